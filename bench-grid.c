@@ -0,0 +1,188 @@
+/*
+ * bench-grid.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+  Benchmark: the memory per cell of the grid and the rate at which text is
+  written into it. Lines of printable text are written with
+  kt_grid_put_chars(), each followed by CR LF, so the screen scrolls into
+  the history as it would with a command printing a lot of output.
+
+  With -r, the history is filled with LINES lines of 0 to 239 characters
+  at 160 columns instead, and the grid resized to a few widths. Each
+  resize is timed, then the idle callbacks counting the rows of the
+  compressed history again are run until none is left. That is done once
+  with plain text and once with every 7th line in wide characters, which
+  are counted cell by cell.
+
+  Usage: bench-grid [MB [COLS ROWS [HISTORY]]]
+         bench-grid -r [LINES]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kt-grid.h"
+#include "kt-util.h"
+
+#define ROWS_RESIZE 50
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Lines of varying length, as in a build log */
+static void run(guint rows, guint cols, guint history, gsize mb)
+{
+        gsize cells = (mb << 20) / sizeof(gunichar);
+        gsize written = 0, lines = 0;
+        gunichar *line;
+        KtGrid *grid;
+        double start, taken;
+        guint i;
+
+        line = g_new(gunichar, cols);
+        for (i = 0; i < cols; i++)
+                line[i] = 'a' + i % 26;
+
+        grid = kt_grid_new(rows, cols, history);
+
+        start = now();
+        while (written < cells) {
+                gsize length = cols / 4 + (lines * 37) % (cols - cols / 4);
+
+                kt_grid_put_chars(grid, line, length);
+                kt_grid_carriage_return(grid);
+                kt_grid_newline(grid);
+
+                written += length;
+                lines++;
+        }
+        taken = now() - start;
+
+        printf("%4ux%-3u history %6u: %7.1f M cells/s %8.1f ns/line  "
+               "%5.1f bytes/cell\n", cols, rows, history,
+               written / taken / 1e6, taken * 1e9 / lines,
+               (double)kt_grid_get_memory(grid) /
+               ((gsize)(rows + MIN(lines, history)) * cols));
+
+        kt_grid_free(grid);
+        g_free(line);
+}
+
+/* Run the idle callbacks until none is left */
+static void idle_drain(guint *calls, double *worst)
+{
+        double start;
+
+        while (g_main_context_pending(NULL)) {
+                start = now();
+                g_main_context_iteration(NULL, FALSE);
+                if (worst)
+                        *worst = MAX(*worst, now() - start);
+                if (calls)
+                        (*calls)++;
+        }
+}
+
+static void run_resize(guint count, gboolean wide)
+{
+        static const guint widths[] = { 120, 200, 97, 160 };
+        gunichar line[240];
+        KtGrid *grid;
+        double start, taken, worst;
+        guint32 seed = 1;
+        guint i, calls, w;
+
+        grid = kt_grid_new(ROWS_RESIZE, 160, count);
+
+        start = now();
+        for (i = 0; i < count; i++) {
+                guint length, j;
+
+                seed = seed * 1103515245 + 12345;
+                length = (seed >> 8) % G_N_ELEMENTS(line);
+                for (j = 0; j < length; j++)
+                        line[j] = wide && i % 7 == 0 ? 0x4e00 + j :
+                                'a' + (i + j) % 26;
+
+                kt_grid_put_chars(grid, line, length);
+                kt_grid_carriage_return(grid);
+                kt_grid_newline(grid);
+
+                /* Let the full blocks be compressed as they would be */
+                if (i % 4096 == 0)
+                        idle_drain(NULL, NULL);
+        }
+        idle_drain(NULL, NULL);
+
+        printf("%s, %u lines in %.1f s, %" G_GUINT64_FORMAT " rows kept, "
+               "%.1f MB:\n", wide ? "1 in 7 lines wide" : "plain text",
+               count, now() - start,
+               kt_grid_get_screen_line(grid) - kt_grid_get_first_line(grid),
+               kt_grid_get_memory(grid) / 1e6);
+
+        for (w = 0; w < G_N_ELEMENTS(widths); w++) {
+                start = now();
+                kt_grid_resize(grid, ROWS_RESIZE, widths[w]);
+                taken = now() - start;
+
+                calls = 0;
+                worst = 0;
+                start = now();
+                idle_drain(&calls, &worst);
+
+                printf("  to %3u cols: resize %6.2f ms, recount %8.1f ms "
+                       "in %5u calls, worst %5.2f ms\n", widths[w],
+                       taken * 1e3, (now() - start) * 1e3, calls,
+                       worst * 1e3);
+        }
+
+        kt_grid_free(grid);
+}
+
+int main(int argc, char **argv)
+{
+        gsize mb = argc > 1 ? atoi(argv[1]) : 64;
+        guint cols = argc > 3 ? atoi(argv[2]) : 200;
+        guint rows = argc > 3 ? atoi(argv[3]) : 50;
+        guint history = argc > 4 ? atoi(argv[4]) : 10000;
+
+        if (argc > 1 && strcmp(argv[1], "-r") == 0) {
+                guint count = argc > 2 ? atoi(argv[2]) : 1000000;
+
+                run_resize(count, FALSE);
+                run_resize(count, TRUE);
+                return 0;
+        }
+
+        printf("%zu bytes per cell, %zu MB of text per run:\n",
+               sizeof(KtCell), mb);
+        run(rows, cols, 0, mb);
+        run(rows, cols, history, mb);
+
+        return 0;
+}
@@ -0,0 +1,215 @@
+/*
+ * bench-parser.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+  Benchmark: the parser's throughput on recorded terminal output, such as
+  a typescript from script(1), and on two made up corpora: plain text like
+  a compiler log, and text with an SGR sequence around every character.
+  The input is fed in slices as large as the ones the terminal hands over,
+  and the callbacks only count what they get, so the time is the parser's
+  alone.
+
+  Each input is parsed with the scalar scan of the text runs and with the
+  one picked for this CPU. The parser is built into the benchmark to get
+  at both.
+
+  Usage: bench-parser [-m MB] [FILE...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kt-parser.c"
+
+#define SLICE (16 * 1024) /* DISPATCH_SLICE in kt-terminal.c */
+#define CORPUS (1024 * 1024)
+
+typedef struct {
+        guint64 fed;
+        guint64 printed;
+        guint64 controls;
+        guint64 sequences;
+} Counts;
+
+static void count_print(const guint8 *data, gsize length, gpointer user_data)
+{
+        ((Counts *)user_data)->printed += length;
+}
+
+static void count_execute(guint8 c, gpointer user_data)
+{
+        ((Counts *)user_data)->controls++;
+}
+
+static void count_esc(const guint8 *intermediates, gsize n_intermediates,
+                      guint8 final, gpointer user_data)
+{
+        ((Counts *)user_data)->sequences++;
+}
+
+static void count_csi(const gint *params, gsize n_params,
+                      const guint8 *intermediates, gsize n_intermediates,
+                      guint8 final, gpointer user_data)
+{
+        ((Counts *)user_data)->sequences++;
+}
+
+static void count_osc(const guint8 *data, gsize length, gpointer user_data)
+{
+        ((Counts *)user_data)->sequences++;
+}
+
+static const KtParserCallbacks callbacks = {
+        .print = count_print,
+        .execute = count_execute,
+        .esc_dispatch = count_esc,
+        .csi_dispatch = count_csi,
+        .osc_dispatch = count_osc,
+};
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Feed data over and over until mb megabytes went through */
+static double feed(const guint8 *data, gsize length, gsize mb,
+                   ScanFunc scan, Counts *counts)
+{
+        KtParser *parser;
+        gsize total = 0, offset;
+        double start, taken;
+
+        parser = kt_parser_new(&callbacks, counts);
+        /* The table, and with it the scan, is set up by the first parser */
+        scan_ground = scan;
+
+        start = now();
+        while (total < (mb << 20)) {
+                for (offset = 0; offset < length; offset += SLICE)
+                        kt_parser_feed(parser, data + offset,
+                                       MIN(SLICE, length - offset));
+                total += length;
+        }
+        taken = now() - start;
+        counts->fed = total;
+
+        kt_parser_free(parser);
+
+        return total / taken / (1 << 20);
+}
+
+static void run(const char *name, const guint8 *data, gsize length, gsize mb)
+{
+        Counts counts = { 0 };
+        double scalar, best;
+
+        scalar = feed(data, length, mb, scan_ground_scalar, &counts);
+        memset(&counts, 0, sizeof(counts));
+        best = feed(data, length, mb, scan_ground_select(), &counts);
+
+        printf("%-24s scalar %7.1f MB/s   simd %7.1f MB/s   "
+               "%3.0f%% printed, %.1f sequences/KB\n", name, scalar, best,
+               100.0 * counts.printed / counts.fed,
+               counts.sequences * 1024.0 / counts.fed);
+}
+
+/* Warnings from a made up build, CR LF ended as on a tty */
+static GString *corpus_plain(void)
+{
+        GString *text = g_string_sized_new(CORPUS + 256);
+        guint i = 0;
+
+        while (text->len < CORPUS) {
+                g_string_append_printf(text,
+                                       "src/module-%u/file-%u.c:%u:%u: "
+                                       "warning: unused variable 'value_%u' "
+                                       "[-Wunused-variable]\r\n",
+                                       i % 17, i % 101, i * 7 % 2000,
+                                       i % 80, i);
+                i++;
+        }
+
+        return text;
+}
+
+/* The same text with its colour changed around every character */
+static GString *corpus_colour(void)
+{
+        GString *plain = corpus_plain();
+        GString *text = g_string_sized_new(CORPUS + 256);
+        gsize i;
+
+        for (i = 0; text->len < CORPUS; i++)
+                g_string_append_printf(text, "\033[1;%um%c\033[0m",
+                                       31 + (guint)(i % 7),
+                                       plain->str[i % plain->len]);
+
+        g_string_free(plain, TRUE);
+
+        return text;
+}
+
+int main(int argc, char **argv)
+{
+        gsize mb = 256;
+        GString *corpus;
+        gint i = 1;
+
+        if (argc > 2 && strcmp(argv[1], "-m") == 0) {
+                mb = atoi(argv[2]);
+                i = 3;
+        }
+
+        printf("%zu MB per input:\n", mb);
+
+        corpus = corpus_plain();
+        run("plain text", (const guint8 *)corpus->str, corpus->len, mb);
+        g_string_free(corpus, TRUE);
+
+        corpus = corpus_colour();
+        run("SGR around every char", (const guint8 *)corpus->str,
+            corpus->len, mb);
+        g_string_free(corpus, TRUE);
+
+        for (; i < argc; i++) {
+                GError *error = NULL;
+                gchar *data;
+                gsize length;
+
+                if (!g_file_get_contents(argv[i], &data, &length, &error)) {
+                        fprintf(stderr, "%s\n", error->message);
+                        g_error_free(error);
+                        return 1;
+                }
+
+                if (length > 0)
+                        run(argv[i], (const guint8 *)data, length, mb);
+                g_free(data);
+        }
+
+        return 0;
+}
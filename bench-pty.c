@@ -0,0 +1,147 @@
+/*
+ * bench-pty.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+  Benchmark: pty throughput of the read backends. For each of them a shell
+  writes MB megabytes to the terminal, a sink swallows the output, and the
+  terminal's counters and the CPU time of the process are reported.
+
+  Usage: bench-pty [MB [poll|thread|io_uring]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include "kt-terminal.h"
+
+typedef struct {
+        GMainLoop *loop;
+        gsize want;
+        gsize got;
+} Run;
+
+static gsize count_sink(KtTerminal *term,
+                        const guint8 *data,
+                        gsize length,
+                        Run *run)
+{
+        run->got += length;
+        if (run->got >= run->want)
+                g_main_loop_quit(run->loop);
+
+        return length;
+}
+
+static double cpu_seconds(void)
+{
+        struct rusage ru;
+
+        getrusage(RUSAGE_SELF, &ru);
+        return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+                (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void run(const char *name, KtPrefs *prefs, gsize mb)
+{
+        KtTerminalSink sink = {
+                .data = (gpointer)count_sink,
+        };
+        KtTerminalStats stats;
+        KtTerminal *term;
+        Run run = { 0, };
+        gchar *cmd;
+        gint64 start;
+        double cpu, secs;
+        guint64 syscalls;
+
+        run.loop = g_main_loop_new(NULL, FALSE);
+        run.want = mb << 20;
+
+        term = kt_terminal_new(prefs, XCB_WINDOW_NONE);
+        if (term == NULL) {
+                printf("%-9s could not start a shell\n", name);
+                return;
+        }
+        kt_terminal_set_sink(term, &sink, &run);
+
+        cmd = g_strdup_printf("exec head -c %zu /dev/zero\n", run.want);
+        kt_terminal_write(term, cmd, strlen(cmd));
+        g_free(cmd);
+
+        start = g_get_monotonic_time();
+        cpu = cpu_seconds();
+        g_main_loop_run(run.loop);
+        cpu = cpu_seconds() - cpu;
+        secs = (g_get_monotonic_time() - start) / 1e6;
+
+        kt_terminal_get_stats(term, &stats);
+        g_object_unref(term);
+        g_main_loop_unref(run.loop);
+
+        if (prefs->io_uring && stats.submit_calls == 0) {
+                printf("%-9s not available\n", name);
+                return;
+        }
+
+        syscalls = stats.read_calls + stats.submit_calls + stats.wakeups;
+        printf("%-9s %7.1f MB/s  %5.2f s cpu  %8" G_GUINT64_FORMAT
+               " reads %8" G_GUINT64_FORMAT " submits %8" G_GUINT64_FORMAT
+               " wakeups  %6.0f bytes/syscall  %" G_GUINT64_FORMAT
+               " budget hits\n", name, mb / secs, cpu, stats.read_calls,
+               stats.submit_calls, stats.wakeups,
+               (double)stats.bytes_read / syscalls, stats.budget_hits);
+}
+
+int main(int argc, char **argv)
+{
+        gsize mb = argc > 1 ? atoi(argv[1]) : 256;
+        const gchar *only = argc > 2 ? argv[2] : NULL;
+        KtPrefs *prefs;
+
+        /* A predictable shell without rc files */
+        setenv("SHELL", "/bin/sh", 1);
+        unsetenv("ENV");
+
+        prefs = kt_prefs_new();
+
+        printf("%zu MB through the pty, %u byte ring, %u byte budget:\n",
+               mb, prefs->ring_size, prefs->read_budget_bytes);
+
+        if (only == NULL || g_str_equal(only, "poll"))
+                run("poll", prefs, mb);
+
+        if (only == NULL || g_str_equal(only, "thread")) {
+                prefs->threaded_reader = TRUE;
+                run("thread", prefs, mb);
+                prefs->threaded_reader = FALSE;
+        }
+
+        if (only == NULL || g_str_equal(only, "io_uring")) {
+                prefs->io_uring = TRUE;
+                run("io_uring", prefs, mb);
+                prefs->io_uring = FALSE;
+        }
+
+        g_object_unref(prefs);
+
+        return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * bench-sink.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+  Micro-benchmark: the cost per chunk of handing pty output to its
+  consumer. Before the sink every chunk was wrapped in a KtBuffer and
+  emitted as "got-tty-data"; the sink is a plain call on the ring data.
+
+  The signal column wraps the chunks with the kt_buffer_new() of this
+  tree, which takes its blocks from a pool. That is cheaper than the
+  allocation per chunk there was before the sink, so the column is not
+  the cost the sink replaced, only the signal path as it stands.
+
+  Usage: bench-sink [MB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "kt-terminal.h"
+
+#define DATA_SIZE (1024 * 1024)
+
+static guint8 data[DATA_SIZE];
+/* Kept, so that the work on the data isn't optimised away */
+static volatile guint sum;
+
+/* The same work for both: look at the data once */
+static void consume(const guint8 *chunk, gsize length)
+{
+        sum += chunk[0] + chunk[length - 1] + length;
+}
+
+static void got_tty_data_cb(KtTerminal *term, KtBuffer *buffer, gpointer data)
+{
+        consume((const guint8 *)buffer->data, buffer->length);
+}
+
+static gsize sink_cb(KtTerminal *term,
+                     const guint8 *chunk,
+                     gsize length,
+                     gpointer user_data)
+{
+        consume(chunk, length);
+
+        return length;
+}
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(KtTerminal *term, guint signal_id, gsize chunk, gsize mb)
+{
+        /* Called through a pointer, as in terminal_dispatch() */
+        static volatile KtTerminalSink sink = {
+                .data = sink_cb,
+        };
+        gsize chunks = (mb << 20) / chunk;
+        double start, emit, call;
+        gsize i;
+
+        start = now();
+        for (i = 0; i < chunks; i++) {
+                gsize offset = (i * chunk) % (DATA_SIZE - chunk);
+                KtBuffer *buffer = kt_buffer_new(data + offset, chunk);
+
+                g_signal_emit(term, signal_id, 0, buffer);
+                kt_buffer_free(buffer);
+        }
+        emit = now() - start;
+
+        start = now();
+        for (i = 0; i < chunks; i++) {
+                gsize offset = (i * chunk) % (DATA_SIZE - chunk);
+
+                sink.data(term, data + offset, chunk, NULL);
+        }
+        call = now() - start;
+
+        printf("%5zu byte chunks: signal %6.1f ns   sink %6.1f ns\n", chunk,
+               emit * 1e9 / chunks, call * 1e9 / chunks);
+}
+
+int main(int argc, char **argv)
+{
+        static const gsize chunks[] = { 64, 512, 4096, 16384 };
+        gsize mb = argc > 1 ? atoi(argv[1]) : 256;
+        KtTerminal *term;
+        KtPrefs *prefs;
+        guint i;
+
+        /* The terminal only serves as the emitter, its shell stays idle */
+        setenv("SHELL", "/bin/sh", 1);
+        prefs = kt_prefs_new();
+        term = kt_terminal_new(prefs, XCB_WINDOW_NONE);
+        if (term == NULL)
+                return 1;
+
+        g_signal_connect(term, "got-tty-data",
+                         G_CALLBACK(got_tty_data_cb), NULL);
+
+        for (i = 0; i < DATA_SIZE; i++)
+                data[i] = i * 7;
+
+        printf("%zu MB per run, per chunk:\n", mb);
+        for (i = 0; i < G_N_ELEMENTS(chunks); i++)
+                run(term, g_signal_lookup("got-tty-data", KT_TERMINAL_TYPE),
+                    chunks[i], mb);
+
+        g_object_unref(term);
+        g_object_unref(prefs);
+
+        printf("checksum %u\n", sum);
+
+        return 0;
+}
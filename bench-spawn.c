@@ -0,0 +1,143 @@
+/*
+ * bench-spawn.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+  Benchmark: the cost of spawning a shell from a parent with a large
+  resident set. fork() copies the page tables, so its cost grows with our
+  RSS; posix_spawn() does not. The memory is a plain mapping that is
+  touched once, in small pages like the many small blocks of a full
+  scrollback.
+
+  "fork" is the old path: g_spawn_async_with_pipes() with a child setup
+  function, which makes GLib fork(). "kt_pty_spawn" is the current one.
+
+  Usage: bench-spawn [MB [SPAWNS]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "kt-pty.h"
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void child_setup_cb(gpointer data)
+{
+        setsid();
+}
+
+static double spawn_fork(gchar **args)
+{
+        GError *error = NULL;
+        double start, taken;
+        GPid pid;
+
+        start = now();
+        if (!g_spawn_async_with_pipes(NULL, args, NULL,
+                                      G_SPAWN_DO_NOT_REAP_CHILD,
+                                      child_setup_cb, NULL, &pid,
+                                      NULL, NULL, NULL, &error)) {
+                fprintf(stderr, "Spawn failed: %s\n", error->message);
+                exit(1);
+        }
+        taken = now() - start;
+
+        waitpid(pid, NULL, 0);
+
+        return taken;
+}
+
+static double spawn_pty(KtPrefs *prefs)
+{
+        double start, taken;
+        KtPty *pty;
+
+        pty = kt_pty_new(prefs, XCB_WINDOW_NONE);
+        if (pty == NULL)
+                exit(1);
+
+        start = now();
+        if (!kt_pty_spawn(pty, NULL))
+                exit(1);
+        taken = now() - start;
+
+        waitpid(kt_pty_get_child_pid(pty), NULL, 0);
+        g_object_unref(pty);
+
+        return taken;
+}
+
+static void run(KtPrefs *prefs, gsize mb, guint spawns)
+{
+        gchar *args[] = { "/bin/true", NULL };
+        double fork_time = 0, pty_time = 0;
+        guint i;
+
+        for (i = 0; i < spawns; i++) {
+                fork_time += spawn_fork(args);
+                pty_time += spawn_pty(prefs);
+        }
+
+        printf("%5zu MB resident: fork %8.1f us   kt_pty_spawn %8.1f us\n",
+               mb, fork_time * 1e6 / spawns, pty_time * 1e6 / spawns);
+}
+
+int main(int argc, char **argv)
+{
+        gsize mb = argc > 1 ? atoi(argv[1]) : 1024;
+        guint spawns = argc > 2 ? atoi(argv[2]) : 50;
+        KtPrefs *prefs;
+        guint8 *memory;
+
+        /* kt_pty_spawn() runs $SHELL */
+        setenv("SHELL", "/bin/true", 1);
+        prefs = kt_prefs_new();
+
+        printf("%u spawns per run, time per spawn:\n", spawns);
+        run(prefs, 0, spawns);
+
+        memory = mmap(NULL, mb << 20, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+                fprintf(stderr, "Could not allocate %zu MB.\n", mb);
+                return 1;
+        }
+        /* Huge pages would hide most of the page table copy */
+        madvise(memory, mb << 20, MADV_NOHUGEPAGE);
+        memset(memory, 1, mb << 20);
+        run(prefs, mb, spawns);
+
+        munmap(memory, mb << 20);
+        g_object_unref(prefs);
+
+        return 0;
+}
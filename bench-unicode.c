@@ -0,0 +1,140 @@
+/*
+ * bench-unicode.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+  Micro-benchmark: kt_unicode_width() against the C library's wcwidth()
+  over a few kinds of text, and the code points where they disagree.
+
+  Usage: bench-unicode [PASSES]
+ */
+
+#define _XOPEN_SOURCE 700
+#include <stdio.h>
+#include <stdlib.h>
+#include <locale.h>
+#include <wchar.h>
+#include <time.h>
+
+#include "kt-unicode.h"
+
+#define CORPUS 65536
+
+static gunichar corpus[CORPUS];
+
+/* Every nth code point from the ranges, over and over */
+static void fill(const gunichar (*ranges)[2], guint n_ranges)
+{
+        guint i, r = 0;
+        gunichar c = ranges[0][0];
+
+        for (i = 0; i < CORPUS; i++) {
+                corpus[i] = c;
+                c += 7;
+                if (c > ranges[r][1]) {
+                        r = (r + 1) % n_ranges;
+                        c = ranges[r][0] + i % 5;
+                }
+        }
+}
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char *name, guint passes)
+{
+        double start, table, libc;
+        guint pass, i;
+        long sum = 0;
+
+        start = now();
+        for (pass = 0; pass < passes; pass++)
+                for (i = 0; i < CORPUS; i++)
+                        sum += kt_unicode_width(corpus[i]);
+        table = now() - start;
+
+        start = now();
+        for (pass = 0; pass < passes; pass++)
+                for (i = 0; i < CORPUS; i++)
+                        sum += wcwidth(corpus[i]);
+        libc = now() - start;
+
+        printf("%-10s table %6.2f ns   wcwidth %6.2f ns   (%ld)\n", name,
+               table * 1e9 / passes / CORPUS, libc * 1e9 / passes / CORPUS,
+               sum & 1);
+}
+
+int main(int argc, char **argv)
+{
+        static const gunichar ascii[][2] = { { 0x20, 0x7e } };
+        static const gunichar latin[][2] = {
+                { 0x20, 0x7e }, { 0xa0, 0x17f }, { 0x300, 0x36f },
+                { 0x400, 0x4ff },
+        };
+        static const gunichar cjk[][2] = {
+                { 0x3040, 0x30ff }, { 0x4e00, 0x9fff }, { 0xac00, 0xd7a3 },
+                { 0xff00, 0xffef },
+        };
+        static const gunichar emoji[][2] = {
+                { 0x2600, 0x27bf }, { 0x1f300, 0x1faff }, { 0xfe00, 0xfe0f },
+                { 0x1f1e6, 0x1f1ff },
+        };
+        static const gunichar all[][2] = { { 0, 0x10ffff } };
+        guint passes = argc > 1 ? atoi(argv[1]) : 200;
+        guint differ = 0;
+        gunichar c;
+
+        if (!setlocale(LC_CTYPE, "") || MB_CUR_MAX == 1)
+                setlocale(LC_CTYPE, "C.UTF-8");
+
+        printf("Unicode %s, %u byte table, per code point:\n",
+               KT_UNICODE_VERSION, (guint) (sizeof(KtUnicodeIndex) *
+               (0x110000 >> KT_UNICODE_SHIFT) +
+               (KT_UNICODE_BLOCKS << KT_UNICODE_SHIFT)));
+
+        fill(ascii, G_N_ELEMENTS(ascii));
+        run("ascii", passes);
+        fill(latin, G_N_ELEMENTS(latin));
+        run("latin", passes);
+        fill(cjk, G_N_ELEMENTS(cjk));
+        run("cjk", passes);
+        fill(emoji, G_N_ELEMENTS(emoji));
+        run("emoji", passes);
+        fill(all, G_N_ELEMENTS(all));
+        run("all", passes);
+
+        /* Controls are -1 to wcwidth and 0 here, that is no news */
+        for (c = 0; c <= 0x10ffff; c++) {
+                int w = wcwidth(c);
+
+                if (w >= 0 && (guint) w != kt_unicode_width(c) &&
+                    differ++ < 16)
+                        printf("U+%04X: table %u, wcwidth %d\n", c,
+                               kt_unicode_width(c), w);
+        }
+        printf("%u code points differ from wcwidth\n", differ);
+
+        return 0;
+}
@@ -0,0 +1,245 @@
+/*
+ * bench-utf8.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+  Benchmark: the UTF-8 decoder on ASCII, CJK and emoji text, with the
+  scalar decoder alone and with the SIMD paths, and a check that cutting
+  the input anywhere doesn't change the result. The check also runs on a
+  corpus with invalid bytes mixed in, against the scalar decoder fed the
+  whole input at once. The decoder is built into the benchmark to get at
+  the scalar one.
+
+  Usage: bench-utf8 [MB [SPLITS]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kt-utf8.c"
+
+#define SLICE (16 * 1024) /* DISPATCH_SLICE in kt-terminal.c */
+#define CORPUS (1024 * 1024)
+
+static gunichar decoded[SLICE + 1];
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Code points from the ranges, with a space or a newline now and then */
+static GString *corpus_new(GRand *rand, const gunichar (*ranges)[2],
+                           guint n_ranges)
+{
+        GString *text = g_string_sized_new(CORPUS + 8);
+
+        while (text->len < CORPUS) {
+                guint r = g_rand_int_range(rand, 0, n_ranges);
+                gunichar c = g_rand_int_range(rand, ranges[r][0],
+                                              ranges[r][1] + 1);
+
+                g_string_append_unichar(text, c);
+                if (g_rand_int_range(rand, 0, 16) == 0)
+                        g_string_append_c(text,
+                                          g_rand_boolean(rand) ? ' ' : '\n');
+        }
+
+        return text;
+}
+
+/* Valid text with bytes overwritten, dropped and truncated sequences */
+static GString *corpus_broken(GRand *rand, const GString *valid)
+{
+        GString *text = g_string_new_len(valid->str, valid->len);
+        guint i;
+
+        for (i = 0; i < text->len / 64; i++) {
+                gsize at = g_rand_int_range(rand, 0, text->len);
+
+                if (g_rand_boolean(rand))
+                        text->str[at] = g_rand_int_range(rand, 0x80, 0x100);
+                else
+                        g_string_erase(text, at, 1);
+        }
+
+        return text;
+}
+
+static double decode_scalar(const guint8 *data, gsize length, gsize mb,
+                            guint64 *count)
+{
+        gsize total = 0, offset;
+        double start;
+        KtUtf8 dec;
+
+        kt_utf8_init(&dec);
+
+        start = now();
+        while (total < (mb << 20)) {
+                for (offset = 0; offset < length; offset += SLICE) {
+                        const guint8 *p = data + offset;
+
+                        *count += utf8_decode_scalar(&dec, p,
+                                                     p + MIN(SLICE,
+                                                             length - offset),
+                                                     decoded);
+                }
+                total += length;
+        }
+
+        return total / (now() - start) / (1 << 20);
+}
+
+static double decode_simd(const guint8 *data, gsize length, gsize mb,
+                          guint64 *count)
+{
+        gsize total = 0, offset;
+        double start;
+        KtUtf8 dec;
+
+        kt_utf8_init(&dec);
+
+        start = now();
+        while (total < (mb << 20)) {
+                for (offset = 0; offset < length; offset += SLICE)
+                        *count += kt_utf8_decode(&dec, data + offset,
+                                                 MIN(SLICE, length - offset),
+                                                 decoded);
+                total += length;
+        }
+
+        return total / (now() - start) / (1 << 20);
+}
+
+/**
+ * check_splits: Decode data cut at random places, splits times, and
+ * compare with the scalar decoder on all of it.
+ *
+ * Returns: The number of runs that differed.
+ */
+static guint check_splits(GRand *rand, const guint8 *data, gsize length,
+                          guint splits)
+{
+        gunichar *want = g_new(gunichar, length + 1);
+        gunichar *got = g_new(gunichar, length + 1);
+        gsize n_want, n_got, offset;
+        guint split, bad = 0;
+        KtUtf8 dec;
+
+        kt_utf8_init(&dec);
+        n_want = utf8_decode_scalar(&dec, data, data + length, want);
+        n_want += kt_utf8_flush(&dec, want + n_want);
+
+        for (split = 0; split < splits; split++) {
+                kt_utf8_init(&dec);
+                n_got = 0;
+                for (offset = 0; offset < length; ) {
+                        /* Mostly short pieces, some past a whole block */
+                        gsize piece = g_rand_int_range(rand, 1,
+                                                       g_rand_boolean(rand) ?
+                                                       8 : 4 * VALIDATE_BLOCK);
+
+                        piece = MIN(piece, length - offset);
+                        n_got += kt_utf8_decode(&dec, data + offset, piece,
+                                                got + n_got);
+                        offset += piece;
+                }
+                n_got += kt_utf8_flush(&dec, got + n_got);
+
+                if (n_got != n_want ||
+                    memcmp(got, want, n_want * sizeof(gunichar)) != 0)
+                        bad++;
+        }
+
+        g_free(want);
+        g_free(got);
+
+        return bad;
+}
+
+static guint run(GRand *rand, const char *name, const GString *text,
+                 gsize mb, guint splits)
+{
+        const guint8 *data = (const guint8 *)text->str;
+        guint64 count_scalar = 0, count_simd = 0;
+        double scalar, simd;
+        guint bad;
+
+        scalar = decode_scalar(data, text->len, mb, &count_scalar);
+        simd = decode_simd(data, text->len, mb, &count_simd);
+        bad = check_splits(rand, data, text->len, splits);
+
+        printf("%-8s scalar %7.1f MB/s   simd %7.1f MB/s   "
+               "%u of %u splits differ%s\n", name, scalar, simd, bad, splits,
+               count_scalar == count_simd ? "" : ", counts differ");
+
+        return bad + (count_scalar != count_simd);
+}
+
+int main(int argc, char **argv)
+{
+        static const gunichar ascii[][2] = { { 0x21, 0x7e } };
+        static const gunichar cjk[][2] = {
+                { 0x3040, 0x30ff }, { 0x4e00, 0x9fff }, { 0xac00, 0xd7a3 },
+        };
+        static const gunichar emoji[][2] = {
+                { 0x1f300, 0x1f5ff }, { 0x1f600, 0x1f64f },
+                { 0x1f680, 0x1f6ff }, { 0x2600, 0x27bf },
+        };
+        static const gunichar mixed[][2] = {
+                { 0x21, 0x7e }, { 0xa0, 0x7ff }, { 0x4e00, 0x9fff },
+                { 0x1f300, 0x1f64f },
+        };
+        gsize mb = argc > 1 ? atoi(argv[1]) : 256;
+        guint splits = argc > 2 ? atoi(argv[2]) : 20;
+        GRand *rand = g_rand_new_with_seed(1);
+        GString *text, *broken;
+        guint bad = 0;
+
+        printf("%zu MB per corpus, decoded in %u byte slices:\n", mb, SLICE);
+
+        text = corpus_new(rand, ascii, G_N_ELEMENTS(ascii));
+        bad += run(rand, "ascii", text, mb, splits);
+        g_string_free(text, TRUE);
+
+        text = corpus_new(rand, cjk, G_N_ELEMENTS(cjk));
+        bad += run(rand, "cjk", text, mb, splits);
+        g_string_free(text, TRUE);
+
+        text = corpus_new(rand, emoji, G_N_ELEMENTS(emoji));
+        bad += run(rand, "emoji", text, mb, splits);
+        g_string_free(text, TRUE);
+
+        text = corpus_new(rand, mixed, G_N_ELEMENTS(mixed));
+        broken = corpus_broken(rand, text);
+        bad += run(rand, "invalid", broken, mb, splits);
+        g_string_free(broken, TRUE);
+        g_string_free(text, TRUE);
+
+        g_rand_free(rand);
+
+        return bad > 0;
+}
@@ -0,0 +1,370 @@
+/*
+ * gen-unicode.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+/*
+  Build tool: reads the Unicode Character Database files in a directory
+  and writes kt-unicode-table.h, the two stage property table that
+  kt-unicode.h looks code points up in.
+
+  Usage: gen-unicode VERSION DIR > kt-unicode-table.h
+
+  Every file must be of the given Unicode version, so that the version in
+  the Makefile is the only input to bump.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define KT_UNICODE_GEN
+#include "kt-unicode.h"
+
+#define CODE_POINTS 0x110000
+#define SHIFT_MIN 4
+#define SHIFT_MAX 12
+
+static const char *version;
+static const char *dir;
+
+/* General categories that matter for the width */
+enum {
+        GC_OTHER,
+        GC_MARK,
+        GC_FORMAT,
+        GC_CONTROL,
+};
+
+static unsigned char gc[CODE_POINTS];
+static unsigned char wide[CODE_POINTS];
+static unsigned char gcb[CODE_POINTS];
+static unsigned char pictographic[CODE_POINTS];
+static unsigned char props[CODE_POINTS];
+
+static const struct {
+        const char *name;
+        KtGraphemeBreak value;
+} gcb_names[] = {
+        { "CR", KT_GCB_CR },
+        { "LF", KT_GCB_LF },
+        { "Control", KT_GCB_CONTROL },
+        { "Extend", KT_GCB_EXTEND },
+        { "ZWJ", KT_GCB_ZWJ },
+        { "Regional_Indicator", KT_GCB_REGIONAL_INDICATOR },
+        { "Prepend", KT_GCB_PREPEND },
+        { "SpacingMark", KT_GCB_SPACING_MARK },
+        { "L", KT_GCB_L },
+        { "V", KT_GCB_V },
+        { "T", KT_GCB_T },
+        { "LV", KT_GCB_LV },
+        { "LVT", KT_GCB_LVT },
+};
+
+static void die(const char *format, const char *arg)
+{
+        fprintf(stderr, "gen-unicode: ");
+        fprintf(stderr, format, arg);
+        fprintf(stderr, "\n");
+        exit(1);
+}
+
+static char *trim(char *s)
+{
+        char *end;
+
+        while (isspace((unsigned char) *s))
+                s++;
+
+        end = s + strlen(s);
+        while (end > s && isspace((unsigned char) end[-1]))
+                *--end = '\0';
+
+        return s;
+}
+
+/* "Emoji Version 14.0" for Unicode 14.0.0 */
+static void emoji_version(char *buf, size_t size)
+{
+        const char *dot = strchr(version, '.');
+        int length = strlen(version);
+
+        if (dot && strchr(dot + 1, '.'))
+                length = strchr(dot + 1, '.') - version;
+
+        snprintf(buf, size, "Emoji Version %.*s", length, version);
+}
+
+/**
+ * parse: Call set for every "first..last ; value" line of a UCD file,
+ * after checking the version in its header.
+ */
+static void parse(const char *name,
+                  void (*set)(unsigned first, unsigned last,
+                              const char *value))
+{
+        char path[4096];
+        char line[1024];
+        char expected[256];
+        char emoji[256];
+        FILE *file;
+        int versioned = 0;
+
+        snprintf(path, sizeof(path), "%s/%s.txt", dir, name);
+        file = fopen(path, "r");
+        if (!file)
+                die("Cannot open %s", path);
+
+        snprintf(expected, sizeof(expected), "%s-%s.txt", name, version);
+        emoji_version(emoji, sizeof(emoji));
+
+        while (fgets(line, sizeof(line), file)) {
+                char *field, *value, *hash, *dots;
+                unsigned first, last;
+
+                /* The version is in the header, emoji-data.txt gives
+                   only the major and minor ones */
+                if (line[0] == '#') {
+                        if (strstr(line, expected) || strstr(line, emoji))
+                                versioned = 1;
+                        continue;
+                }
+
+                hash = strchr(line, '#');
+                if (hash)
+                        *hash = '\0';
+
+                value = strchr(line, ';');
+                if (!value)
+                        continue;
+                *value++ = '\0';
+
+                if (!versioned)
+                        die("%s is not of the expected Unicode version",
+                            path);
+
+                /* emoji-data.txt has no further fields, others might */
+                field = strchr(value, ';');
+                if (field)
+                        *field = '\0';
+
+                field = trim(line);
+                first = strtoul(field, &dots, 16);
+                last = first;
+                if (dots[0] == '.' && dots[1] == '.')
+                        last = strtoul(dots + 2, NULL, 16);
+
+                if (last >= CODE_POINTS || first > last)
+                        die("Bad range in %s", path);
+
+                set(first, last, trim(value));
+        }
+
+        fclose(file);
+}
+
+static void set_gc(unsigned first, unsigned last, const char *value)
+{
+        unsigned char v = GC_OTHER;
+
+        if (strcmp(value, "Mn") == 0 || strcmp(value, "Me") == 0)
+                v = GC_MARK;
+        else if (strcmp(value, "Cf") == 0)
+                v = GC_FORMAT;
+        else if (strcmp(value, "Cc") == 0 || strcmp(value, "Zl") == 0 ||
+                 strcmp(value, "Zp") == 0)
+                v = GC_CONTROL;
+
+        memset(gc + first, v, last - first + 1);
+}
+
+static void set_wide(unsigned first, unsigned last, const char *value)
+{
+        if (strcmp(value, "W") == 0 || strcmp(value, "F") == 0)
+                memset(wide + first, 1, last - first + 1);
+}
+
+static void set_gcb(unsigned first, unsigned last, const char *value)
+{
+        size_t i;
+
+        for (i = 0; i < sizeof(gcb_names) / sizeof(gcb_names[0]); i++) {
+                if (strcmp(value, gcb_names[i].name) == 0) {
+                        memset(gcb + first, gcb_names[i].value,
+                               last - first + 1);
+                        return;
+                }
+        }
+
+        die("Unknown grapheme break value %s", value);
+}
+
+static void set_pictographic(unsigned first, unsigned last,
+                             const char *value)
+{
+        if (strcmp(value, "Extended_Pictographic") == 0)
+                memset(pictographic + first, 1, last - first + 1);
+}
+
+static unsigned width(unsigned c)
+{
+        /* The soft hyphen is shown, Hangul jamo after the first join it */
+        if (c == 0x00ad)
+                return 1;
+        if (gc[c] != GC_OTHER || gcb[c] == KT_GCB_V || gcb[c] == KT_GCB_T)
+                return 0;
+        if (wide[c] || gcb[c] == KT_GCB_REGIONAL_INDICATOR)
+                return 2;
+        return 1;
+}
+
+/* Blocks are deduplicated through an open addressing hash of index + 1 */
+static unsigned block_hash(const unsigned char *block, unsigned size)
+{
+        unsigned h = 2166136261u;
+        unsigned i;
+
+        for (i = 0; i < size; i++)
+                h = (h ^ block[i]) * 16777619u;
+
+        return h;
+}
+
+/**
+ * split: Split the properties in blocks of 1 << shift code points.
+ *
+ * Returns: The number of distinct blocks, index holding the block of
+ * every range and blocks their first occurrences, in order.
+ */
+static unsigned split(unsigned shift, unsigned *index, unsigned *blocks)
+{
+        unsigned size = 1u << shift;
+        unsigned n = CODE_POINTS >> shift;
+        unsigned mask = 1;
+        unsigned *slots;
+        unsigned unique = 0;
+        unsigned i;
+
+        while (mask < 2 * n)
+                mask <<= 1;
+        slots = calloc(mask--, sizeof(unsigned));
+        if (!slots)
+                die("Out of memory%s", "");
+
+        for (i = 0; i < n; i++) {
+                const unsigned char *block = props + i * size;
+                unsigned slot = block_hash(block, size) & mask;
+
+                while (slots[slot] &&
+                       memcmp(props + blocks[slots[slot] - 1] * size,
+                              block, size) != 0)
+                        slot = (slot + 1) & mask;
+
+                if (!slots[slot]) {
+                        blocks[unique++] = i;
+                        slots[slot] = unique;
+                }
+                index[i] = slots[slot] - 1;
+        }
+
+        free(slots);
+        return unique;
+}
+
+static void print_bytes(const char *type, const char *name,
+                        const unsigned *values, unsigned n)
+{
+        unsigned i;
+
+        printf("const %s %s[%u] = {", type, name, n);
+        for (i = 0; i < n; i++)
+                printf("%s%u,", i % 16 ? " " : "\n        ", values[i]);
+        printf("\n};\n");
+}
+
+int main(int argc, char **argv)
+{
+        unsigned *index, *blocks, *values;
+        unsigned best_shift = 0, best_size = 0, unique;
+        unsigned shift, size, n, c, i;
+
+        if (argc != 3) {
+                fprintf(stderr, "Usage: %s VERSION DIR\n", argv[0]);
+                return 1;
+        }
+        version = argv[1];
+        dir = argv[2];
+
+        parse("DerivedGeneralCategory", set_gc);
+        parse("EastAsianWidth", set_wide);
+        parse("GraphemeBreakProperty", set_gcb);
+        parse("emoji-data", set_pictographic);
+
+        for (c = 0; c < CODE_POINTS; c++)
+                props[c] = width(c) | gcb[c] << KT_UNICODE_GCB_SHIFT |
+                        (pictographic[c] ? KT_UNICODE_PICTOGRAPHIC : 0);
+
+        index = malloc((CODE_POINTS >> SHIFT_MIN) * sizeof(unsigned));
+        blocks = malloc((CODE_POINTS >> SHIFT_MIN) * sizeof(unsigned));
+        if (!index || !blocks)
+                die("Out of memory%s", "");
+
+        /* The smallest pair of stages wins */
+        for (shift = SHIFT_MIN; shift <= SHIFT_MAX; shift++) {
+                n = CODE_POINTS >> shift;
+                unique = split(shift, index, blocks);
+                size = n * (unique <= 256 ? 1 : 2) + (unique << shift);
+                if (!best_shift || size < best_size) {
+                        best_shift = shift;
+                        best_size = size;
+                }
+        }
+
+        shift = best_shift;
+        n = CODE_POINTS >> shift;
+        unique = split(shift, index, blocks);
+
+        printf("/* Generated by gen-unicode from the Unicode %s character "
+               "database, do not edit */\n\n", version);
+        printf("#define KT_UNICODE_VERSION \"%s\"\n", version);
+        printf("#define KT_UNICODE_SHIFT %u\n", shift);
+        printf("#define KT_UNICODE_BLOCKS %u\n\n", unique);
+        printf("typedef %s KtUnicodeIndex;\n\n",
+               unique <= 256 ? "guint8" : "guint16");
+        printf("#ifdef KT_UNICODE_TABLE_DATA\n");
+
+        print_bytes("KtUnicodeIndex", "kt_unicode_stage1", index, n);
+
+        size = 1u << shift;
+        values = malloc(unique * size * sizeof(unsigned));
+        if (!values)
+                die("Out of memory%s", "");
+        for (i = 0; i < unique * size; i++)
+                values[i] = props[blocks[i / size] * size + i % size];
+        print_bytes("guint8", "kt_unicode_stage2", values, unique * size);
+
+        printf("#endif /* KT_UNICODE_TABLE_DATA */\n");
+
+        free(values);
+        free(blocks);
+        free(index);
+
+        return 0;
+}
@@ -507,3 +507,13 @@ xcb_cursor_t kt_app_get_hidden_cursor(KtApp *app)
         return priv->cursor[CUR_HIDDEN];
 }
 
+xcb_key_symbols_t *kt_app_get_key_symbols(KtApp *app)
+{
+        KtAppPrivate *priv;
+
+        g_return_val_if_fail(KT_IS_APP(app), NULL);
+
+        priv = app->priv;
+
+        return priv->key_symbols;
+}
@@ -64,6 +64,7 @@ gint kt_app_get_xfd(KtApp *app);
 const gchar *kt_app_get_display_name(KtApp *app);
 xcb_cursor_t kt_app_get_normal_cursor(KtApp *app);
 xcb_cursor_t kt_app_get_hidden_cursor(KtApp *app);
+xcb_key_symbols_t *kt_app_get_key_symbols(KtApp *app);
 
 G_END_DECLS
 #endif /* KT_APP_H */
@@ -21,30 +21,158 @@
  */
 
 #include "kt-buffer.h"
+#include "kt-util.h"
+
+/* Data is packed into blocks of this size, bigger buffers get their own. */
+#define BLOCK_SIZE (64 * 1024)
+/* Number of free blocks kept around for reuse */
+#define BLOCK_POOL_MAX 16
+
+typedef struct _KtBufferBlock KtBufferBlock;
+
+struct _KtBufferBlock {
+        gint refcount;
+        gsize size;
+        KtBufferBlock *next; /* free list */
+        guint8 data[];
+};
 
 typedef struct {
         KtBuffer buffer;
         gint refcount;
+        KtBufferBlock *block;
 } KtBufferPriv;
 
 G_DEFINE_BOXED_TYPE(KtBuffer, kt_buffer, kt_buffer_copy, kt_buffer_free)
 
-KtBuffer * kt_buffer_new(gconstpointer data, gsize length)
+/* The pool and the block currently being filled. */
+G_LOCK_DEFINE_STATIC(pool);
+static KtBufferBlock *pool_free = NULL;
+static guint pool_free_count = 0;
+static KtBufferBlock *pool_current = NULL;
+static gsize pool_current_used = 0;
+
+/* Private methods */
+static KtBufferBlock *block_new(gsize size)
+{
+        KtBufferBlock *block = NULL;
+
+        if (size == BLOCK_SIZE && pool_free) {
+                block = pool_free;
+                pool_free = block->next;
+                pool_free_count--;
+        }
+
+        if (block == NULL) {
+                block = g_malloc(sizeof(KtBufferBlock) + size);
+                block->size = size;
+        }
+
+        block->refcount = 1;
+        block->next = NULL;
+
+        return block;
+}
+
+static void block_unref(KtBufferBlock *block)
 {
-        KtBufferPriv *priv = g_slice_new0(KtBufferPriv);
+        if (!g_atomic_int_dec_and_test(&block->refcount))
+                return;
+
+        G_LOCK(pool);
+        if (block->size == BLOCK_SIZE && pool_free_count < BLOCK_POOL_MAX) {
+                block->next = pool_free;
+                pool_free = block;
+                pool_free_count++;
+                block = NULL;
+        }
+        G_UNLOCK(pool);
 
-        priv->buffer.data = data;
+        g_free(block);
+}
+
+static KtBuffer *buffer_new(KtBufferBlock *block,
+                            const guint8 *data,
+                            gsize length)
+{
+        KtBufferPriv *priv = g_new(KtBufferPriv, 1);
+
+        priv->buffer.data = (const char *)data;
         priv->buffer.length = length;
         priv->refcount = 1;
+        priv->block = block;
 
         return (KtBuffer *)priv;
 }
 
+/* Public methods */
+
+/**
+ * kt_buffer_new: Copy data into a new buffer.
+ *
+ * This is the only copy, the data then stays valid for as long as the
+ * buffer or any slice of it is alive.
+ */
+KtBuffer * kt_buffer_new(gconstpointer data, gsize length)
+{
+        KtBufferBlock *block;
+        guint8 *dest;
+
+        if (length > BLOCK_SIZE / 4) {
+                G_LOCK(pool);
+                block = block_new(MAX(length, BLOCK_SIZE));
+                G_UNLOCK(pool);
+                dest = block->data;
+        } else {
+                KtBufferBlock *full = NULL;
+
+                /* Small buffers share the current block */
+                G_LOCK(pool);
+                if (pool_current == NULL ||
+                    BLOCK_SIZE - pool_current_used < length) {
+                        full = pool_current;
+                        pool_current = block_new(BLOCK_SIZE);
+                        pool_current_used = 0;
+                }
+
+                block = pool_current;
+                g_atomic_int_inc(&block->refcount);
+                dest = block->data + pool_current_used;
+                pool_current_used += length;
+                G_UNLOCK(pool);
+
+                if (full)
+                        block_unref(full);
+        }
+
+        memcpy(dest, data, length);
+
+        return buffer_new(block, dest, length);
+}
+
+/**
+ * kt_buffer_slice: Create a buffer for part of another one, without
+ * copying.
+ */
+KtBuffer *kt_buffer_slice(KtBuffer *buffer, gsize offset, gsize length)
+{
+        KtBufferPriv *priv = (KtBufferPriv *)buffer;
+
+        g_return_val_if_fail(offset <= buffer->length, NULL);
+        g_return_val_if_fail(length <= buffer->length - offset, NULL);
+
+        g_atomic_int_inc(&priv->block->refcount);
+
+        return buffer_new(priv->block,
+                          (const guint8 *)buffer->data + offset,
+                          length);
+}
+
 KtBuffer * kt_buffer_copy(KtBuffer *buffer)
 {
         KtBufferPriv *priv = (KtBufferPriv *)buffer;
 
-        priv->refcount++;
+        g_atomic_int_inc(&priv->refcount);
 
         return buffer;
 }
@@ -53,7 +181,8 @@ void kt_buffer_free(KtBuffer *buffer)
 {
         KtBufferPriv *priv = (KtBufferPriv *)buffer;
 
-        if (!--priv->refcount) {
-                g_slice_free(KtBufferPriv, priv);
+        if (g_atomic_int_dec_and_test(&priv->refcount)) {
+                block_unref(priv->block);
+                g_free(priv);
         }
 }
@@ -27,6 +27,12 @@
 
 G_BEGIN_DECLS
 
+/*
+  A read-only slice of pty data. The bytes live in pooled, fixed-size
+  blocks that are shared between slices, so a buffer can be sliced and
+  handed to other threads without copying. kt_buffer_copy() takes a
+  reference and kt_buffer_free() drops one; both are thread safe.
+ */
 typedef struct {
         const char *data;
         gsize length;
@@ -36,6 +42,7 @@ GType kt_buffer_get_type (void);
 #define KT_TYPE_BUFFER (kt_buffer_get_type())
 
 KtBuffer *kt_buffer_new(gconstpointer data, gsize length);
+KtBuffer *kt_buffer_slice(KtBuffer *buffer, gsize offset, gsize length);
 KtBuffer * kt_buffer_copy(KtBuffer *buffer);
 void kt_buffer_free(KtBuffer *buffer);
 
@@ -0,0 +1,235 @@
+/*
+ * kt-cluster.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "kt-cluster.h"
+#include "kt-util.h"
+
+#define CLUSTERS_MIN 64
+
+typedef struct {
+        guint32 refs;
+        guint32 id;
+        guint hash;
+        guint length;
+        const gunichar *chars; /* Right after the struct */
+} Cluster;
+
+struct _KtClusterTable {
+        Cluster **clusters; /* Indexed by ID, NULL when free */
+        guint size; /* IDs handed out so far */
+        guint allocated;
+        guint32 *free_ids; /* IDs given back, to use first */
+        guint n_free;
+        GHashTable *lookup; /* The clusters, by their code points */
+        gsize bytes;
+};
+
+/* Private methods */
+static guint chars_hash(const gunichar *chars, guint n)
+{
+        guint32 h = 2166136261u;
+        guint i;
+
+        for (i = 0; i < n; i++)
+                h = (h ^ chars[i]) * 16777619u;
+
+        return h;
+}
+
+static guint cluster_hash(gconstpointer key)
+{
+        return ((const Cluster *)key)->hash;
+}
+
+static gboolean cluster_equal(gconstpointer a, gconstpointer b)
+{
+        const Cluster *ca = a, *cb = b;
+
+        return ca->length == cb->length &&
+                memcmp(ca->chars, cb->chars,
+                       ca->length * sizeof(gunichar)) == 0;
+}
+
+static guint table_take_id(KtClusterTable *table)
+{
+        Cluster **clusters;
+        guint32 *free_ids;
+
+        if (table->n_free > 0)
+                return table->free_ids[--table->n_free];
+
+        if (table->size == KT_CLUSTER_MAX)
+                return KT_CLUSTER_NONE;
+
+        if (table->size == table->allocated) {
+                table->allocated *= 2;
+
+                clusters = NEW(Cluster *, table->allocated);
+                memcpy(clusters, table->clusters,
+                       table->size * sizeof(Cluster *));
+                FREE(&table->clusters);
+                table->clusters = clusters;
+
+                free_ids = NEW(guint32, table->allocated);
+                FREE(&table->free_ids);
+                table->free_ids = free_ids;
+        }
+
+        return table->size++;
+}
+
+/* Public methods */
+KtClusterTable *kt_cluster_table_new(void)
+{
+        KtClusterTable *table;
+
+        table = NEW(KtClusterTable, 1);
+        MEMSET(table, 1);
+
+        table->allocated = CLUSTERS_MIN;
+        table->clusters = NEW(Cluster *, table->allocated);
+        table->free_ids = NEW(guint32, table->allocated);
+        table->lookup = g_hash_table_new(cluster_hash, cluster_equal);
+
+        return table;
+}
+
+void kt_cluster_table_free(KtClusterTable *table)
+{
+        guint i;
+
+        if (table == NULL)
+                return;
+
+        for (i = 0; i < table->size; i++)
+                FREE(&table->clusters[i]);
+
+        g_hash_table_unref(table->lookup);
+        FREE(&table->clusters);
+        FREE(&table->free_ids);
+        FREE(&table);
+}
+
+/**
+ * kt_cluster_table_intern: Find the ID of a cluster, adding it if needed,
+ * and take a reference on it.
+ *
+ * Returns: The ID, or KT_CLUSTER_NONE if there are no IDs left.
+ */
+guint kt_cluster_table_intern(KtClusterTable *table, const gunichar *chars,
+                              guint n)
+{
+        Cluster key, *cluster;
+        gunichar *copy;
+        guint id;
+
+        g_return_val_if_fail(table != NULL && chars != NULL, KT_CLUSTER_NONE);
+
+        n = MIN(n, KT_CLUSTER_MAX_CHARS);
+        key.chars = chars;
+        key.length = n;
+        key.hash = chars_hash(chars, n);
+
+        cluster = g_hash_table_lookup(table->lookup, &key);
+        if (cluster) {
+                cluster->refs++;
+                return cluster->id;
+        }
+
+        id = table_take_id(table);
+        if (id == KT_CLUSTER_NONE)
+                return KT_CLUSTER_NONE;
+
+        cluster = (Cluster *)NEW(guint8, sizeof(Cluster) +
+                                 n * sizeof(gunichar));
+        copy = (gunichar *)(cluster + 1);
+        memcpy(copy, chars, n * sizeof(gunichar));
+
+        cluster->refs = 1;
+        cluster->id = id;
+        cluster->hash = key.hash;
+        cluster->length = n;
+        cluster->chars = copy;
+
+        table->clusters[id] = cluster;
+        table->bytes += sizeof(Cluster) + n * sizeof(gunichar);
+        g_hash_table_add(table->lookup, cluster);
+
+        return id;
+}
+
+void kt_cluster_table_ref(KtClusterTable *table, guint id)
+{
+        g_return_if_fail(table != NULL);
+        g_return_if_fail(id < table->size && table->clusters[id] != NULL);
+
+        table->clusters[id]->refs++;
+}
+
+void kt_cluster_table_unref(KtClusterTable *table, guint id)
+{
+        Cluster *cluster;
+
+        g_return_if_fail(table != NULL);
+        g_return_if_fail(id < table->size && table->clusters[id] != NULL);
+
+        cluster = table->clusters[id];
+        if (--cluster->refs > 0)
+                return;
+
+        g_hash_table_remove(table->lookup, cluster);
+        table->bytes -= sizeof(Cluster) + cluster->length * sizeof(gunichar);
+        FREE(&table->clusters[id]);
+        table->free_ids[table->n_free++] = id;
+}
+
+/**
+ * kt_cluster_table_get()
+ *
+ * Returns: The code points of a cluster, and their number in n, or NULL
+ * for an unknown ID.
+ */
+const gunichar *kt_cluster_table_get(KtClusterTable *table, guint id,
+                                     guint *n)
+{
+        g_return_val_if_fail(table != NULL, NULL);
+
+        if (id >= table->size || table->clusters[id] == NULL) {
+                *n = 0;
+                return NULL;
+        }
+
+        *n = table->clusters[id]->length;
+
+        return table->clusters[id]->chars;
+}
+
+void kt_cluster_table_get_stats(KtClusterTable *table, guint *count,
+                                gsize *bytes)
+{
+        g_return_if_fail(table != NULL);
+
+        if (count)
+                *count = g_hash_table_size(table->lookup);
+        if (bytes)
+                *bytes = table->bytes;
+}
@@ -0,0 +1,55 @@
+/*
+ * kt-cluster.h
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KT_CLUSTER_H
+#define KT_CLUSTER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+  Grapheme clusters of more than one code point, interned to IDs a cell
+  can hold in place of a code point. Each cell holding an ID owns a
+  reference, and a cluster goes away, its ID ready for reuse, with the last
+  one.
+ */
+#define KT_CLUSTER_MAX (1 << 21)
+#define KT_CLUSTER_MAX_CHARS 32 /* Longer ones are cut */
+#define KT_CLUSTER_NONE G_MAXUINT
+
+typedef struct _KtClusterTable KtClusterTable;
+
+KtClusterTable *kt_cluster_table_new(void);
+void kt_cluster_table_free(KtClusterTable *table);
+
+guint kt_cluster_table_intern(KtClusterTable *table, const gunichar *chars,
+                              guint n);
+void kt_cluster_table_ref(KtClusterTable *table, guint id);
+void kt_cluster_table_unref(KtClusterTable *table, guint id);
+const gunichar *kt_cluster_table_get(KtClusterTable *table, guint id,
+                                     guint *n);
+void kt_cluster_table_get_stats(KtClusterTable *table, guint *count,
+                                gsize *bytes);
+
+G_END_DECLS
+#endif /* KT_CLUSTER_H */
@@ -252,7 +252,7 @@ KtFont *kt_font_new(KtApp *app, KtPrefs *prefs)
 
         priv->bold = font_desc_new(priv->prefs->font_name,
                                    priv->prefs->font_size,
-                                   FALSE, FALSE, FALSE);
+                                   FALSE, TRUE, FALSE);
 
         priv->italic = font_desc_new(priv->prefs->font_name,
                                      priv->prefs->font_size,
@@ -277,3 +277,28 @@ void kt_font_get_size(KtFont *font, int *width, int *height)
         *width = priv->width;
         *height = priv->height;
 }
+
+/**
+ * kt_font_get_desc()
+ *
+ * Returns: The font description for the given style, owned by the font.
+ */
+PangoFontDescription *kt_font_get_desc(KtFont *font,
+                                       gboolean bold,
+                                       gboolean italic)
+{
+        KtFontPrivate *priv;
+
+        g_return_val_if_fail(KT_IS_FONT(font), NULL);
+
+        priv = font->priv;
+
+        if (bold && italic)
+                return priv->bold_italic;
+        if (bold)
+                return priv->bold;
+        if (italic)
+                return priv->italic;
+
+        return priv->normal;
+}
@@ -55,4 +55,7 @@ GType kt_font_get_type(void);
 KtFont *kt_font_new(KtApp *app, KtPrefs *prefs);
 
 void kt_font_get_size(KtFont *font, gint *width, gint *height);
+PangoFontDescription *kt_font_get_desc(KtFont *font,
+                                       gboolean bold,
+                                       gboolean italic);
 #endif /* KT_FONT_H */
@@ -0,0 +1,1438 @@
+/*
+ * kt-grid.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "kt-grid.h"
+#include "kt-cluster.h"
+#include "kt-scrollback.h"
+#include "kt-unicode.h"
+#include "kt-util.h"
+
+#define TAB_WIDTH 8
+#define HOT_LINES 1024
+
+/*
+  The screen and the scrollback share one ring of capacity lines: the
+  screen is the rows lines from start on, the history the up to scrollback
+  lines before it. Scrolling the whole screen up only advances start; the
+  line leaving the top stays where it is and becomes history, and the slot
+  coming in at the bottom is free or the oldest line of history.
+
+  Only the most recent HOT_LINES lines of history are kept in the ring. The
+  older ones go to a compressed KtScrollback, from where they are copied
+  into cold_line when asked for.
+
+  Lines are also numbered absolutely, counting from the first line the grid
+  ever had: the top of the screen is line "scrolled". The compressed
+  history is numbered back from the oldest line of the ring, by rows at
+  the current width.
+
+  When the width changes, the logical lines of the ring, lines joined by
+  KT_LINE_WRAPPED, are rewrapped at once; the compressed history is
+  rewrapped as it is looked at.
+ */
+struct _KtGrid {
+        guint rows;
+        guint cols;
+        guint scrollback; /* Max lines of history in the ring */
+        guint capacity; /* rows + scrollback */
+        KtGridLine *ring;
+        guint start; /* Slot of the top line of the screen */
+        guint history; /* Lines of history */
+        guint64 scrolled; /* Lines scrolled off the screen, ever */
+        KtGridLine *scratch; /* rows lines, for moving lines around */
+        KtCell *cells; /* capacity * cols, in no particular order */
+        KtScrollback *cold; /* The history older than the ring, or NULL */
+        KtGridLine cold_line;
+        KtStyleTable *styles;
+        KtClusterTable *clusters;
+
+        /* Cursor */
+        guint row;
+        guint col;
+        gboolean wrap_pending; /* The last column was written */
+        guint saved_row;
+        guint saved_col;
+
+        /* Scrolling region, inclusive */
+        guint top;
+        guint bottom;
+
+        /* Pen */
+        KtStyle pen;
+        KtStyle saved_pen;
+        guint32 style; /* ID of the pen */
+        guint32 erase_style; /* ID of the pen's background alone */
+};
+
+/* Content generations of the lines, from one counter for all the grids so
+   that a generation is never seen on two screens */
+static guint32 line_generation;
+
+/* Private methods */
+static inline KtGridLine *grid_line(KtGrid *grid, guint row)
+{
+        guint slot = grid->start + row;
+
+        if (slot >= grid->capacity)
+                slot -= grid->capacity;
+
+        return &grid->ring[slot];
+}
+
+static inline gboolean is_devanagari_consonant(gunichar c)
+{
+        return (c >= 0x0915 && c <= 0x0939) || (c >= 0x0958 && c <= 0x095f) ||
+                (c >= 0x0978 && c <= 0x097f);
+}
+
+/**
+ * grapheme_continues: Whether c belongs to the same grapheme cluster as
+ * the n characters before it, after the UAX #29 rules that matter for a
+ * terminal: marks and joiners (GB9, GB9a, GB9b), Hangul syllables (GB6 to
+ * GB8), emoji ZWJ sequences (GB11), flags (GB12, GB13) and Devanagari
+ * conjuncts (GB9c, which the tables do not cover before Unicode 15.1).
+ */
+static gboolean grapheme_continues(const gunichar *chars, guint n, gunichar c)
+{
+        gunichar last = chars[n - 1];
+        KtGraphemeBreak prev = kt_unicode_grapheme_break(last);
+        KtGraphemeBreak next = kt_unicode_grapheme_break(c);
+
+        switch (next) {
+        case KT_GCB_EXTEND:
+        case KT_GCB_ZWJ:
+        case KT_GCB_SPACING_MARK:
+                return TRUE;
+        case KT_GCB_CR:
+        case KT_GCB_LF:
+        case KT_GCB_CONTROL:
+                return FALSE;
+        default:
+                break;
+        }
+
+        switch (prev) {
+        case KT_GCB_PREPEND:
+                return TRUE;
+        case KT_GCB_ZWJ:
+                if (n >= 2 && kt_unicode_is_pictographic(chars[0]) &&
+                    kt_unicode_is_pictographic(c))
+                        return TRUE;
+                break;
+        case KT_GCB_REGIONAL_INDICATOR:
+                return n == 1 && next == KT_GCB_REGIONAL_INDICATOR;
+        case KT_GCB_L:
+                return next == KT_GCB_L || next == KT_GCB_V ||
+                        next == KT_GCB_LV || next == KT_GCB_LVT;
+        case KT_GCB_V:
+        case KT_GCB_LV:
+                return next == KT_GCB_V || next == KT_GCB_T;
+        case KT_GCB_T:
+        case KT_GCB_LVT:
+                return next == KT_GCB_T;
+        default:
+                break;
+        }
+
+        return is_devanagari_consonant(c) &&
+                (last == 0x094d ||
+                 (last == 0x200d && n >= 2 && chars[n - 2] == 0x094d));
+}
+
+/**
+ * cell_chars: The code points of a cell, one or a whole cluster.
+ *
+ * Returns: The code points, in buf or in the cluster table.
+ */
+static const gunichar *cell_chars(KtGrid *grid, const KtCell *cell,
+                                  gunichar *buf, guint *n)
+{
+        if (cell->ch & KT_CELL_CLUSTER)
+                return kt_cluster_table_get(grid->clusters,
+                                            KT_CELL_CHAR(cell), n);
+
+        buf[0] = KT_CELL_CHAR(cell);
+        *n = 1;
+
+        return buf;
+}
+
+/* Give back the clusters held by cells about to be overwritten */
+static void cells_release(KtGrid *grid, KtCell *cells, guint n)
+{
+        guint i;
+
+        for (i = 0; i < n; i++) {
+                if (cells[i].ch & KT_CELL_CLUSTER)
+                        kt_cluster_table_unref(grid->clusters,
+                                               KT_CELL_CHAR(&cells[i]));
+        }
+}
+
+/* Take references for cells copied from others */
+static void cells_ref(KtGrid *grid, KtCell *cells, guint n)
+{
+        guint i;
+
+        for (i = 0; i < n; i++) {
+                if (cells[i].ch & KT_CELL_CLUSTER)
+                        kt_cluster_table_ref(grid->clusters,
+                                             KT_CELL_CHAR(&cells[i]));
+        }
+}
+
+/* Erased cells keep the background of the pen. The cells are expected to
+   be released already. */
+static void cells_blank(KtGrid *grid, KtCell *cells, guint n)
+{
+        guint i;
+
+        for (i = 0; i < n; i++) {
+                cells[i].ch = 0;
+                cells[i].style = grid->erase_style;
+        }
+}
+
+static void cells_clear(KtGrid *grid, KtCell *cells, guint n)
+{
+        cells_release(grid, cells, n);
+        cells_blank(grid, cells, n);
+}
+
+/* The cells of line changed */
+static inline void line_changed(KtGridLine *line)
+{
+        line->flags |= KT_LINE_DIRTY;
+        line->gen = ++line_generation;
+}
+
+static void line_clear(KtGrid *grid, KtGridLine *line)
+{
+        cells_clear(grid, line->cells, grid->cols);
+        line->flags = 0;
+        line_changed(line);
+}
+
+static void lines_dirty(KtGrid *grid, guint first, guint last)
+{
+        guint i;
+
+        for (i = first; i <= last; i++)
+                grid_line(grid, i)->flags |= KT_LINE_DIRTY;
+}
+
+/**
+ * grid_compact_styles: Start a new style table holding only the styles
+ * still used by the ring, the cold line and the pen. The style IDs of the
+ * cells change.
+ */
+static void grid_compact_styles(KtGrid *grid)
+{
+        KtStyleTable *styles = kt_style_table_new();
+        guint size = kt_style_table_get_size(grid->styles);
+        guint32 *map;
+        guint i, j;
+
+        map = NEW(guint32, size);
+        for (i = 0; i < size; i++)
+                map[i] = KT_STYLE_NONE;
+
+        for (i = 0; i <= grid->capacity; i++) {
+                KtCell *cells = i < grid->capacity ? grid->ring[i].cells :
+                        grid->cold_line.cells;
+
+                for (j = 0; j < grid->cols; j++) {
+                        guint id = MIN(cells[j].style, size - 1);
+
+                        if (map[id] == KT_STYLE_NONE)
+                                map[id] = kt_style_table_intern(styles,
+                                        kt_style_table_get(grid->styles, id));
+                        cells[j].style = map[id];
+                }
+        }
+
+        /* The pen is still in there, it was interned when set */
+        for (i = 0; i < 2; i++) {
+                guint32 *pen = i == 0 ? &grid->style : &grid->erase_style;
+                guint id = MIN(*pen, size - 1);
+
+                if (map[id] == KT_STYLE_NONE)
+                        map[id] = kt_style_table_intern(styles,
+                                kt_style_table_get(grid->styles, id));
+                *pen = map[id];
+        }
+
+        debug("Styles compacted from %u to %u.", size,
+              kt_style_table_get_size(styles));
+
+        FREE(&map);
+        kt_style_table_free(grid->styles);
+        grid->styles = styles;
+}
+
+/* Make sure n more styles can be interned, if at all possible */
+static void grid_reserve_styles(KtGrid *grid, guint n)
+{
+        if (kt_style_table_get_size(grid->styles) + n > KT_STYLE_MAX)
+                grid_compact_styles(grid);
+}
+
+/* Work out the style IDs of the pen */
+static void grid_pen_intern(KtGrid *grid)
+{
+        KtStyle erase;
+        guint style, erase_style;
+
+        MEMSET(&erase, 1);
+        erase.bg = grid->pen.bg;
+
+        grid_reserve_styles(grid, 2);
+
+        style = kt_style_table_intern(grid->styles, &grid->pen);
+        erase_style = kt_style_table_intern(grid->styles, &erase);
+
+        /* Only when every cell has a style of its own */
+        grid->style = style == KT_STYLE_NONE ? erase_style : style;
+        grid->erase_style = erase_style == KT_STYLE_NONE ?
+                KT_STYLE_DEFAULT : erase_style;
+}
+
+/**
+ * grid_scroll_screen: Scroll the whole screen up by n lines, into the
+ * history.
+ */
+static void grid_scroll_screen(KtGrid *grid, guint n)
+{
+        guint i;
+
+        for (i = 0; i < n; i++) {
+                /* The oldest line is reused for the new one, keep it */
+                if (grid->history == grid->scrollback && grid->cold)
+                        kt_scrollback_push(grid->cold,
+                                           grid_line(grid, grid->rows),
+                                           grid->cols, grid->styles,
+                                           grid->clusters);
+
+                if (++grid->start == grid->capacity)
+                        grid->start = 0;
+                grid->scrolled++;
+
+                if (grid->history < grid->scrollback)
+                        grid->history++;
+
+                line_clear(grid, grid_line(grid, grid->rows - 1));
+        }
+
+        lines_dirty(grid, 0, grid->rows - 1);
+}
+
+/**
+ * grid_scroll_region: Move lines top..bottom up (n > 0) or down (n < 0) by
+ * |n|. The lines that come in are blank. With history set, lines scrolled
+ * off the top of the whole screen go to the history; only scrolling at the
+ * bottom margin (IND, LF, SU) does that, IL and DL just drop the lines.
+ */
+static void grid_scroll_region(KtGrid *grid, guint top, guint bottom, gint n,
+                               gboolean history)
+{
+        guint height = bottom - top + 1;
+        guint count = MIN((guint)ABS(n), height);
+        KtGridLine *scratch = grid->scratch;
+        guint i;
+
+        if (count == 0)
+                return;
+
+        if (history && n > 0 && top == 0 && bottom == grid->rows - 1) {
+                grid_scroll_screen(grid, count);
+                return;
+        }
+
+        /* Rotate the line structs of the region, the cells stay put */
+        for (i = 0; i < height; i++)
+                scratch[i] = *grid_line(grid, top + i);
+
+        for (i = 0; i < height; i++) {
+                guint from = n > 0 ? (i + count) % height :
+                        (i + height - count) % height;
+
+                *grid_line(grid, top + i) = scratch[from];
+        }
+
+        if (n > 0) {
+                for (i = bottom - count + 1; i <= bottom; i++)
+                        line_clear(grid, grid_line(grid, i));
+        } else {
+                for (i = top; i < top + count; i++)
+                        line_clear(grid, grid_line(grid, i));
+        }
+
+        /* Everything in the region moved on the screen */
+        lines_dirty(grid, top, bottom);
+}
+
+/* Don't leave half of a wide character behind in [col, col + n) */
+static void line_fix_wide(KtGrid *grid, KtGridLine *line, guint col, guint n)
+{
+        guint end = MIN(col + n, grid->cols);
+
+        if (col < grid->cols && col > 0 &&
+            (line->cells[col].ch & KT_CELL_WIDE_TAIL))
+                cells_clear(grid, &line->cells[col - 1], 1);
+
+        if (end > 0 && end < grid->cols &&
+            (line->cells[end].ch & KT_CELL_WIDE_TAIL))
+                cells_clear(grid, &line->cells[end], 1);
+}
+
+/* A wide character can't start in the last column */
+static void line_fix_last(KtGrid *grid, KtGridLine *line)
+{
+        if (line->cells[grid->cols - 1].ch & KT_CELL_WIDE)
+                cells_clear(grid, &line->cells[grid->cols - 1], 1);
+}
+
+/**
+ * line_content: The cells of line that are part of its logical line: all
+ * of a wrapped line but for a last column left empty for a wide character
+ * starting next, or up to the last cell that isn't blank.
+ */
+static guint line_content(KtGrid *grid, KtGridLine *line, KtGridLine *next)
+{
+        const KtCell *cell;
+        guint n;
+
+        if (line->flags & KT_LINE_WRAPPED) {
+                if (next && grid->cols > 1 &&
+                    line->cells[grid->cols - 1].ch == 0 &&
+                    (next->cells[0].ch & KT_CELL_WIDE))
+                        return grid->cols - 1;
+
+                return grid->cols;
+        }
+
+        for (n = grid->cols; n > 0; n--) {
+                cell = &line->cells[n - 1];
+                if (cell->ch != 0 || cell->style != KT_STYLE_DEFAULT)
+                        break;
+        }
+
+        return n;
+}
+
+static void grid_alloc(KtGrid *grid, guint rows, guint cols, guint scrollback)
+{
+        guint i;
+
+        grid->rows = rows;
+        grid->cols = cols;
+        grid->scrollback = scrollback;
+        grid->capacity = rows + scrollback;
+        grid->cells = NEW(KtCell, (gsize)grid->capacity * cols);
+        grid->ring = NEW(KtGridLine, grid->capacity);
+        grid->scratch = NEW(KtGridLine, rows);
+        grid->cold_line.cells = NEW(KtCell, cols);
+        cells_blank(grid, grid->cold_line.cells, cols);
+        grid->start = 0;
+        grid->history = 0;
+
+        for (i = 0; i < grid->capacity; i++) {
+                grid->ring[i].cells = grid->cells + (gsize)i * cols;
+                cells_blank(grid, grid->ring[i].cells, cols);
+                grid->ring[i].flags = 0;
+                line_changed(&grid->ring[i]);
+        }
+}
+
+static void grid_release(KtGrid *grid)
+{
+        FREE(&grid->cells);
+        FREE(&grid->ring);
+        FREE(&grid->scratch);
+        FREE(&grid->cold_line.cells);
+}
+
+/* Rows laid out at a new width, before they go into the ring */
+typedef struct {
+        KtCell *cells;
+        guint *flags;
+        guint cols;
+        guint rows;
+        guint size; /* Rows allocated */
+        guint col; /* Next column of the last row */
+} Reflow;
+
+static void reflow_row(KtGrid *grid, Reflow *rf)
+{
+        if (rf->rows == rf->size) {
+                rf->size = MAX(rf->size * 2, 64);
+                /* Aborts if out of memory, like NEW() */
+                rf->cells = g_realloc(rf->cells, (gsize)rf->size * rf->cols *
+                                      sizeof(KtCell));
+                rf->flags = g_realloc(rf->flags, rf->size * sizeof(guint));
+        }
+
+        cells_blank(grid, rf->cells + (gsize)rf->rows * rf->cols, rf->cols);
+        rf->flags[rf->rows++] = KT_LINE_DIRTY;
+        rf->col = 0;
+}
+
+/**
+ * reflow_line: Lay the logical line of ring lines line to end out again
+ * from a new row. The cursor is kept on the cell it was on, or as far
+ * past the end of the line as fits.
+ */
+static void reflow_line(KtGrid *grid, KtGrid *old, Reflow *rf, guint64 line,
+                        guint64 end, guint *cursor_row, guint *cursor_col,
+                        guint *top)
+{
+        guint64 cursor = old->scrolled + old->row;
+        guint64 l;
+
+        reflow_row(grid, rf);
+
+        for (l = line; l <= end; l++) {
+                KtGridLine *from = kt_grid_get_line_abs(old, l);
+                KtGridLine *next = l < end ?
+                        kt_grid_get_line_abs(old, l + 1) : NULL;
+                guint n = line_content(old, from, next);
+                guint k;
+
+                if (l == old->scrolled)
+                        *top = rf->rows - (rf->col < rf->cols);
+
+                for (k = 0; k < n; k++) {
+                        KtCell cell = from->cells[k], *to;
+                        guint width = 1, skip = 0;
+
+                        if (cell.ch & KT_CELL_WIDE) {
+                                if (k + 1 < n && (from->cells[k + 1].ch &
+                                                  KT_CELL_WIDE_TAIL))
+                                        skip = 1;
+                                if (rf->cols > 1)
+                                        width = 2;
+                                else
+                                        cell.ch = 0;
+                        } else if (cell.ch & KT_CELL_WIDE_TAIL) {
+                                cell.ch = 0;
+                        }
+
+                        if (rf->col + width > rf->cols && rf->col > 0) {
+                                rf->flags[rf->rows - 1] |= KT_LINE_WRAPPED;
+                                reflow_row(grid, rf);
+                        }
+
+                        if (l == cursor && old->col >= k &&
+                            old->col <= k + skip) {
+                                *cursor_row = rf->rows - 1;
+                                *cursor_col = MIN(rf->col, rf->cols - 1);
+                        }
+
+                        to = rf->cells + (gsize)(rf->rows - 1) * rf->cols +
+                                rf->col;
+                        to[0] = cell;
+                        if (width == 2) {
+                                to[1].ch = KT_CELL_PACK(0, KT_CELL_WIDE_TAIL);
+                                to[1].style = cell.style;
+                        }
+                        rf->col += width;
+                        k += skip;
+                }
+
+                if (l == cursor && old->col >= n) {
+                        *cursor_row = rf->rows - 1;
+                        *cursor_col = MIN(rf->col + old->col - n,
+                                          rf->cols - 1);
+                }
+        }
+}
+
+/**
+ * grid_reflow: Resize to a new width, rewrapping the lines. The ring is
+ * laid out again from its oldest line down to the cursor or the last line
+ * that isn't blank, and the top of the screen stays on the same text if
+ * the cursor allows. Rows that no longer fit the ring go to the compressed
+ * history, which is rewrapped lazily.
+ */
+static void grid_reflow(KtGrid *grid, guint rows, guint cols)
+{
+        KtGrid old = *grid;
+        Reflow rf;
+        guint64 first, bound = 0, last, line, end;
+        guint cursor_row = 0, cursor_col = 0, top = 0, history, overflow, i;
+
+        first = kt_grid_get_first_line(grid);
+        if (grid->cold) {
+                kt_scrollback_set_width(grid->cold, cols);
+                bound = kt_scrollback_get_rows(grid->cold);
+        }
+
+        last = old.scrolled + old.row;
+        for (i = old.rows; i > old.row + 1; i--) {
+                if (line_content(&old, grid_line(&old, i - 1), NULL) > 0) {
+                        last = old.scrolled + i - 1;
+                        break;
+                }
+        }
+
+        MEMSET(&rf, 1);
+        rf.cols = cols;
+
+        for (line = old.scrolled - old.history; line <= last; line = end + 1) {
+                for (end = line; end < last; end++) {
+                        if (!(kt_grid_get_line_abs(&old, end)->flags &
+                              KT_LINE_WRAPPED))
+                                break;
+                }
+
+                reflow_line(grid, &old, &rf, line, end, &cursor_row,
+                            &cursor_col, &top);
+        }
+
+        /* Keep the cursor on the screen */
+        if (top > cursor_row)
+                top = cursor_row;
+        else if (cursor_row >= top + rows)
+                top = cursor_row - rows + 1;
+
+        history = MIN(top, old.scrollback);
+        overflow = top - history;
+
+        /* The rows that no longer fit the ring, at the new width */
+        for (i = 0; i < overflow && grid->cold; i++) {
+                KtGridLine row;
+
+                row.cells = rf.cells + (gsize)i * cols;
+                row.flags = rf.flags[i];
+                kt_scrollback_push(grid->cold, &row, cols, grid->styles,
+                                   grid->clusters);
+        }
+
+        grid_alloc(grid, rows, cols, old.scrollback);
+        grid->history = history;
+        grid->scrolled = first + bound + top;
+
+        first = grid->scrolled - grid->history;
+        for (i = 0; i < history + rows && overflow + i < rf.rows; i++) {
+                KtGridLine *to = kt_grid_get_line_abs(grid, first + i);
+
+                memcpy(to->cells, rf.cells + (gsize)(overflow + i) * cols,
+                       cols * sizeof(KtCell));
+                cells_ref(grid, to->cells, cols);
+                to->flags = rf.flags[overflow + i];
+                line_changed(to);
+        }
+
+        /* The copies hold their own references */
+        for (i = 0; i < old.capacity; i++)
+                cells_release(grid, old.ring[i].cells, old.cols);
+        cells_release(grid, old.cold_line.cells, old.cols);
+        grid_release(&old);
+        FREE(&rf.cells);
+        FREE(&rf.flags);
+
+        grid->row = MIN(cursor_row - top, rows - 1);
+        grid->col = cursor_col;
+}
+
+/* Resize cutting or padding the lines on the right */
+static void grid_cut(KtGrid *grid, guint rows, guint cols)
+{
+        KtGrid old;
+        guint drop, i;
+        guint64 first;
+
+        old = *grid;
+        grid_alloc(grid, rows, cols, old.scrollback);
+
+        drop = old.row >= rows ? old.row - rows + 1 : 0;
+        grid->scrolled = old.scrolled + drop;
+        grid->history = MIN(old.history + drop, grid->scrollback);
+
+        /* The lines that no longer fit the ring */
+        first = old.scrolled - old.history;
+        if (grid->cold) {
+                for (i = 0; i < old.history + drop - grid->history; i++)
+                        kt_scrollback_push(grid->cold,
+                                           kt_grid_get_line_abs(&old,
+                                                                first + i),
+                                           old.cols, grid->styles,
+                                           grid->clusters);
+        }
+
+        /* The history and what is left of the screen, oldest first */
+        first = grid->scrolled - grid->history;
+        for (i = 0; i < grid->history + rows; i++) {
+                KtGridLine *from = kt_grid_get_line_abs(&old, first + i);
+                KtGridLine *to = kt_grid_get_line_abs(grid, first + i);
+
+                if (from == NULL)
+                        break;
+
+                memcpy(to->cells, from->cells,
+                       MIN(cols, old.cols) * sizeof(KtCell));
+                cells_ref(grid, to->cells, MIN(cols, old.cols));
+                to->flags = from->flags;
+                line_changed(to);
+                if (cols < old.cols)
+                        line_fix_last(grid, to);
+        }
+
+        /* The copies hold their own references */
+        for (i = 0; i < old.capacity; i++)
+                cells_release(grid, old.ring[i].cells, old.cols);
+        cells_release(grid, old.cold_line.cells, old.cols);
+        grid_release(&old);
+
+        grid->row = MIN(old.row - drop, rows - 1);
+        grid->col = MIN(old.col, cols - 1);
+}
+
+/* Public methods */
+
+/**
+ * kt_grid_new: Create a blank grid of rows x cols cells, keeping up to
+ * scrollback lines of history, or a few hundred more once they no longer
+ * fit the ring.
+ */
+KtGrid *kt_grid_new(guint rows, guint cols, guint scrollback)
+{
+        KtGrid *grid;
+
+        g_return_val_if_fail(rows > 0 && cols > 0, NULL);
+
+        grid = NEW(KtGrid, 1);
+        MEMSET(grid, 1);
+
+        grid->styles = kt_style_table_new();
+        grid->clusters = kt_cluster_table_new();
+        grid_alloc(grid, rows, cols, MIN(scrollback, HOT_LINES));
+        grid->bottom = rows - 1;
+
+        if (scrollback > HOT_LINES) {
+                grid->cold = kt_scrollback_new(scrollback - HOT_LINES);
+                kt_scrollback_set_width(grid->cold, cols);
+        }
+
+        debug("Grid of %ux%u cells and %u lines of history, %zu bytes"
+              " per cell.", cols, rows, scrollback, sizeof(KtCell));
+
+        return grid;
+}
+
+void kt_grid_free(KtGrid *grid)
+{
+        if (grid == NULL)
+                return;
+
+        kt_scrollback_free(grid->cold);
+        kt_style_table_free(grid->styles);
+        kt_cluster_table_free(grid->clusters);
+        grid_release(grid);
+        FREE(&grid);
+}
+
+/**
+ * kt_grid_resize: Change the size of the grid. When the width changes and
+ * there is history, the lines are rewrapped, else they are cut or padded
+ * on the right. When the grid gets shorter, lines go from the top of the
+ * screen into the history as far as needed to keep the cursor line.
+ */
+void kt_grid_resize(KtGrid *grid, guint rows, guint cols)
+{
+        g_return_if_fail(grid != NULL);
+        g_return_if_fail(rows > 0 && cols > 0);
+
+        if (rows == grid->rows && cols == grid->cols)
+                return;
+
+        if (cols != grid->cols && (grid->scrollback > 0 || grid->cold))
+                grid_reflow(grid, rows, cols);
+        else
+                grid_cut(grid, rows, cols);
+
+        grid->saved_row = MIN(grid->saved_row, rows - 1);
+        grid->saved_col = MIN(grid->saved_col, cols - 1);
+        grid->wrap_pending = FALSE;
+        grid->top = 0;
+        grid->bottom = rows - 1;
+}
+
+/**
+ * kt_grid_set_spill: Keep the history that is dropped from memory in spill
+ * instead. The grid takes spill over.
+ */
+void kt_grid_set_spill(KtGrid *grid, KtSpill *spill)
+{
+        g_return_if_fail(grid != NULL);
+
+        if (grid->cold == NULL) {
+                grid->cold = kt_scrollback_new(0);
+                kt_scrollback_set_width(grid->cold, grid->cols);
+        }
+
+        kt_scrollback_set_spill(grid->cold, spill);
+}
+
+/**
+ * kt_grid_set_history_bytes: Keep no more than max_bytes of the history
+ * older than the ring in memory, 0 for no limit. The ring itself is a
+ * fixed cost.
+ */
+void kt_grid_set_history_bytes(KtGrid *grid, gsize max_bytes)
+{
+        g_return_if_fail(grid != NULL);
+
+        if (grid->cold)
+                kt_scrollback_set_max_bytes(grid->cold, max_bytes);
+}
+
+guint kt_grid_get_rows(KtGrid *grid)
+{
+        g_return_val_if_fail(grid != NULL, 0);
+
+        return grid->rows;
+}
+
+guint kt_grid_get_cols(KtGrid *grid)
+{
+        g_return_val_if_fail(grid != NULL, 0);
+
+        return grid->cols;
+}
+
+/**
+ * kt_grid_get_memory: Bytes held by the grid, the compressed history
+ * and the index of what was spilled to disk included, but not the file.
+ */
+gsize kt_grid_get_memory(KtGrid *grid)
+{
+        gsize bytes, cold = 0, clusters = 0;
+
+        g_return_val_if_fail(grid != NULL, 0);
+
+        /* The ring's cells and the cold line */
+        bytes = sizeof(KtGrid) +
+                ((gsize)grid->capacity + 1) * grid->cols * sizeof(KtCell) +
+                ((gsize)grid->capacity + grid->rows) * sizeof(KtGridLine);
+
+        if (grid->cold)
+                cold = kt_scrollback_get_memory(grid->cold);
+        kt_cluster_table_get_stats(grid->clusters, NULL, &clusters);
+
+        return bytes + cold + clusters +
+                kt_style_table_get_memory(grid->styles);
+}
+
+/**
+ * kt_grid_get_line()
+ *
+ * Returns: The line at the given row of the screen. It is only valid until
+ * the grid is changed.
+ */
+KtGridLine *kt_grid_get_line(KtGrid *grid, guint row)
+{
+        g_return_val_if_fail(grid != NULL, NULL);
+        g_return_val_if_fail(row < grid->rows, NULL);
+
+        return grid_line(grid, row);
+}
+
+/**
+ * kt_grid_get_first_line()
+ *
+ * Returns: The absolute number of the oldest line of history.
+ */
+guint64 kt_grid_get_first_line(KtGrid *grid)
+{
+        guint64 boundary, rows = 0;
+
+        g_return_val_if_fail(grid != NULL, 0);
+
+        boundary = grid->scrolled - grid->history;
+        if (grid->cold)
+                rows = kt_scrollback_get_rows(grid->cold);
+
+        return boundary > rows ? boundary - rows : 0;
+}
+
+/**
+ * kt_grid_get_screen_line()
+ *
+ * Returns: The absolute number of the top line of the screen.
+ */
+guint64 kt_grid_get_screen_line(KtGrid *grid)
+{
+        g_return_val_if_fail(grid != NULL, 0);
+
+        return grid->scrolled;
+}
+
+/**
+ * kt_grid_get_line_abs: Look a line of the history or the screen up by its
+ * absolute number.
+ *
+ * Returns: The line, or NULL if it isn't kept. A line from the compressed
+ * history is a copy, only valid until the next call, and reading it may
+ * renumber the styles of all lines.
+ */
+KtGridLine *kt_grid_get_line_abs(KtGrid *grid, guint64 line)
+{
+        guint slot;
+
+        g_return_val_if_fail(grid != NULL, NULL);
+
+        if (line >= grid->scrolled + grid->rows)
+                return NULL;
+
+        if (line + grid->history < grid->scrolled) {
+                if (grid->cold == NULL)
+                        return NULL;
+
+                /* Room for a style per cell */
+                grid_reserve_styles(grid, grid->cols);
+                cells_clear(grid, grid->cold_line.cells, grid->cols);
+                if (!kt_scrollback_get_row(grid->cold,
+                                           grid->scrolled - grid->history -
+                                           1 - line, &grid->cold_line,
+                                           grid->cols, grid->styles,
+                                           grid->clusters))
+                        return NULL;
+
+                return &grid->cold_line;
+        }
+
+        if (line >= grid->scrolled)
+                return grid_line(grid, line - grid->scrolled);
+
+        slot = grid->start + grid->capacity - (guint)(grid->scrolled - line);
+        if (slot >= grid->capacity)
+                slot -= grid->capacity;
+
+        return &grid->ring[slot];
+}
+
+/**
+ * kt_grid_snapshot: Take the history and the screen, the compressed
+ * history followed by the lines of the ring. The lines of the snapshot are
+ * numbered by position: the lines of the ring go on from the compressed
+ * ones, which they join as they are pushed out, so a position stays the
+ * same line until the width changes.
+ */
+KtScrollbackSnapshot *kt_grid_snapshot(KtGrid *grid)
+{
+        KtScrollbackSnapshot *snap;
+        guint64 line, boundary;
+
+        g_return_val_if_fail(grid != NULL, NULL);
+
+        boundary = grid->scrolled - grid->history;
+        snap = kt_scrollback_snapshot_new(grid->cold, boundary);
+        for (line = boundary; line < grid->scrolled + grid->rows; line++)
+                kt_scrollback_snapshot_add(snap,
+                                           kt_grid_get_line_abs(grid, line),
+                                           grid->cols, grid->styles,
+                                           grid->clusters);
+
+        return snap;
+}
+
+/**
+ * kt_grid_find_position: Find cell col of the line at position, numbered
+ * like kt_grid_snapshot() does.
+ *
+ * Returns: TRUE if the line is still there, and then line is its absolute
+ * number and line_col the column, once rewrapped.
+ */
+gboolean kt_grid_find_position(KtGrid *grid, guint64 position, guint col,
+                               guint64 *line, guint *line_col)
+{
+        guint64 boundary, ring, back;
+
+        g_return_val_if_fail(grid != NULL, FALSE);
+
+        boundary = grid->scrolled - grid->history;
+        ring = boundary;
+        if (grid->cold)
+                ring = kt_scrollback_get_first(grid->cold) +
+                        kt_scrollback_get_lines(grid->cold);
+
+        if (position >= ring) {
+                *line = boundary + (position - ring);
+                *line_col = MIN(col, grid->cols - 1);
+                return *line < grid->scrolled + grid->rows;
+        }
+
+        if (grid->cold == NULL ||
+            !kt_scrollback_find_row(grid->cold, position, col, &back,
+                                    line_col) ||
+            back >= boundary)
+                return FALSE;
+
+        *line = boundary - 1 - back;
+        *line_col = MIN(*line_col, grid->cols - 1);
+
+        return TRUE;
+}
+
+void kt_grid_get_cursor(KtGrid *grid, guint *row, guint *col)
+{
+        g_return_if_fail(grid != NULL);
+
+        if (row)
+                *row = grid->row;
+        if (col)
+                *col = grid->col;
+}
+
+void kt_grid_set_pen(KtGrid *grid, const KtStyle *pen)
+{
+        g_return_if_fail(grid != NULL && pen != NULL);
+
+        grid->pen = *pen;
+        grid_pen_intern(grid);
+}
+
+void kt_grid_get_pen(KtGrid *grid, KtStyle *pen)
+{
+        g_return_if_fail(grid != NULL && pen != NULL);
+
+        *pen = grid->pen;
+}
+
+/**
+ * kt_grid_get_cluster()
+ *
+ * Returns: The code points of a cell with KT_CELL_CLUSTER set, and their
+ * number in n. They are only valid until the grid is changed.
+ */
+const gunichar *kt_grid_get_cluster(KtGrid *grid, const KtCell *cell,
+                                    guint *n)
+{
+        g_return_val_if_fail(grid != NULL && cell != NULL, NULL);
+
+        return kt_cluster_table_get(grid->clusters, KT_CELL_CHAR(cell), n);
+}
+
+/**
+ * kt_grid_get_style()
+ *
+ * Returns: The style of a cell's style ID. It is only valid until the grid
+ * is changed.
+ */
+const KtStyle *kt_grid_get_style(KtGrid *grid, guint id)
+{
+        g_return_val_if_fail(grid != NULL, NULL);
+
+        return kt_style_table_get(grid->styles, id);
+}
+
+/**
+ * grid_cluster_append: Add c to the grapheme cluster of the cell left of
+ * the cursor, if it continues it. A variation selector asking for emoji
+ * presentation makes the cell wide, if there is room.
+ *
+ * Returns: TRUE if c was taken, FALSE if it starts a cell of its own.
+ */
+static gboolean grid_cluster_append(KtGrid *grid, KtGridLine *line,
+                                    gunichar c)
+{
+        gunichar buf[KT_CLUSTER_MAX_CHARS + 1];
+        const gunichar *chars;
+        KtCell *cell;
+        guint col, n, id;
+
+        if (grid->wrap_pending)
+                col = grid->col;
+        else if (grid->col > 0)
+                col = grid->col - 1;
+        else
+                return FALSE;
+
+        if (col > 0 && (line->cells[col].ch & KT_CELL_WIDE_TAIL))
+                col--;
+
+        cell = &line->cells[col];
+        if (cell->ch == 0)
+                return FALSE;
+
+        chars = cell_chars(grid, cell, buf, &n);
+        if (n == 0 || !grapheme_continues(chars, n, c))
+                return FALSE;
+
+        /* Runs of marks past any sensible length are swallowed */
+        if (n >= KT_CLUSTER_MAX_CHARS)
+                return TRUE;
+
+        if (chars != buf)
+                memcpy(buf, chars, n * sizeof(gunichar));
+        buf[n++] = c;
+
+        id = kt_cluster_table_intern(grid->clusters, buf, n);
+        if (id == KT_CLUSTER_NONE)
+                return TRUE;
+
+        cells_release(grid, cell, 1);
+        cell->ch = KT_CELL_PACK(id, (cell->ch & KT_CELL_WIDE) |
+                                KT_CELL_CLUSTER);
+        line_changed(line);
+
+        if (c == 0xfe0f && !(cell->ch & KT_CELL_WIDE) &&
+            !grid->wrap_pending && grid->col < grid->cols) {
+                line_fix_wide(grid, line, grid->col, 1);
+                cells_release(grid, &cell[1], 1);
+                cell->ch |= KT_CELL_WIDE;
+                cell[1].ch = KT_CELL_PACK(0, KT_CELL_WIDE_TAIL);
+                cell[1].style = cell->style;
+
+                if (++grid->col >= grid->cols) {
+                        grid->col = grid->cols - 1;
+                        grid->wrap_pending = TRUE;
+                }
+        }
+
+        return TRUE;
+}
+
+/**
+ * kt_grid_put_chars: Write characters at the cursor with the current pen,
+ * wrapping and scrolling as needed.
+ */
+void kt_grid_put_chars(KtGrid *grid, const gunichar *chars, gsize n)
+{
+        const gunichar *end = chars + n;
+        KtGridLine *line;
+
+        g_return_if_fail(grid != NULL);
+
+        line = grid_line(grid, grid->row);
+
+        while (chars < end) {
+                gunichar c = *chars++;
+                guint width;
+                KtCell *cell;
+
+                if (c >= 0x300 && grid_cluster_append(grid, line, c))
+                        continue;
+
+                /* Marks with nothing to go on are dropped */
+                width = kt_unicode_width(c);
+                if (width == 0)
+                        continue;
+
+                if (width > grid->cols)
+                        width = 1;
+
+                if (grid->wrap_pending ||
+                    (width == 2 && grid->col == grid->cols - 1)) {
+                        if (!grid->wrap_pending)
+                                cells_clear(grid, &line->cells[grid->col], 1);
+                        line->flags |= KT_LINE_WRAPPED;
+                        kt_grid_newline(grid);
+                        grid->col = 0;
+                        line = grid_line(grid, grid->row);
+                }
+
+                line_fix_wide(grid, line, grid->col, width);
+
+                cell = &line->cells[grid->col];
+                cells_release(grid, cell, width);
+                cell->ch = KT_CELL_PACK(c, width == 2 ? KT_CELL_WIDE : 0);
+                cell->style = grid->style;
+
+                if (width == 2) {
+                        cell[1].ch = KT_CELL_PACK(0, KT_CELL_WIDE_TAIL);
+                        cell[1].style = grid->style;
+                }
+
+                line_changed(line);
+
+                grid->col += width;
+                if (grid->col >= grid->cols) {
+                        grid->col = grid->cols - 1;
+                        grid->wrap_pending = TRUE;
+                }
+        }
+}
+
+/* Line feed, scrolling at the bottom of the scrolling region */
+void kt_grid_newline(KtGrid *grid)
+{
+        g_return_if_fail(grid != NULL);
+
+        grid->wrap_pending = FALSE;
+
+        if (grid->row == grid->bottom)
+                grid_scroll_region(grid, grid->top, grid->bottom, 1, TRUE);
+        else if (grid->row < grid->rows - 1)
+                grid->row++;
+}
+
+void kt_grid_reverse_index(KtGrid *grid)
+{
+        g_return_if_fail(grid != NULL);
+
+        grid->wrap_pending = FALSE;
+
+        if (grid->row == grid->top)
+                grid_scroll_region(grid, grid->top, grid->bottom, -1, FALSE);
+        else if (grid->row > 0)
+                grid->row--;
+}
+
+void kt_grid_carriage_return(KtGrid *grid)
+{
+        g_return_if_fail(grid != NULL);
+
+        grid->col = 0;
+        grid->wrap_pending = FALSE;
+}
+
+void kt_grid_backspace(KtGrid *grid)
+{
+        g_return_if_fail(grid != NULL);
+
+        if (grid->col > 0)
+                grid->col--;
+        grid->wrap_pending = FALSE;
+}
+
+void kt_grid_tab(KtGrid *grid)
+{
+        g_return_if_fail(grid != NULL);
+
+        grid->col = MIN((grid->col / TAB_WIDTH + 1) * TAB_WIDTH,
+                        grid->cols - 1);
+        grid->wrap_pending = FALSE;
+}
+
+void kt_grid_set_cursor(KtGrid *grid, guint row, guint col)
+{
+        g_return_if_fail(grid != NULL);
+
+        grid->row = MIN(row, grid->rows - 1);
+        grid->col = MIN(col, grid->cols - 1);
+        grid->wrap_pending = FALSE;
+}
+
+void kt_grid_move_cursor(KtGrid *grid, gint rows, gint cols)
+{
+        gint row, col;
+
+        g_return_if_fail(grid != NULL);
+
+        row = CLAMP((gint)grid->row + rows, 0, (gint)grid->rows - 1);
+        col = CLAMP((gint)grid->col + cols, 0, (gint)grid->cols - 1);
+
+        kt_grid_set_cursor(grid, row, col);
+}
+
+void kt_grid_save_cursor(KtGrid *grid)
+{
+        g_return_if_fail(grid != NULL);
+
+        grid->saved_row = grid->row;
+        grid->saved_col = grid->col;
+        grid->saved_pen = grid->pen;
+}
+
+void kt_grid_restore_cursor(KtGrid *grid)
+{
+        g_return_if_fail(grid != NULL);
+
+        kt_grid_set_cursor(grid, grid->saved_row, grid->saved_col);
+        grid->pen = grid->saved_pen;
+        grid_pen_intern(grid);
+}
+
+/**
+ * kt_grid_set_margins: Set the scrolling region, top and bottom inclusive.
+ * An invalid region resets it to the whole screen.
+ */
+void kt_grid_set_margins(KtGrid *grid, guint top, guint bottom)
+{
+        g_return_if_fail(grid != NULL);
+
+        if (top >= bottom || bottom >= grid->rows) {
+                top = 0;
+                bottom = grid->rows - 1;
+        }
+
+        grid->top = top;
+        grid->bottom = bottom;
+        kt_grid_set_cursor(grid, 0, 0);
+}
+
+void kt_grid_scroll_up(KtGrid *grid, guint n)
+{
+        g_return_if_fail(grid != NULL);
+
+        grid_scroll_region(grid, grid->top, grid->bottom, MIN(n, grid->rows),
+                           TRUE);
+}
+
+void kt_grid_scroll_down(KtGrid *grid, guint n)
+{
+        g_return_if_fail(grid != NULL);
+
+        grid_scroll_region(grid, grid->top, grid->bottom,
+                           -(gint)MIN(n, grid->rows), FALSE);
+}
+
+void kt_grid_insert_lines(KtGrid *grid, guint n)
+{
+        g_return_if_fail(grid != NULL);
+
+        if (grid->row < grid->top || grid->row > grid->bottom)
+                return;
+
+        grid_scroll_region(grid, grid->row, grid->bottom,
+                           -(gint)MIN(n, grid->rows), FALSE);
+        grid->col = 0;
+        grid->wrap_pending = FALSE;
+}
+
+void kt_grid_delete_lines(KtGrid *grid, guint n)
+{
+        g_return_if_fail(grid != NULL);
+
+        if (grid->row < grid->top || grid->row > grid->bottom)
+                return;
+
+        grid_scroll_region(grid, grid->row, grid->bottom, MIN(n, grid->rows),
+                           FALSE);
+        grid->col = 0;
+        grid->wrap_pending = FALSE;
+}
+
+void kt_grid_insert_chars(KtGrid *grid, guint n)
+{
+        KtGridLine *line;
+        guint col;
+
+        g_return_if_fail(grid != NULL);
+
+        line = grid_line(grid, grid->row);
+        col = grid->col;
+        n = MIN(n, grid->cols - col);
+
+        line_fix_wide(grid, line, col, grid->cols - col);
+        cells_release(grid, line->cells + grid->cols - n, n);
+        memmove(line->cells + col + n, line->cells + col,
+                (grid->cols - col - n) * sizeof(KtCell));
+        cells_blank(grid, line->cells + col, n);
+        line_fix_last(grid, line);
+        line_changed(line);
+        grid->wrap_pending = FALSE;
+}
+
+void kt_grid_delete_chars(KtGrid *grid, guint n)
+{
+        KtGridLine *line;
+        guint col;
+
+        g_return_if_fail(grid != NULL);
+
+        line = grid_line(grid, grid->row);
+        col = grid->col;
+        n = MIN(n, grid->cols - col);
+
+        line_fix_wide(grid, line, col, n);
+        cells_release(grid, line->cells + col, n);
+        memmove(line->cells + col, line->cells + col + n,
+                (grid->cols - col - n) * sizeof(KtCell));
+        cells_blank(grid, line->cells + grid->cols - n, n);
+        line_changed(line);
+        grid->wrap_pending = FALSE;
+}
+
+void kt_grid_erase_chars(KtGrid *grid, guint n)
+{
+        KtGridLine *line;
+
+        g_return_if_fail(grid != NULL);
+
+        line = grid_line(grid, grid->row);
+        n = MIN(n, grid->cols - grid->col);
+
+        line_fix_wide(grid, line, grid->col, n);
+        cells_clear(grid, line->cells + grid->col, n);
+        line_changed(line);
+        grid->wrap_pending = FALSE;
+}
+
+void kt_grid_erase_line(KtGrid *grid, guint mode)
+{
+        KtGridLine *line;
+        guint first, last;
+
+        g_return_if_fail(grid != NULL);
+
+        line = grid_line(grid, grid->row);
+
+        switch (mode) {
+        case 0:
+                first = grid->col;
+                last = grid->cols - 1;
+                line->flags &= ~KT_LINE_WRAPPED;
+                break;
+        case 1:
+                first = 0;
+                last = grid->col;
+                break;
+        default:
+                first = 0;
+                last = grid->cols - 1;
+                line->flags &= ~KT_LINE_WRAPPED;
+                break;
+        }
+
+        line_fix_wide(grid, line, first, last - first + 1);
+        cells_clear(grid, line->cells + first, last - first + 1);
+        line_changed(line);
+        grid->wrap_pending = FALSE;
+}
+
+void kt_grid_erase_display(KtGrid *grid, guint mode)
+{
+        guint i;
+
+        g_return_if_fail(grid != NULL);
+
+        switch (mode) {
+        case 0:
+                kt_grid_erase_line(grid, 0);
+                for (i = grid->row + 1; i < grid->rows; i++)
+                        line_clear(grid, grid_line(grid, i));
+                break;
+        case 1:
+                kt_grid_erase_line(grid, 1);
+                for (i = 0; i < grid->row; i++)
+                        line_clear(grid, grid_line(grid, i));
+                break;
+        default:
+                for (i = 0; i < grid->rows; i++)
+                        line_clear(grid, grid_line(grid, i));
+                grid->wrap_pending = FALSE;
+                break;
+        }
+}
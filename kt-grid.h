@@ -0,0 +1,143 @@
+/*
+ * kt-grid.h
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KT_GRID_H
+#define KT_GRID_H
+
+#include <glib.h>
+
+#include "kt-cluster.h"
+#include "kt-spill.h"
+#include "kt-style.h"
+
+G_BEGIN_DECLS
+
+/*
+  The screen model: a rows x cols grid of character cells, and the lines
+  that scrolled off its top.
+
+  Cells are 8 bytes, a character and the ID of its style in the grid's
+  KtStyleTable, and the cells of a row are contiguous. Rows are reached
+  through a ring of KtGridLine holding both the screen and the history, so
+  scrolling and inserting or deleting lines only move those around, never
+  the cells, and scrolling the whole screen is O(1).
+ */
+
+/* Colours are 32 bits: the kind in the top byte, then a palette index or
+   24 bit RGB. */
+#define KT_CELL_COLOR_DEFAULT 0
+#define KT_CELL_COLOR_INDEXED(i) (0x01000000 | ((i) & 0xff))
+#define KT_CELL_COLOR_RGB(r, g, b) (0x02000000 | ((r) & 0xff) << 16 | \
+                                    ((g) & 0xff) << 8 | ((b) & 0xff))
+#define KT_CELL_COLOR_KIND(c) ((c) >> 24)
+#define KT_CELL_COLOR_VALUE(c) ((c) & 0x00ffffff)
+
+enum {
+        KT_CELL_COLOR_KIND_DEFAULT,
+        KT_CELL_COLOR_KIND_INDEXED,
+        KT_CELL_COLOR_KIND_RGB,
+};
+
+/* The code point takes the low 21 bits of ch. A wide character is stored
+   in its first cell, the second one only has KT_CELL_WIDE_TAIL set. An
+   empty cell has no code point. A grapheme cluster of more than one code
+   point is stored as its ID in the grid's KtClusterTable instead, with
+   KT_CELL_CLUSTER set. */
+#define KT_CELL_WIDE (1 << 21)
+#define KT_CELL_WIDE_TAIL (1 << 22)
+#define KT_CELL_CLUSTER (1 << 23)
+#define KT_CELL_CHAR(cell) ((cell)->ch & 0x1fffff)
+#define KT_CELL_PACK(c, flags) ((c) | (flags))
+
+typedef struct {
+        guint32 ch;
+        guint32 style;
+} KtCell;
+
+/* Line flags */
+#define KT_LINE_DIRTY (1 << 0) /* Changed since it was last drawn */
+#define KT_LINE_WRAPPED (1 << 1) /* Continues on the next line */
+
+typedef struct {
+        KtCell *cells;
+        guint flags;
+        guint32 gen; /* Changes whenever the cells do */
+} KtGridLine;
+
+typedef struct _KtGrid KtGrid;
+
+KtGrid *kt_grid_new(guint rows, guint cols, guint scrollback);
+void kt_grid_free(KtGrid *grid);
+void kt_grid_resize(KtGrid *grid, guint rows, guint cols);
+void kt_grid_set_spill(KtGrid *grid, KtSpill *spill);
+void kt_grid_set_history_bytes(KtGrid *grid, gsize max_bytes);
+
+guint kt_grid_get_rows(KtGrid *grid);
+guint kt_grid_get_cols(KtGrid *grid);
+gsize kt_grid_get_memory(KtGrid *grid);
+KtGridLine *kt_grid_get_line(KtGrid *grid, guint row);
+guint64 kt_grid_get_first_line(KtGrid *grid);
+guint64 kt_grid_get_screen_line(KtGrid *grid);
+KtGridLine *kt_grid_get_line_abs(KtGrid *grid, guint64 line);
+
+/* For searching the history from another thread, see kt-scrollback.h */
+struct _KtScrollbackSnapshot *kt_grid_snapshot(KtGrid *grid);
+gboolean kt_grid_find_position(KtGrid *grid, guint64 position, guint col,
+                               guint64 *line, guint *line_col);
+void kt_grid_get_cursor(KtGrid *grid, guint *row, guint *col);
+
+/* Drawing state */
+void kt_grid_set_pen(KtGrid *grid, const KtStyle *pen);
+void kt_grid_get_pen(KtGrid *grid, KtStyle *pen);
+const KtStyle *kt_grid_get_style(KtGrid *grid, guint id);
+const gunichar *kt_grid_get_cluster(KtGrid *grid, const KtCell *cell,
+                                    guint *n);
+
+/* Output */
+void kt_grid_put_chars(KtGrid *grid, const gunichar *chars, gsize n);
+void kt_grid_newline(KtGrid *grid);
+void kt_grid_reverse_index(KtGrid *grid);
+void kt_grid_carriage_return(KtGrid *grid);
+void kt_grid_backspace(KtGrid *grid);
+void kt_grid_tab(KtGrid *grid);
+
+/* Cursor movement, rows and columns are 0 based */
+void kt_grid_set_cursor(KtGrid *grid, guint row, guint col);
+void kt_grid_move_cursor(KtGrid *grid, gint rows, gint cols);
+void kt_grid_save_cursor(KtGrid *grid);
+void kt_grid_restore_cursor(KtGrid *grid);
+
+/* Editing */
+void kt_grid_set_margins(KtGrid *grid, guint top, guint bottom);
+void kt_grid_scroll_up(KtGrid *grid, guint n);
+void kt_grid_scroll_down(KtGrid *grid, guint n);
+void kt_grid_insert_lines(KtGrid *grid, guint n);
+void kt_grid_delete_lines(KtGrid *grid, guint n);
+void kt_grid_insert_chars(KtGrid *grid, guint n);
+void kt_grid_delete_chars(KtGrid *grid, guint n);
+void kt_grid_erase_chars(KtGrid *grid, guint n);
+/* mode: 0 to the end, 1 from the start, 2 all */
+void kt_grid_erase_line(KtGrid *grid, guint mode);
+void kt_grid_erase_display(KtGrid *grid, guint mode);
+
+G_END_DECLS
+#endif /* KT_GRID_H */
@@ -0,0 +1,455 @@
+/*
+ * kt-matcher.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "kt-matcher.h"
+#include "kt-util.h"
+
+#include <string.h>
+
+/* URLs, and paths of two components or more. Punctuation at the end is
+   taken to be the sentence's. */
+#define DEFAULT_PATTERN                                                 \
+        "\\b(?:(?:https?|ftp|file)://|www\\.|mailto:)"                  \
+        "[^\\s<>\"'`]*[^\\s<>\"'`.,;:!?()\\[\\]{}]"                     \
+        "|(?<![\\w/.~-])(?:~|\\.{1,2})?(?:/[\\w.+@%-]+){2,}"
+
+/* What was found on a row */
+typedef struct {
+        guint32 gen; /* Of the row */
+        guint32 prev; /* Of the rows before and after it in the logical */
+        guint32 next; /* line, 0 if the line starts or ends there */
+        guint64 update; /* The last update it was on the screen */
+        guint n;
+        KtMatchSpan *spans;
+} RowMatches;
+
+/* Where the text of a cell is in the text of a logical line */
+typedef struct {
+        guint offset;
+        guint row;
+        guint col;
+        guint width;
+} CellText;
+
+typedef struct {
+        guint row;
+        KtMatchSpan span;
+} Found;
+
+struct _KtMatcher {
+        GRegex *regex;
+        guint rows;
+        RowMatches **cache; /* What is on each row of the screen */
+        RowMatches **next; /* The cache being built by an update */
+        GHashTable *by_gen; /* The entries of cache, by row generation */
+        guint64 update;
+
+        /* Kept between updates to save allocations */
+        GString *text;
+        GArray *cells; /* Of CellText */
+        GArray *found; /* Of Found */
+
+        guint64 scanned; /* Rows matched again */
+        guint64 kept; /* Changed rows that were found as they were */
+};
+
+/* Private methods */
+static void row_matches_free(RowMatches *entry)
+{
+        FREE(&entry->spans);
+        FREE(&entry);
+}
+
+static void matcher_clear(KtMatcher *matcher)
+{
+        guint row;
+
+        for (row = 0; row < matcher->rows; row++)
+                if (matcher->cache[row])
+                        row_matches_free(matcher->cache[row]);
+
+        g_hash_table_remove_all(matcher->by_gen);
+        FREE(&matcher->cache);
+        FREE(&matcher->next);
+        matcher->rows = 0;
+}
+
+static void matcher_resize(KtMatcher *matcher, guint rows)
+{
+        matcher_clear(matcher);
+
+        matcher->rows = rows;
+        matcher->cache = NEW(RowMatches *, rows);
+        MEMSET(matcher->cache, rows);
+        matcher->next = NEW(RowMatches *, rows);
+        MEMSET(matcher->next, rows);
+}
+
+static inline guint32 row_gen(KtGrid *grid, guint row)
+{
+        return kt_grid_get_line(grid, row)->gen;
+}
+
+/**
+ * group_kept: Whether the rows first to last, a logical line, were all
+ * seen as they are now, and in the same logical line, wherever they were.
+ * If so, they go in the new cache.
+ */
+static gboolean group_kept(KtMatcher *matcher, KtGrid *grid, guint first,
+                           guint last)
+{
+        guint row;
+
+        for (row = first; row <= last; row++) {
+                guint32 gen = row_gen(grid, row);
+                RowMatches *entry = matcher->cache[row];
+
+                if (entry == NULL || entry->gen != gen)
+                        entry = g_hash_table_lookup(matcher->by_gen,
+                                                    GUINT_TO_POINTER(gen));
+
+                if (entry == NULL ||
+                    entry->prev != (row > first ? row_gen(grid, row - 1) : 0) ||
+                    entry->next != (row < last ? row_gen(grid, row + 1) : 0))
+                        return FALSE;
+
+                matcher->next[row] = entry;
+        }
+
+        for (row = first; row <= last; row++)
+                matcher->next[row]->update = matcher->update;
+
+        return TRUE;
+}
+
+static inline void text_append(GString *text, gunichar c)
+{
+        if (c < 0x80)
+                g_string_append_c(text, c);
+        else
+                g_string_append_unichar(text, g_unichar_validate(c) ?
+                                        c : 0xfffd);
+}
+
+/* The text of the logical line on rows first to last */
+static void group_text(KtMatcher *matcher, KtGrid *grid, guint first,
+                       guint last)
+{
+        guint cols = kt_grid_get_cols(grid);
+        guint row, col, end, i, n;
+
+        g_string_truncate(matcher->text, 0);
+        g_array_set_size(matcher->cells, 0);
+
+        for (row = first; row <= last; row++) {
+                const KtGridLine *line = kt_grid_get_line(grid, row);
+
+                /* The blanks after the end of the line don't match */
+                end = cols;
+                if (row == last)
+                        while (end > 0 && line->cells[end - 1].ch == 0)
+                                end--;
+
+                for (col = 0; col < end; col++) {
+                        const KtCell *cell = &line->cells[col];
+                        CellText at;
+
+                        if (cell->ch & KT_CELL_WIDE_TAIL)
+                                continue;
+
+                        /* Left by a wide character that didn't fit */
+                        if (cell->ch == 0 && col == cols - 1 && row < last)
+                                continue;
+
+                        at.offset = matcher->text->len;
+                        at.row = row;
+                        at.col = col;
+                        at.width = cell->ch & KT_CELL_WIDE ? 2 : 1;
+                        g_array_append_val(matcher->cells, at);
+
+                        if (cell->ch & KT_CELL_CLUSTER) {
+                                const gunichar *chars;
+
+                                chars = kt_grid_get_cluster(grid, cell, &n);
+                                for (i = 0; i < n; i++)
+                                        text_append(matcher->text, chars[i]);
+                        } else if (KT_CELL_CHAR(cell)) {
+                                text_append(matcher->text,
+                                            KT_CELL_CHAR(cell));
+                        } else {
+                                g_string_append_c(matcher->text, ' ');
+                        }
+                }
+        }
+}
+
+/* The cell the text at offset belongs to */
+static const CellText *cell_at(GArray *cells, guint offset)
+{
+        guint lo = 0, hi = cells->len;
+
+        while (hi - lo > 1) {
+                guint mid = lo + (hi - lo) / 2;
+
+                if (g_array_index(cells, CellText, mid).offset <= offset)
+                        lo = mid;
+                else
+                        hi = mid;
+        }
+
+        return &g_array_index(cells, CellText, lo);
+}
+
+/* A match of the text from start to end, a span on each of its rows */
+static void group_found(KtMatcher *matcher, guint cols, guint start,
+                        guint end)
+{
+        const CellText *from = cell_at(matcher->cells, start);
+        const CellText *to = cell_at(matcher->cells, end - 1);
+        Found found;
+
+        for (found.row = from->row; found.row <= to->row; found.row++) {
+                found.span.start = found.row == from->row ? from->col : 0;
+                found.span.end = found.row == to->row ?
+                        to->col + to->width : cols;
+                g_array_append_val(matcher->found, found);
+        }
+}
+
+/**
+ * group_scan: Match the logical line on rows first to last again. The rows
+ * whose spans changed are marked dirty for drawing them.
+ */
+static void group_scan(KtMatcher *matcher, KtGrid *grid, guint first,
+                       guint last)
+{
+        guint cols = kt_grid_get_cols(grid);
+        GMatchInfo *info;
+        guint row, i = 0;
+
+        group_text(matcher, grid, first, last);
+        g_array_set_size(matcher->found, 0);
+
+        if (matcher->text->len > 0) {
+                g_regex_match_full(matcher->regex, matcher->text->str,
+                                   matcher->text->len, 0,
+                                   G_REGEX_MATCH_NOTEMPTY, &info, NULL);
+                while (g_match_info_matches(info)) {
+                        gint start, end;
+
+                        g_match_info_fetch_pos(info, 0, &start, &end);
+                        group_found(matcher, cols, start, end);
+                        g_match_info_next(info, NULL);
+                }
+                g_match_info_free(info);
+        }
+
+        for (row = first; row <= last; row++) {
+                KtGridLine *line = kt_grid_get_line(grid, row);
+                RowMatches *entry, *old = matcher->cache[row];
+                guint n = 0;
+
+                while (i + n < matcher->found->len &&
+                       g_array_index(matcher->found, Found, i + n).row == row)
+                        n++;
+
+                entry = NEW(RowMatches, 1);
+                entry->gen = line->gen;
+                entry->prev = row > first ? row_gen(grid, row - 1) : 0;
+                entry->next = row < last ? row_gen(grid, row + 1) : 0;
+                entry->update = matcher->update;
+                entry->n = n;
+                entry->spans = NULL;
+                if (n > 0) {
+                        guint k;
+
+                        entry->spans = NEW(KtMatchSpan, n);
+                        for (k = 0; k < n; k++)
+                                entry->spans[k] = g_array_index(matcher->found,
+                                                                Found,
+                                                                i + k).span;
+                }
+                i += n;
+
+                /* Drawn with the old spans */
+                if (old == NULL || old->n != n ||
+                    (n > 0 && memcmp(old->spans, entry->spans,
+                                     n * sizeof(KtMatchSpan)) != 0))
+                        line->flags |= KT_LINE_DIRTY;
+
+                g_hash_table_insert(matcher->by_gen,
+                                    GUINT_TO_POINTER(entry->gen), entry);
+                matcher->next[row] = entry;
+        }
+
+        matcher->scanned += last - first + 1;
+}
+
+/* Public methods */
+
+/**
+ * kt_matcher_new: Set up matching pattern, a GRegex, or URLs and paths if
+ * it is NULL.
+ *
+ * Returns: The matcher, or NULL with error set if the pattern is invalid.
+ */
+KtMatcher *kt_matcher_new(const gchar *pattern, GError **error)
+{
+        KtMatcher *matcher;
+        GRegex *regex;
+
+        regex = g_regex_new(pattern ? pattern : DEFAULT_PATTERN,
+                            G_REGEX_OPTIMIZE, 0, error);
+        if (regex == NULL)
+                return NULL;
+
+        matcher = NEW(KtMatcher, 1);
+        MEMSET(matcher, 1);
+
+        matcher->regex = regex;
+        matcher->by_gen = g_hash_table_new(g_direct_hash, g_direct_equal);
+        matcher->text = g_string_sized_new(1024);
+        matcher->cells = g_array_new(FALSE, FALSE, sizeof(CellText));
+        matcher->found = g_array_new(FALSE, FALSE, sizeof(Found));
+
+        return matcher;
+}
+
+void kt_matcher_free(KtMatcher *matcher)
+{
+        if (matcher == NULL)
+                return;
+
+        matcher_clear(matcher);
+        g_hash_table_unref(matcher->by_gen);
+        g_regex_unref(matcher->regex);
+        g_string_free(matcher->text, TRUE);
+        g_array_free(matcher->cells, TRUE);
+        g_array_free(matcher->found, TRUE);
+        FREE(&matcher);
+}
+
+/**
+ * kt_matcher_update: Catch up with the screen of grid, before drawing it.
+ * Only the logical lines with dirty rows are looked at, and only those
+ * with rows that weren't seen before are matched again. Rows whose spans
+ * changed are marked dirty.
+ */
+void kt_matcher_update(KtMatcher *matcher, KtGrid *grid)
+{
+        RowMatches **swap;
+        guint rows, first, last, row;
+
+        g_return_if_fail(matcher != NULL);
+        g_return_if_fail(grid != NULL);
+
+        rows = kt_grid_get_rows(grid);
+        if (rows != matcher->rows)
+                matcher_resize(matcher, rows);
+
+        matcher->update++;
+
+        for (first = 0; first < rows; first = last + 1) {
+                gboolean dirty = FALSE;
+
+                for (last = first; ; last++) {
+                        const KtGridLine *line = kt_grid_get_line(grid, last);
+
+                        if (line->flags & KT_LINE_DIRTY)
+                                dirty = TRUE;
+                        if (!(line->flags & KT_LINE_WRAPPED) ||
+                            last == rows - 1)
+                                break;
+                }
+
+                if (!dirty) {
+                        /* Untouched since the last update */
+                        for (row = first; row <= last; row++)
+                                if (matcher->cache[row] == NULL)
+                                        break;
+                        if (row > last) {
+                                for (row = first; row <= last; row++) {
+                                        matcher->next[row] =
+                                                matcher->cache[row];
+                                        matcher->next[row]->update =
+                                                matcher->update;
+                                }
+                                continue;
+                        }
+                }
+
+                if (group_kept(matcher, grid, first, last))
+                        matcher->kept += last - first + 1;
+                else
+                        group_scan(matcher, grid, first, last);
+        }
+
+        /* What is no longer on the screen */
+        for (row = 0; row < rows; row++) {
+                RowMatches *entry = matcher->cache[row];
+
+                if (entry == NULL || entry->update == matcher->update)
+                        continue;
+
+                if (g_hash_table_lookup(matcher->by_gen,
+                                        GUINT_TO_POINTER(entry->gen)) == entry)
+                        g_hash_table_remove(matcher->by_gen,
+                                            GUINT_TO_POINTER(entry->gen));
+                row_matches_free(entry);
+        }
+
+        swap = matcher->cache;
+        matcher->cache = matcher->next;
+        matcher->next = swap;
+}
+
+/**
+ * kt_matcher_get_spans: Look up what was found on a row of the screen at
+ * the last update.
+ *
+ * Returns: The spans, n of them, left to right.
+ */
+const KtMatchSpan *kt_matcher_get_spans(KtMatcher *matcher, guint row,
+                                        guint *n)
+{
+        RowMatches *entry;
+
+        g_return_val_if_fail(matcher != NULL, NULL);
+
+        entry = row < matcher->rows ? matcher->cache[row] : NULL;
+        *n = entry ? entry->n : 0;
+
+        return entry ? entry->spans : NULL;
+}
+
+/**
+ * kt_matcher_get_stats: How much matching the updates saved, the rows that
+ * were matched again and the changed ones that were not.
+ */
+void kt_matcher_get_stats(KtMatcher *matcher, guint64 *scanned,
+                          guint64 *kept)
+{
+        g_return_if_fail(matcher != NULL);
+
+        *scanned = matcher->scanned;
+        *kept = matcher->kept;
+}
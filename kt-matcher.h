@@ -0,0 +1,59 @@
+/*
+ * kt-matcher.h
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KT_MATCHER_H
+#define KT_MATCHER_H
+
+#include <glib.h>
+
+#include "kt-grid.h"
+
+G_BEGIN_DECLS
+
+/*
+  Finding URLs, paths and the like on the screen of a grid, for drawing
+  them underlined.
+
+  What was found is kept per row along with the content generation of the
+  row, so only the rows that changed since the last update are looked at
+  again, wherever scrolling took the others. A pattern is matched against
+  logical lines, and a match that goes on past a soft wrap gets a span on
+  each of its rows. Logical lines are taken as far as the screen goes.
+ */
+typedef struct _KtMatcher KtMatcher;
+
+typedef struct {
+        guint start; /* First column */
+        guint end; /* Past the last one */
+} KtMatchSpan;
+
+KtMatcher *kt_matcher_new(const gchar *pattern, GError **error);
+void kt_matcher_free(KtMatcher *matcher);
+
+void kt_matcher_update(KtMatcher *matcher, KtGrid *grid);
+const KtMatchSpan *kt_matcher_get_spans(KtMatcher *matcher, guint row,
+                                        guint *n);
+void kt_matcher_get_stats(KtMatcher *matcher, guint64 *scanned,
+                          guint64 *kept);
+
+G_END_DECLS
+#endif /* KT_MATCHER_H */
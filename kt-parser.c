@@ -0,0 +1,510 @@
+/*
+ * kt-parser.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "kt-parser.h"
+#include "kt-util.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/* States of the DEC ANSI parser */
+enum {
+        STATE_GROUND,
+        STATE_ESCAPE,
+        STATE_ESCAPE_INTERMEDIATE,
+        STATE_CSI_ENTRY,
+        STATE_CSI_PARAM,
+        STATE_CSI_INTERMEDIATE,
+        STATE_CSI_IGNORE,
+        STATE_DCS_ENTRY,
+        STATE_DCS_PARAM,
+        STATE_DCS_INTERMEDIATE,
+        STATE_DCS_PASSTHROUGH,
+        STATE_DCS_IGNORE,
+        STATE_OSC_STRING,
+        STATE_SOS_PM_APC_STRING,
+        STATE_LAST
+};
+
+/* Transition actions. Entry and exit actions are implied by the states. */
+enum {
+        ACTION_NONE,
+        ACTION_IGNORE,
+        ACTION_PRINT,
+        ACTION_EXECUTE,
+        ACTION_COLLECT,
+        ACTION_PARAM,
+        ACTION_ESC_DISPATCH,
+        ACTION_CSI_DISPATCH,
+        ACTION_PUT,
+        ACTION_OSC_PUT,
+        ACTION_LAST
+};
+
+/* A table entry packs the action in the high nibble and the next state in
+   the low one. */
+#define ENTRY(action, state) ((guint8)((action) << 4 | (state)))
+#define ENTRY_ACTION(entry) ((entry) >> 4)
+#define ENTRY_STATE(entry) ((entry) & 0x0f)
+
+#define PARAM_VALUE_MAX 65535
+
+static guint8 parser_table[STATE_LAST][256];
+
+/*
+  In the ground state everything but the C0 controls and DEL is printed,
+  and most of the output is plain text. scan_ground() returns the first byte
+  in [p, end) that is not printed, or end; the widest implementation the CPU
+  supports is picked when the table is built.
+ */
+typedef const guint8 *(*ScanFunc)(const guint8 *p, const guint8 *end);
+
+static ScanFunc scan_ground;
+
+struct _KtParser {
+        guint state;
+
+        gint params[KT_PARSER_PARAMS_MAX];
+        gsize n_params;
+        gboolean params_overflow;
+
+        guint8 intermediates[KT_PARSER_INTERMEDIATES_MAX];
+        gsize n_intermediates;
+        gboolean intermediates_overflow;
+
+        guint8 osc[KT_PARSER_OSC_MAX];
+        gsize osc_length;
+
+        KtParserCallbacks cb;
+        gpointer user_data;
+};
+
+/* Private methods */
+static const guint8 *scan_ground_scalar(const guint8 *p, const guint8 *end)
+{
+        while (p < end && *p >= 0x20 && *p != 0x7f)
+                p++;
+
+        return p;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static const guint8 *scan_ground_sse2(const guint8 *p, const guint8 *end)
+{
+        const __m128i c0_max = _mm_set1_epi8(0x1f);
+        const __m128i del = _mm_set1_epi8(0x7f);
+
+        while (end - p >= 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *)p);
+                /* min(v, 0x1f) == v iff v <= 0x1f, unsigned */
+                __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, c0_max), v),
+                                            _mm_cmpeq_epi8(v, del));
+                gint mask = _mm_movemask_epi8(stop);
+
+                if (mask)
+                        return p + __builtin_ctz(mask);
+                p += 16;
+        }
+
+        return scan_ground_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const guint8 *scan_ground_avx2(const guint8 *p, const guint8 *end)
+{
+        const __m256i c0_max = _mm256_set1_epi8(0x1f);
+        const __m256i del = _mm256_set1_epi8(0x7f);
+
+        while (end - p >= 32) {
+                __m256i v = _mm256_loadu_si256((const __m256i *)p);
+                __m256i stop = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(v, c0_max), v),
+                                               _mm256_cmpeq_epi8(v, del));
+                guint mask = _mm256_movemask_epi8(stop);
+
+                if (mask)
+                        return p + __builtin_ctz(mask);
+                p += 32;
+        }
+
+        return scan_ground_sse2(p, end);
+}
+#endif
+
+static ScanFunc scan_ground_select(void)
+{
+#ifdef HAVE_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+                return scan_ground_avx2;
+        if (__builtin_cpu_supports("sse2"))
+                return scan_ground_sse2;
+#endif
+        return scan_ground_scalar;
+}
+
+static void table_set(guint state, guint first, guint last,
+                      guint action, guint next)
+{
+        guint c;
+
+        for (c = first; c <= last; c++)
+                parser_table[state][c] = ENTRY(action, next);
+}
+
+/* The C0 controls, except CAN, SUB and ESC which are handled everywhere */
+static void table_set_c0(guint state, guint action)
+{
+        table_set(state, 0x00, 0x17, action, state);
+        table_set(state, 0x19, 0x19, action, state);
+        table_set(state, 0x1c, 0x1f, action, state);
+}
+
+/**
+ * parser_table_init: Build the transition table from the state diagram.
+ * This is done once, the table is shared by all the parsers.
+ */
+static void parser_table_init(void)
+{
+        guint s;
+
+        for (s = 0; s < STATE_LAST; s++) {
+                table_set(s, 0x00, 0xff, ACTION_IGNORE, s);
+
+                /* "Anywhere" transitions */
+                table_set(s, 0x18, 0x18, ACTION_EXECUTE, STATE_GROUND);
+                table_set(s, 0x1a, 0x1a, ACTION_EXECUTE, STATE_GROUND);
+                table_set(s, 0x1b, 0x1b, ACTION_NONE, STATE_ESCAPE);
+        }
+
+        /* Ground. DEL is dropped rather than printed. */
+        table_set_c0(STATE_GROUND, ACTION_EXECUTE);
+        table_set(STATE_GROUND, 0x20, 0x7e, ACTION_PRINT, STATE_GROUND);
+        table_set(STATE_GROUND, 0x80, 0xff, ACTION_PRINT, STATE_GROUND);
+
+        /* Escape */
+        table_set_c0(STATE_ESCAPE, ACTION_EXECUTE);
+        table_set(STATE_ESCAPE, 0x20, 0x2f, ACTION_COLLECT, STATE_ESCAPE_INTERMEDIATE);
+        table_set(STATE_ESCAPE, 0x30, 0x7e, ACTION_ESC_DISPATCH, STATE_GROUND);
+        table_set(STATE_ESCAPE, 0x50, 0x50, ACTION_NONE, STATE_DCS_ENTRY);
+        table_set(STATE_ESCAPE, 0x58, 0x58, ACTION_NONE, STATE_SOS_PM_APC_STRING);
+        table_set(STATE_ESCAPE, 0x5b, 0x5b, ACTION_NONE, STATE_CSI_ENTRY);
+        table_set(STATE_ESCAPE, 0x5d, 0x5d, ACTION_NONE, STATE_OSC_STRING);
+        table_set(STATE_ESCAPE, 0x5e, 0x5f, ACTION_NONE, STATE_SOS_PM_APC_STRING);
+
+        table_set_c0(STATE_ESCAPE_INTERMEDIATE, ACTION_EXECUTE);
+        table_set(STATE_ESCAPE_INTERMEDIATE, 0x20, 0x2f, ACTION_COLLECT, STATE_ESCAPE_INTERMEDIATE);
+        table_set(STATE_ESCAPE_INTERMEDIATE, 0x30, 0x7e, ACTION_ESC_DISPATCH, STATE_GROUND);
+
+        /* CSI */
+        table_set_c0(STATE_CSI_ENTRY, ACTION_EXECUTE);
+        table_set(STATE_CSI_ENTRY, 0x20, 0x2f, ACTION_COLLECT, STATE_CSI_INTERMEDIATE);
+        table_set(STATE_CSI_ENTRY, 0x30, 0x39, ACTION_PARAM, STATE_CSI_PARAM);
+        table_set(STATE_CSI_ENTRY, 0x3a, 0x3a, ACTION_NONE, STATE_CSI_IGNORE);
+        table_set(STATE_CSI_ENTRY, 0x3b, 0x3b, ACTION_PARAM, STATE_CSI_PARAM);
+        table_set(STATE_CSI_ENTRY, 0x3c, 0x3f, ACTION_COLLECT, STATE_CSI_PARAM);
+        table_set(STATE_CSI_ENTRY, 0x40, 0x7e, ACTION_CSI_DISPATCH, STATE_GROUND);
+
+        table_set_c0(STATE_CSI_PARAM, ACTION_EXECUTE);
+        table_set(STATE_CSI_PARAM, 0x20, 0x2f, ACTION_COLLECT, STATE_CSI_INTERMEDIATE);
+        table_set(STATE_CSI_PARAM, 0x30, 0x39, ACTION_PARAM, STATE_CSI_PARAM);
+        table_set(STATE_CSI_PARAM, 0x3a, 0x3a, ACTION_NONE, STATE_CSI_IGNORE);
+        table_set(STATE_CSI_PARAM, 0x3b, 0x3b, ACTION_PARAM, STATE_CSI_PARAM);
+        table_set(STATE_CSI_PARAM, 0x3c, 0x3f, ACTION_NONE, STATE_CSI_IGNORE);
+        table_set(STATE_CSI_PARAM, 0x40, 0x7e, ACTION_CSI_DISPATCH, STATE_GROUND);
+
+        table_set_c0(STATE_CSI_INTERMEDIATE, ACTION_EXECUTE);
+        table_set(STATE_CSI_INTERMEDIATE, 0x20, 0x2f, ACTION_COLLECT, STATE_CSI_INTERMEDIATE);
+        table_set(STATE_CSI_INTERMEDIATE, 0x30, 0x3f, ACTION_NONE, STATE_CSI_IGNORE);
+        table_set(STATE_CSI_INTERMEDIATE, 0x40, 0x7e, ACTION_CSI_DISPATCH, STATE_GROUND);
+
+        table_set_c0(STATE_CSI_IGNORE, ACTION_EXECUTE);
+        table_set(STATE_CSI_IGNORE, 0x40, 0x7e, ACTION_NONE, STATE_GROUND);
+
+        /* DCS */
+        table_set(STATE_DCS_ENTRY, 0x20, 0x2f, ACTION_COLLECT, STATE_DCS_INTERMEDIATE);
+        table_set(STATE_DCS_ENTRY, 0x30, 0x39, ACTION_PARAM, STATE_DCS_PARAM);
+        table_set(STATE_DCS_ENTRY, 0x3a, 0x3a, ACTION_NONE, STATE_DCS_IGNORE);
+        table_set(STATE_DCS_ENTRY, 0x3b, 0x3b, ACTION_PARAM, STATE_DCS_PARAM);
+        table_set(STATE_DCS_ENTRY, 0x3c, 0x3f, ACTION_COLLECT, STATE_DCS_PARAM);
+        table_set(STATE_DCS_ENTRY, 0x40, 0x7e, ACTION_NONE, STATE_DCS_PASSTHROUGH);
+
+        table_set(STATE_DCS_PARAM, 0x20, 0x2f, ACTION_COLLECT, STATE_DCS_INTERMEDIATE);
+        table_set(STATE_DCS_PARAM, 0x30, 0x39, ACTION_PARAM, STATE_DCS_PARAM);
+        table_set(STATE_DCS_PARAM, 0x3a, 0x3a, ACTION_NONE, STATE_DCS_IGNORE);
+        table_set(STATE_DCS_PARAM, 0x3b, 0x3b, ACTION_PARAM, STATE_DCS_PARAM);
+        table_set(STATE_DCS_PARAM, 0x3c, 0x3f, ACTION_NONE, STATE_DCS_IGNORE);
+        table_set(STATE_DCS_PARAM, 0x40, 0x7e, ACTION_NONE, STATE_DCS_PASSTHROUGH);
+
+        table_set(STATE_DCS_INTERMEDIATE, 0x20, 0x2f, ACTION_COLLECT, STATE_DCS_INTERMEDIATE);
+        table_set(STATE_DCS_INTERMEDIATE, 0x30, 0x3f, ACTION_NONE, STATE_DCS_IGNORE);
+        table_set(STATE_DCS_INTERMEDIATE, 0x40, 0x7e, ACTION_NONE, STATE_DCS_PASSTHROUGH);
+
+        table_set_c0(STATE_DCS_PASSTHROUGH, ACTION_PUT);
+        table_set(STATE_DCS_PASSTHROUGH, 0x20, 0x7e, ACTION_PUT, STATE_DCS_PASSTHROUGH);
+        table_set(STATE_DCS_PASSTHROUGH, 0x80, 0xff, ACTION_PUT, STATE_DCS_PASSTHROUGH);
+
+        /* OSC. Like xterm, BEL terminates the string as well as ST. */
+        table_set(STATE_OSC_STRING, 0x07, 0x07, ACTION_NONE, STATE_GROUND);
+        table_set(STATE_OSC_STRING, 0x20, 0x7f, ACTION_OSC_PUT, STATE_OSC_STRING);
+        table_set(STATE_OSC_STRING, 0x80, 0xff, ACTION_OSC_PUT, STATE_OSC_STRING);
+
+        /* DCS ignore and SOS/PM/APC strings ignore everything */
+
+        scan_ground = scan_ground_select();
+}
+
+static void parser_clear(KtParser *parser)
+{
+        parser->n_params = 0;
+        parser->params_overflow = FALSE;
+        parser->n_intermediates = 0;
+        parser->intermediates_overflow = FALSE;
+}
+
+static void parser_collect(KtParser *parser, guint8 c)
+{
+        if (parser->n_intermediates < KT_PARSER_INTERMEDIATES_MAX)
+                parser->intermediates[parser->n_intermediates++] = c;
+        else
+                parser->intermediates_overflow = TRUE;
+}
+
+static void parser_param(KtParser *parser, guint8 c)
+{
+        gint *param;
+
+        if (parser->n_params == 0)
+                parser->params[parser->n_params++] = 0;
+
+        if (c == ';') {
+                if (parser->n_params < KT_PARSER_PARAMS_MAX)
+                        parser->params[parser->n_params++] = 0;
+                else
+                        parser->params_overflow = TRUE;
+                return;
+        }
+
+        /* Digits past the last parameter are dropped */
+        if (parser->params_overflow)
+                return;
+
+        param = &parser->params[parser->n_params - 1];
+        *param = MIN(*param * 10 + (c - '0'), PARAM_VALUE_MAX);
+}
+
+static void parser_action(KtParser *parser, guint action, guint8 c)
+{
+        KtParserCallbacks *cb = &parser->cb;
+
+        switch (action) {
+        case ACTION_PRINT:
+                if (cb->print)
+                        cb->print(&c, 1, parser->user_data);
+                break;
+        case ACTION_EXECUTE:
+                if (cb->execute)
+                        cb->execute(c, parser->user_data);
+                break;
+        case ACTION_COLLECT:
+                parser_collect(parser, c);
+                break;
+        case ACTION_PARAM:
+                parser_param(parser, c);
+                break;
+        case ACTION_ESC_DISPATCH:
+                if (cb->esc_dispatch && !parser->intermediates_overflow)
+                        cb->esc_dispatch(parser->intermediates,
+                                         parser->n_intermediates,
+                                         c,
+                                         parser->user_data);
+                break;
+        case ACTION_CSI_DISPATCH:
+                if (cb->csi_dispatch && !parser->intermediates_overflow)
+                        cb->csi_dispatch(parser->params,
+                                         parser->n_params,
+                                         parser->intermediates,
+                                         parser->n_intermediates,
+                                         c,
+                                         parser->user_data);
+                break;
+        case ACTION_PUT:
+                if (cb->dcs_put)
+                        cb->dcs_put(c, parser->user_data);
+                break;
+        case ACTION_OSC_PUT:
+                if (parser->osc_length < KT_PARSER_OSC_MAX)
+                        parser->osc[parser->osc_length++] = c;
+                break;
+        case ACTION_NONE:
+        case ACTION_IGNORE:
+        default:
+                break;
+        }
+}
+
+static void parser_exit(KtParser *parser)
+{
+        KtParserCallbacks *cb = &parser->cb;
+
+        switch (parser->state) {
+        case STATE_OSC_STRING:
+                if (cb->osc_dispatch)
+                        cb->osc_dispatch(parser->osc,
+                                         parser->osc_length,
+                                         parser->user_data);
+                break;
+        case STATE_DCS_PASSTHROUGH:
+                if (cb->dcs_unhook)
+                        cb->dcs_unhook(parser->user_data);
+                break;
+        default:
+                break;
+        }
+}
+
+static void parser_enter(KtParser *parser, guint state, guint8 c)
+{
+        KtParserCallbacks *cb = &parser->cb;
+
+        switch (state) {
+        case STATE_ESCAPE:
+        case STATE_CSI_ENTRY:
+        case STATE_DCS_ENTRY:
+                parser_clear(parser);
+                break;
+        case STATE_OSC_STRING:
+                parser->osc_length = 0;
+                break;
+        case STATE_DCS_PASSTHROUGH:
+                if (cb->dcs_hook && !parser->intermediates_overflow)
+                        cb->dcs_hook(parser->params,
+                                     parser->n_params,
+                                     parser->intermediates,
+                                     parser->n_intermediates,
+                                     c,
+                                     parser->user_data);
+                break;
+        default:
+                break;
+        }
+
+        parser->state = state;
+}
+
+/* Public methods */
+
+/**
+ * kt_parser_new: Create a parser calling the given callbacks with
+ * user_data. The callbacks are copied.
+ */
+KtParser *kt_parser_new(const KtParserCallbacks *callbacks,
+                        gpointer user_data)
+{
+        static gsize table_ready = 0;
+        KtParser *parser;
+
+        g_return_val_if_fail(callbacks != NULL, NULL);
+
+        if (g_once_init_enter(&table_ready)) {
+                parser_table_init();
+                g_once_init_leave(&table_ready, 1);
+        }
+
+        parser = NEW(KtParser, 1);
+        if (parser == NULL)
+                return NULL;
+
+        MEMSET(parser, 1);
+        parser->cb = *callbacks;
+        parser->user_data = user_data;
+        parser->state = STATE_GROUND;
+
+        return parser;
+}
+
+void kt_parser_free(KtParser *parser)
+{
+        if (parser == NULL)
+                return;
+
+        FREE(&parser);
+}
+
+/**
+ * kt_parser_reset: Drop any partial sequence and go back to the ground
+ * state.
+ */
+void kt_parser_reset(KtParser *parser)
+{
+        g_return_if_fail(parser != NULL);
+
+        parser_clear(parser);
+        parser->osc_length = 0;
+        parser->state = STATE_GROUND;
+}
+
+/**
+ * kt_parser_feed: Parse length bytes of data. The data doesn't have to end
+ * on a sequence boundary, the rest of the sequence is expected in the next
+ * call.
+ */
+void kt_parser_feed(KtParser *parser, const guint8 *data, gsize length)
+{
+        const guint8 *p = data;
+        const guint8 *end = data + length;
+
+        g_return_if_fail(parser != NULL);
+
+        while (p < end) {
+                guint8 c, entry;
+                guint next;
+
+                /* Hand out runs of text in one call */
+                if (parser->state == STATE_GROUND) {
+                        const guint8 *run = p;
+
+                        p = scan_ground(p, end);
+                        if (p > run) {
+                                if (parser->cb.print)
+                                        parser->cb.print(run, p - run,
+                                                         parser->user_data);
+                                continue;
+                        }
+                }
+
+                c = *p++;
+                entry = parser_table[parser->state][c];
+                next = ENTRY_STATE(entry);
+
+                /* ESC always re-enters the escape state, clearing it */
+                if (next != parser->state || c == 0x1b) {
+                        parser_exit(parser);
+                        parser_action(parser, ENTRY_ACTION(entry), c);
+                        parser_enter(parser, next, c);
+                } else {
+                        parser_action(parser, ENTRY_ACTION(entry), c);
+                }
+        }
+}
@@ -0,0 +1,88 @@
+/*
+ * kt-parser.h
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KT_PARSER_H
+#define KT_PARSER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+  A parser for the escape sequences of the VT500 series terminals, following
+  the state diagram of the DEC ANSI parser. It turns the byte stream coming
+  from the pty into calls of the callbacks below.
+
+  The parser keeps all its state in the KtParser, so a sequence can be split
+  at any byte between two calls of kt_parser_feed(), and nothing is
+  allocated while parsing.
+
+  The stream is assumed to be UTF-8: bytes from 0x80 up are printed in the
+  ground state (and passed through in OSC and DCS strings) rather than being
+  taken as C1 controls.
+ */
+#define KT_PARSER_PARAMS_MAX 16
+#define KT_PARSER_INTERMEDIATES_MAX 2
+#define KT_PARSER_OSC_MAX 4096
+
+typedef struct _KtParser KtParser;
+
+/* Any of the callbacks can be NULL. Parameters that were left out are 0. */
+typedef struct {
+        /* A run of printable bytes */
+        void (*print)(const guint8 *data, gsize length, gpointer user_data);
+        /* A C0 control */
+        void (*execute)(guint8 c, gpointer user_data);
+        void (*esc_dispatch)(const guint8 *intermediates,
+                             gsize n_intermediates,
+                             guint8 final,
+                             gpointer user_data);
+        /* Private markers ("?", ">"...) are passed as intermediates */
+        void (*csi_dispatch)(const gint *params,
+                             gsize n_params,
+                             const guint8 *intermediates,
+                             gsize n_intermediates,
+                             guint8 final,
+                             gpointer user_data);
+        /* Strings longer than KT_PARSER_OSC_MAX are truncated */
+        void (*osc_dispatch)(const guint8 *data,
+                             gsize length,
+                             gpointer user_data);
+        void (*dcs_hook)(const gint *params,
+                         gsize n_params,
+                         const guint8 *intermediates,
+                         gsize n_intermediates,
+                         guint8 final,
+                         gpointer user_data);
+        void (*dcs_put)(guint8 c, gpointer user_data);
+        void (*dcs_unhook)(gpointer user_data);
+} KtParserCallbacks;
+
+KtParser *kt_parser_new(const KtParserCallbacks *callbacks,
+                        gpointer user_data);
+void kt_parser_free(KtParser *parser);
+
+void kt_parser_feed(KtParser *parser, const guint8 *data, gsize length);
+void kt_parser_reset(KtParser *parser);
+
+G_END_DECLS
+#endif /* KT_PARSER_H */
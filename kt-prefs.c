@@ -59,6 +59,22 @@ static void kt_prefs_init(KtPrefs *prefs)
 
         prefs->font_name = "Monospace";
         prefs->font_size = 12;
+
+        prefs->ring_size = 1024 * 1024;
+        prefs->read_budget_bytes = 256 * 1024;
+        prefs->read_budget_usec = 5000;
+        prefs->threaded_reader = FALSE;
+        prefs->io_uring = FALSE;
+        prefs->write_queue_size = 64 * 1024;
+        prefs->pty_pool_size = 0;
+
+        prefs->scrollback_lines = 4096;
+        prefs->scrollback_spill_mb = 0;
+        prefs->scrollback_mb = 0;
+        prefs->scrollback_total_mb = 0;
+
+        prefs->highlight_matches = TRUE;
+        prefs->match_pattern = NULL;
 }
 
 /* Public methods */
@@ -71,6 +87,7 @@ KtPrefs *kt_prefs_new(void)
         prefs->fg_color = linux_colors[7];
         prefs->bg_color = linux_colors[0];
         prefs->vb_color = reserved_colors[0];
+        memcpy(prefs->palette, linux_colors, sizeof(prefs->palette));
 
         return prefs;
 }
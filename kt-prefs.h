@@ -62,6 +62,29 @@ struct _KtPrefs {
         kt_color_t fg_color;
         kt_color_t bg_color;
         kt_color_t vb_color; /* Visual Bell color */
+        kt_color_t palette[16]; /* The ANSI colors */
+
+        /* PTY */
+        guint ring_size; /* Size of the pty ingest ring in bytes */
+        guint read_budget_bytes; /* Max bytes read per pty dispatch */
+        guint read_budget_usec; /* Max time spent per pty dispatch */
+        gboolean threaded_reader; /* Read the pty from a separate thread */
+        gboolean io_uring; /* Use io_uring for the pty, when available */
+        guint write_queue_size; /* Max bytes queued for the child */
+        guint pty_pool_size; /* Number of prespawned shells, 0 disables */
+
+        /* Scrollback */
+        guint scrollback_lines; /* Lines of history kept in memory */
+        guint scrollback_spill_mb; /* Cap of the file older history goes
+                                      to, 0 disables */
+        guint scrollback_mb; /* Cap of the history kept in memory by a
+                                terminal, 0 disables */
+        guint scrollback_total_mb; /* Cap shared by all the terminals, 0
+                                      disables */
+
+        /* Highlighting */
+        gboolean highlight_matches; /* Underline URLs and paths */
+        gchar *match_pattern; /* A GRegex to underline instead, or NULL */
 
         KtPrefsPrivate *priv;
 };
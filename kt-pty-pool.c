@@ -0,0 +1,279 @@
+/*
+ * kt-pty-pool.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "kt-pty-pool.h"
+#include "kt-util.h"
+
+/* Time between two refills, so that a new shell does not compete for the
+ * CPU with the one that was just handed out while it starts up. */
+#define POOL_REFILL_DELAY_MSEC 1000
+
+typedef struct {
+        KtPty *pty;
+        guint child_watch_source;
+        KtPtyPool *pool;
+} PoolEntry;
+
+struct _KtPtyPoolPrivate {
+        GQueue entries; /* PoolEntry, oldest first */
+        guint refill_source;
+
+        /* Properties */
+        KtPrefs *prefs;
+};
+
+enum {
+        PROP_0,
+        PROP_KT_PREFS,
+};
+
+G_DEFINE_TYPE_WITH_CODE(KtPtyPool, kt_pty_pool, G_TYPE_OBJECT,
+                        G_ADD_PRIVATE(KtPtyPool));
+
+static KtPtyPool *default_pool = NULL;
+
+/* Private methods */
+static void pool_entry_free(PoolEntry *entry)
+{
+        if (entry->child_watch_source != 0)
+                g_source_remove(entry->child_watch_source);
+
+        g_object_unref(entry->pty);
+        g_free(entry);
+}
+
+static void pool_schedule_refill(KtPtyPool *pool);
+
+/* A shell died while waiting in the pool. */
+static void pool_child_watch_cb(GPid pid, gint status, PoolEntry *entry)
+{
+        KtPtyPool *pool = entry->pool;
+
+        debug("Pooled shell[%d] exited.", pid);
+
+        entry->child_watch_source = 0;
+        g_queue_remove(&pool->priv->entries, entry);
+        pool_entry_free(entry);
+
+        pool_schedule_refill(pool);
+}
+
+static gboolean pool_refill_cb(KtPtyPool *pool)
+{
+        KtPtyPoolPrivate *priv = pool->priv;
+        PoolEntry *entry;
+        KtPty *pty;
+
+        if (g_queue_get_length(&priv->entries) >= priv->prefs->pty_pool_size) {
+                priv->refill_source = 0;
+                return G_SOURCE_REMOVE;
+        }
+
+        /* The window id is not known yet */
+        pty = kt_pty_new(priv->prefs, XCB_WINDOW_NONE);
+        if (pty == NULL || !kt_pty_spawn(pty, NULL)) {
+                error("Could not prespawn a shell, giving up on the pool.");
+                if (pty)
+                        g_object_unref(pty);
+                priv->refill_source = 0;
+                return G_SOURCE_REMOVE;
+        }
+
+        entry = g_new0(PoolEntry, 1);
+        entry->pty = pty;
+        entry->pool = pool;
+        entry->child_watch_source =
+                g_child_watch_add(kt_pty_get_child_pid(pty),
+                                  (GChildWatchFunc)pool_child_watch_cb,
+                                  entry);
+
+        g_queue_push_tail(&priv->entries, entry);
+
+        /* One shell per call, the next one after another delay */
+        return G_SOURCE_CONTINUE;
+}
+
+static void pool_schedule_refill(KtPtyPool *pool)
+{
+        KtPtyPoolPrivate *priv = pool->priv;
+
+        if (priv->refill_source != 0)
+                return;
+
+        priv->refill_source = g_timeout_add_full(G_PRIORITY_LOW,
+                                                 POOL_REFILL_DELAY_MSEC,
+                                                 (GSourceFunc)pool_refill_cb,
+                                                 pool,
+                                                 NULL);
+}
+
+/* Class methods */
+static void kt_pty_pool_get_property(GObject *obj,
+                                     guint param_id,
+                                     GValue *value,
+                                     GParamSpec *pspec)
+{
+        KtPtyPool *pool = KT_PTY_POOL(obj);
+        KtPtyPoolPrivate *priv = pool->priv;
+
+        switch(param_id) {
+        case PROP_KT_PREFS:
+                g_value_set_object(value, priv->prefs);
+                break;
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, param_id, pspec);
+                break;
+        }
+}
+
+static void kt_pty_pool_set_property(GObject *obj,
+                                     guint param_id,
+                                     const GValue *value,
+                                     GParamSpec *pspec)
+{
+        KtPtyPool *pool = KT_PTY_POOL(obj);
+        KtPtyPoolPrivate *priv = pool->priv;
+
+        switch(param_id) {
+        case PROP_KT_PREFS:
+                if (priv->prefs)
+                        g_object_unref(priv->prefs);
+
+                priv->prefs = g_object_ref(g_value_get_object(value));
+                break;
+        default:
+                G_OBJECT_WARN_INVALID_PROPERTY_ID(obj, param_id, pspec);
+                break;
+        }
+}
+
+static void kt_pty_pool_finalize(GObject *object)
+{
+        KtPtyPool *pool = KT_PTY_POOL(object);
+        KtPtyPoolPrivate *priv = pool->priv;
+
+        if (priv->refill_source != 0)
+                g_source_remove(priv->refill_source);
+
+        /* Closing the master fd hangs the pooled shells up */
+        g_queue_clear_full(&priv->entries, (GDestroyNotify)pool_entry_free);
+
+        if (priv->prefs)
+                g_object_unref(priv->prefs);
+
+        if (default_pool == pool)
+                default_pool = NULL;
+
+        G_OBJECT_CLASS(kt_pty_pool_parent_class)->finalize(object);
+}
+
+static void kt_pty_pool_class_init(KtPtyPoolClass *klass)
+{
+        GObjectClass *oclass = G_OBJECT_CLASS(klass);
+
+        oclass->get_property = kt_pty_pool_get_property;
+        oclass->set_property = kt_pty_pool_set_property;
+        oclass->finalize = kt_pty_pool_finalize;
+
+        g_object_class_install_property(oclass,
+                                        PROP_KT_PREFS,
+                                        g_param_spec_object("kt-prefs",
+                                                            "Kixterm Preferences",
+                                                            "The KtPrefs object",
+                                                            KT_PREFS_TYPE,
+                                                            G_PARAM_CONSTRUCT_ONLY |
+                                                            G_PARAM_READWRITE));
+}
+
+static void kt_pty_pool_init(KtPtyPool *pool)
+{
+        KtPtyPoolPrivate *priv;
+
+        pool->priv = kt_pty_pool_get_instance_private(pool);
+        priv = pool->priv;
+
+        g_queue_init(&priv->entries);
+        priv->refill_source = 0;
+}
+
+/* Public methods */
+
+/**
+ * kt_pty_pool_new: Create a pool of prefs->pty_pool_size shells. The first
+ * pool created becomes the default one.
+ *
+ * The first shell is spawned right away, so that it starts up while the
+ * caller goes on with its own setup; the others follow one at a time.
+ */
+KtPtyPool *kt_pty_pool_new(KtPrefs *prefs)
+{
+        KtPtyPool *pool;
+
+        g_return_val_if_fail(KT_IS_PREFS(prefs), NULL);
+
+        pool = g_object_new(KT_PTY_POOL_TYPE,
+                            "kt-prefs", prefs,
+                            NULL);
+
+        if (default_pool == NULL)
+                default_pool = pool;
+
+        if (pool_refill_cb(pool))
+                pool_schedule_refill(pool);
+
+        return pool;
+}
+
+/**
+ * kt_pty_pool_get_default()
+ *
+ * Returns: The default pool, or NULL if there is none.
+ */
+KtPtyPool *kt_pty_pool_get_default(void)
+{
+        return default_pool;
+}
+
+/**
+ * kt_pty_pool_acquire: Take a pty with a running shell out of the pool.
+ * The caller is responsible for watching the child from now on.
+ *
+ * Returns: A new reference to the pty, or NULL if the pool is empty.
+ */
+KtPty *kt_pty_pool_acquire(KtPtyPool *pool)
+{
+        PoolEntry *entry;
+        KtPty *pty;
+
+        g_return_val_if_fail(KT_IS_PTY_POOL(pool), NULL);
+
+        entry = g_queue_pop_head(&pool->priv->entries);
+        pool_schedule_refill(pool);
+
+        if (entry == NULL)
+                return NULL;
+
+        pty = g_object_ref(entry->pty);
+        pool_entry_free(entry);
+
+        return pty;
+}
@@ -0,0 +1,67 @@
+/*
+ * kt-pty-pool.h
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef KT_PTY_POOL_H
+#define KT_PTY_POOL_H
+
+#include <glib-object.h>
+
+#include "kt-prefs.h"
+#include "kt-pty.h"
+
+G_BEGIN_DECLS
+
+typedef struct _KtPtyPool KtPtyPool;
+typedef struct _KtPtyPoolClass KtPtyPoolClass;
+typedef struct _KtPtyPoolPrivate KtPtyPoolPrivate;
+
+#define KT_PTY_POOL_TYPE (kt_pty_pool_get_type())
+#define KT_PTY_POOL(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), KT_PTY_POOL_TYPE, KtPtyPool))
+#define KT_PTY_POOL_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST((klass), TYPE_BINARY_TREE, KtPtyPoolClass))
+#define KT_IS_PTY_POOL(obj)  (G_TYPE_CHECK_INSTANCE_TYPE((obj), KT_PTY_POOL_TYPE))
+#define KT_IS_PTY_POOL_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass), KT_PTY_POOL_TYPE))
+#define KT_PTY_POOL_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS((obj), KT_PTY_POOL_TYPE, KtPtyPoolClass))
+
+/*
+  A pool of ptys with shells already running in them, so that new
+  terminals don't have to wait for the shell to start up. The pool is
+  refilled from a low priority timeout, one shell at a time.
+ */
+struct _KtPtyPool {
+        GObject parent_instance;
+
+        /* <private> */
+        KtPtyPoolPrivate *priv;
+};
+
+struct _KtPtyPoolClass {
+        GObjectClass parent_class;
+};
+
+GType kt_pty_pool_get_type(void);
+KtPtyPool *kt_pty_pool_new(KtPrefs *prefs);
+KtPtyPool *kt_pty_pool_get_default(void);
+
+KtPty *kt_pty_pool_acquire(KtPtyPool *pool);
+
+G_END_DECLS
+
+#endif /* KT_PTY_POOL_H */
@@ -0,0 +1,292 @@
+/*
+ * kt-pty-reader.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "kt-pty-reader.h"
+#include "kt-util.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+#ifdef LINUX
+#include <sys/eventfd.h>
+#endif
+
+struct _KtPtyReader {
+        gint fd; /* pty master fd */
+        KtRing *ring;
+        GThread *thread;
+
+        gint wakeup_fd; /* reader -> main loop: data is available */
+        gint control_fd; /* main loop -> reader: space is available/stop */
+
+        gint armed; /* The consumer wants a wakeup */
+        gint waiting; /* The reader is waiting for space */
+        gint stop;
+
+        gint eof;
+        gint err;
+
+        /* Counters */
+        gsize bytes_read;
+        gsize read_calls;
+};
+
+/* Private methods */
+#ifdef LINUX
+static void reader_signal(gint fd)
+{
+        eventfd_t one = 1;
+
+        while (write(fd, &one, sizeof(one)) == -1 && errno == EINTR)
+                ;
+}
+
+static void reader_drain(gint fd)
+{
+        eventfd_t value;
+
+        while (read(fd, &value, sizeof(value)) == -1 && errno == EINTR)
+                ;
+}
+
+/* Wake the main loop up, but only if it asked to be woken up. */
+static void reader_notify(KtPtyReader *reader)
+{
+        if (g_atomic_int_compare_and_exchange(&reader->armed, 1, 0))
+                reader_signal(reader->wakeup_fd);
+}
+
+/**
+ * reader_wait_for_space: Block until the consumer frees up some of the ring.
+ *
+ * Returns: FALSE if the reader was asked to stop.
+ */
+static gboolean reader_wait_for_space(KtPtyReader *reader)
+{
+        struct pollfd pfd = { reader->control_fd, POLLIN, 0 };
+        gsize avail;
+
+        g_atomic_int_set(&reader->waiting, 1);
+
+        /* Check again, the consumer may have freed space meanwhile */
+        kt_ring_write_ptr(reader->ring, &avail);
+        if (avail == 0 && !g_atomic_int_get(&reader->stop)) {
+                /* Make sure the consumer knows there is data to drain */
+                reader_notify(reader);
+
+                if (poll(&pfd, 1, -1) > 0)
+                        reader_drain(reader->control_fd);
+        }
+
+        g_atomic_int_set(&reader->waiting, 0);
+
+        return !g_atomic_int_get(&reader->stop);
+}
+
+static gpointer reader_thread(KtPtyReader *reader)
+{
+        struct pollfd pfd[2] = {
+                { reader->fd, POLLIN, 0 },
+                { reader->control_fd, POLLIN, 0 },
+        };
+
+        while (!g_atomic_int_get(&reader->stop)) {
+                guint8 *data;
+                gsize avail;
+                ssize_t ret;
+
+                data = kt_ring_write_ptr(reader->ring, &avail);
+                if (avail == 0) {
+                        if (!reader_wait_for_space(reader))
+                                break;
+                        continue;
+                }
+
+                if (poll(pfd, 2, -1) == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        g_atomic_int_set(&reader->err, errno);
+                        break;
+                }
+
+                if (pfd[1].revents & POLLIN)
+                        reader_drain(reader->control_fd);
+
+                if ((pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) == 0)
+                        continue;
+
+                ret = read(reader->fd, data, avail);
+                g_atomic_pointer_add(&reader->read_calls, 1);
+
+                if (ret == -1) {
+                        if (errno == EAGAIN || errno == EINTR)
+                                continue;
+                        if (errno != EIO)
+                                g_atomic_int_set(&reader->err, errno);
+                        break;
+                } else if (ret == 0) {
+                        break;
+                }
+
+                kt_ring_commit(reader->ring, ret);
+                g_atomic_pointer_add(&reader->bytes_read, ret);
+
+                reader_notify(reader);
+        }
+
+        /* Always let the main loop know that we are gone */
+        g_atomic_int_set(&reader->eof, 1);
+        reader_signal(reader->wakeup_fd);
+
+        return NULL;
+}
+#endif
+
+/* Public methods */
+KtPtyReader *kt_pty_reader_new(gint fd, KtRing *ring)
+{
+#ifdef LINUX
+        KtPtyReader *reader;
+        GError *error = NULL;
+
+        reader = NEW(KtPtyReader, 1);
+        reader->fd = fd;
+        reader->ring = ring;
+        reader->armed = 1;
+
+        reader->wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        reader->control_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (reader->wakeup_fd == -1 || reader->control_fd == -1) {
+                error("Could not create eventfd: %s", g_strerror(errno));
+                goto failed;
+        }
+
+        reader->thread = g_thread_try_new("kt-pty-reader",
+                                          (GThreadFunc)reader_thread,
+                                          reader,
+                                          &error);
+        if (reader->thread == NULL) {
+                error("Could not start the pty reader: %s", error->message);
+                g_error_free(error);
+                goto failed;
+        }
+
+        return reader;
+
+failed:
+        if (reader->wakeup_fd != -1)
+                close(reader->wakeup_fd);
+        if (reader->control_fd != -1)
+                close(reader->control_fd);
+        FREE(&reader);
+#endif
+        return NULL;
+}
+
+void kt_pty_reader_free(KtPtyReader *reader)
+{
+#ifdef LINUX
+        if (reader == NULL)
+                return;
+
+        g_atomic_int_set(&reader->stop, 1);
+        reader_signal(reader->control_fd);
+        g_thread_join(reader->thread);
+
+        close(reader->wakeup_fd);
+        close(reader->control_fd);
+
+        FREE(&reader);
+#endif
+}
+
+gint kt_pty_reader_get_wakeup_fd(KtPtyReader *reader)
+{
+        return reader->wakeup_fd;
+}
+
+/**
+ * kt_pty_reader_ack: Acknowledge a wakeup before draining the ring.
+ */
+void kt_pty_reader_ack(KtPtyReader *reader)
+{
+#ifdef LINUX
+        reader_drain(reader->wakeup_fd);
+#endif
+}
+
+/**
+ * kt_pty_reader_poke: Wake the main loop up again on its next iteration.
+ *
+ * Used by the consumer when it stops draining before the ring is empty.
+ */
+void kt_pty_reader_poke(KtPtyReader *reader)
+{
+#ifdef LINUX
+        reader_signal(reader->wakeup_fd);
+#endif
+}
+
+/**
+ * kt_pty_reader_rearm: Ask for a wakeup once the ring has been drained.
+ *
+ * Returns: TRUE if armed, FALSE if data arrived meanwhile and the caller
+ * should keep draining.
+ */
+gboolean kt_pty_reader_rearm(KtPtyReader *reader)
+{
+        g_atomic_int_set(&reader->armed, 1);
+
+        if (kt_ring_get_fill(reader->ring) == 0)
+                return TRUE;
+
+        /* If the reader beat us to it, a wakeup is already on its way */
+        return !g_atomic_int_compare_and_exchange(&reader->armed, 1, 0);
+}
+
+/**
+ * kt_pty_reader_consumed: Tell the reader that the ring has space again.
+ */
+void kt_pty_reader_consumed(KtPtyReader *reader)
+{
+#ifdef LINUX
+        if (g_atomic_int_get(&reader->waiting))
+                reader_signal(reader->control_fd);
+#endif
+}
+
+gboolean kt_pty_reader_is_eof(KtPtyReader *reader, gint *err)
+{
+        if (err)
+                *err = g_atomic_int_get(&reader->err);
+
+        return g_atomic_int_get(&reader->eof);
+}
+
+void kt_pty_reader_get_counters(KtPtyReader *reader,
+                                guint64 *bytes_read,
+                                guint64 *read_calls)
+{
+        *bytes_read = g_atomic_pointer_get(&reader->bytes_read);
+        *read_calls = g_atomic_pointer_get(&reader->read_calls);
+}
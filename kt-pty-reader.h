@@ -0,0 +1,58 @@
+/*
+ * kt-pty-reader.h
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KT_PTY_READER_H
+#define KT_PTY_READER_H
+
+#include <glib.h>
+
+#include "kt-ring.h"
+
+G_BEGIN_DECLS
+
+/*
+  A thread that keeps the master side of the pty drained into a KtRing, so
+  the child never blocks on a full pty while the main thread is busy.
+
+  The main loop is woken up through an eventfd, and only when the ring goes
+  from empty to non-empty: the consumer arms the wakeup with
+  kt_pty_reader_rearm() once it has drained the ring.
+ */
+typedef struct _KtPtyReader KtPtyReader;
+
+KtPtyReader *kt_pty_reader_new(gint fd, KtRing *ring);
+void kt_pty_reader_free(KtPtyReader *reader);
+
+gint kt_pty_reader_get_wakeup_fd(KtPtyReader *reader);
+
+/* Consumer side, to be called from the main thread only. */
+void kt_pty_reader_ack(KtPtyReader *reader);
+void kt_pty_reader_poke(KtPtyReader *reader);
+gboolean kt_pty_reader_rearm(KtPtyReader *reader);
+void kt_pty_reader_consumed(KtPtyReader *reader);
+gboolean kt_pty_reader_is_eof(KtPtyReader *reader, gint *err);
+void kt_pty_reader_get_counters(KtPtyReader *reader,
+                                guint64 *bytes_read,
+                                guint64 *read_calls);
+
+G_END_DECLS
+#endif /* KT_PTY_READER_H */
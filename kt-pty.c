@@ -20,6 +20,10 @@
  *
  */
 
+#ifdef LINUX
+#define _GNU_SOURCE
+#endif
+
 #include "kt-pty.h"
 
 #include <stdlib.h>
@@ -30,6 +34,18 @@
 
 #include <pwd.h>
 #include <sys/types.h>
+#include <spawn.h>
+#include <signal.h>
+
+/* posix_spawn() can only replace pty_spawn_cb when it can make the child a
+   session leader and close the fds it must not inherit. */
+#if defined(POSIX_SPAWN_SETSID) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 34)
+#define HAVE_POSIX_SPAWN_PTY 1
+#endif
+#endif
+
+extern char **environ;
 
 #define SPAWN_FLAGS G_SPAWN_CHILD_INHERITS_STDIN | \
         G_SPAWN_DO_NOT_REAP_CHILD
@@ -37,6 +53,7 @@
 struct _KtPtyPrivate {
         GString *wid;
         GPid cpid;
+        gint64 spawn_time; /* Monotonic time of the spawn */
         /* openpty fd */
         gint mfd; /* masterfd */
         gint sfd; /* slavefd */
@@ -113,6 +130,61 @@ static void pty_spawn_cb(KtPty *pty)
         close(priv->mfd);
 }
 
+#ifdef HAVE_POSIX_SPAWN_PTY
+/**
+ * pty_posix_spawn: Spawn the child with posix_spawn(), which glibc
+ * implements with clone(CLONE_VM | CLONE_VFORK). Unlike fork() its cost
+ * does not grow with our RSS. The work of pty_spawn_cb is expressed as
+ * spawn attributes: setsid, then opening the slave makes it the
+ * controlling tty of the new session.
+ *
+ * Returns: TRUE if successful, FALSE if not.
+ */
+static gboolean pty_posix_spawn(KtPty *pty, gchar **args, GPid *pid)
+{
+        KtPtyPrivate *priv = pty->priv;
+        posix_spawn_file_actions_t actions;
+        posix_spawnattr_t attr;
+        sigset_t mask;
+        gchar name[64];
+        gint ret;
+
+        if (ptsname_r(priv->mfd, name, sizeof(name)) != 0) {
+                error("ptsname_r() failed.");
+                return FALSE;
+        }
+
+        posix_spawnattr_init(&attr);
+        sigemptyset(&mask);
+        posix_spawnattr_setsigmask(&attr, &mask);
+        posix_spawnattr_setflags(&attr,
+                                 POSIX_SPAWN_SETSID |
+                                 POSIX_SPAWN_SETSIGMASK);
+
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, name,
+                                         O_RDWR, 0);
+        posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO,
+                                         STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, STDIN_FILENO,
+                                         STDERR_FILENO);
+        /* Our pty masters, the X connection, eventfds... */
+        posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+
+        ret = posix_spawn(pid, args[0], &actions, &attr, args, environ);
+
+        posix_spawn_file_actions_destroy(&actions);
+        posix_spawnattr_destroy(&attr);
+
+        if (ret != 0) {
+                error("posix_spawn() failed: %s", g_strerror(ret));
+                return FALSE;
+        }
+
+        return TRUE;
+}
+#endif
+
 /* Class methods */
 static void kt_pty_get_property(GObject *obj,
                                 guint param_id,
@@ -271,6 +343,7 @@ gboolean kt_pty_spawn(KtPty *pty, gchar **args)
         GError *error = NULL;
         GPid pid;
         gchar *shell;
+        gint64 start;
 
         g_return_val_if_fail(KT_IS_PTY(pty), FALSE);
 
@@ -281,6 +354,15 @@ gboolean kt_pty_spawn(KtPty *pty, gchar **args)
 
         args = (char *[]){shell, "-i", NULL};
 
+        start = g_get_monotonic_time();
+
+#ifdef HAVE_POSIX_SPAWN_PTY
+        if (pty_posix_spawn(pty, args, &pid)) {
+                debug("posix_spawn() took %" G_GINT64_FORMAT " usec.",
+                      g_get_monotonic_time() - start);
+                goto spawned;
+        }
+#endif
 
         retval = g_spawn_async_with_pipes(NULL, /* Spawn in CWD */
                                           args,
@@ -294,10 +376,18 @@ gboolean kt_pty_spawn(KtPty *pty, gchar **args)
 
         if (!retval) {
                 error("Spawn failed: %s", error->message);
+                g_error_free(error);
                 return FALSE;
         }
 
+        debug("g_spawn_async_with_pipes() took %" G_GINT64_FORMAT " usec.",
+              g_get_monotonic_time() - start);
+
+#ifdef HAVE_POSIX_SPAWN_PTY
+spawned:
+#endif
         priv->cpid = pid;
+        priv->spawn_time = g_get_monotonic_time();
 
         return TRUE;
 }
@@ -340,3 +430,15 @@ GPid kt_pty_get_child_pid(KtPty *pty)
 
         return pty->priv->cpid;
 }
+
+/**
+ * kt_pty_get_spawn_time()
+ *
+ * Returns: The monotonic time at which the child was spawned, or 0.
+ */
+gint64 kt_pty_get_spawn_time(KtPty *pty)
+{
+        g_return_val_if_fail(KT_IS_PTY(pty), 0);
+
+        return pty->priv->spawn_time;
+}
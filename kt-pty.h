@@ -57,4 +57,5 @@ gint kt_pty_get_fd(KtPty *pty);
 gboolean kt_pty_spawn(KtPty *pty, gchar **args);
 gboolean kt_pty_set_size(KtPty *pty, gint rows, gint cols);
 GPid kt_pty_get_child_pid(KtPty *pty);
+gint64 kt_pty_get_spawn_time(KtPty *pty);
 #endif /* KT_PTY_H */
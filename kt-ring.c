@@ -0,0 +1,206 @@
+/*
+ * kt-ring.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifdef LINUX
+#define _GNU_SOURCE
+#endif
+
+#include "kt-ring.h"
+#include "kt-util.h"
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+struct _KtRing {
+        guint8 *base;
+        gsize size;
+        gboolean mirrored;
+
+        /* Free running counters, the offsets are taken modulo size. Only
+           the reader moves head and only the writer moves tail, so a single
+           producer and a single consumer can share the ring without a
+           lock. */
+        gsize head; /* read position */
+        gsize tail; /* write position */
+};
+
+/* Private methods */
+static gsize ring_round_size(gsize size)
+{
+        gsize page = sysconf(_SC_PAGESIZE);
+
+        if (size < page)
+                size = page;
+
+        return (size + page - 1) & ~(page - 1);
+}
+
+/**
+ * ring_map_mirrored: Map the same pages twice, back to back.
+ *
+ * Returns: TRUE if successful, FALSE if not.
+ */
+static gboolean ring_map_mirrored(KtRing *ring)
+{
+#ifdef LINUX
+        guint8 *addr;
+        int fd;
+
+        fd = memfd_create("kixterm-ring", MFD_CLOEXEC);
+        if (fd == -1)
+                return FALSE;
+
+        if (ftruncate(fd, ring->size) == -1)
+                goto failed;
+
+        /* Reserve twice the size and then map the file over both halves */
+        addr = mmap(NULL, 2 * ring->size, PROT_NONE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED)
+                goto failed;
+
+        if (mmap(addr, ring->size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+                goto unmap;
+
+        if (mmap(addr + ring->size, ring->size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+                goto unmap;
+
+        close(fd);
+
+        ring->base = addr;
+        ring->mirrored = TRUE;
+
+        return TRUE;
+
+unmap:
+        munmap(addr, 2 * ring->size);
+failed:
+        close(fd);
+#endif
+        return FALSE;
+}
+
+/* Public methods */
+KtRing *kt_ring_new(gsize size)
+{
+        KtRing *ring;
+
+        ring = NEW(KtRing, 1);
+        ring->size = ring_round_size(size);
+        ring->head = 0;
+        ring->tail = 0;
+
+        if (!ring_map_mirrored(ring)) {
+                warn("Could not mirror the ring buffer, wrap around reads "
+                     "will be split.");
+                ring->base = NEW(guint8, ring->size);
+                ring->mirrored = FALSE;
+        }
+
+        return ring;
+}
+
+void kt_ring_free(KtRing *ring)
+{
+        if (ring == NULL)
+                return;
+
+        if (ring->mirrored)
+                munmap(ring->base, 2 * ring->size);
+        else
+                FREE(&ring->base);
+
+        FREE(&ring);
+}
+
+gsize kt_ring_get_size(KtRing *ring)
+{
+        return ring->size;
+}
+
+gsize kt_ring_get_fill(KtRing *ring)
+{
+        gsize head = g_atomic_pointer_get(&ring->head);
+
+        return g_atomic_pointer_get(&ring->tail) - head;
+}
+
+gboolean kt_ring_is_mirrored(KtRing *ring)
+{
+        return ring->mirrored;
+}
+
+/**
+ * kt_ring_write_ptr: Get the region that can be written to.
+ *
+ * Returns: A pointer to the free region, its length is stored in avail.
+ */
+guint8 *kt_ring_write_ptr(KtRing *ring, gsize *avail)
+{
+        gsize tail = ring->tail;
+        gsize off = tail % ring->size;
+        gsize space = ring->size - (tail - g_atomic_pointer_get(&ring->head));
+
+        if (!ring->mirrored)
+                space = MIN(space, ring->size - off);
+
+        *avail = space;
+
+        return ring->base + off;
+}
+
+void kt_ring_commit(KtRing *ring, gsize length)
+{
+        g_return_if_fail(length <= ring->size - kt_ring_get_fill(ring));
+
+        /* Publishes the data to the reader */
+        g_atomic_pointer_set(&ring->tail, ring->tail + length);
+}
+
+/**
+ * kt_ring_read_ptr: Get the region that has data to be consumed.
+ *
+ * Returns: A pointer to the data, its length is stored in avail.
+ */
+const guint8 *kt_ring_read_ptr(KtRing *ring, gsize *avail)
+{
+        gsize head = ring->head;
+        gsize off = head % ring->size;
+        gsize fill = g_atomic_pointer_get(&ring->tail) - head;
+
+        if (!ring->mirrored)
+                fill = MIN(fill, ring->size - off);
+
+        *avail = fill;
+
+        return ring->base + off;
+}
+
+void kt_ring_consume(KtRing *ring, gsize length)
+{
+        g_return_if_fail(length <= kt_ring_get_fill(ring));
+
+        /* Hands the space back to the writer */
+        g_atomic_pointer_set(&ring->head, ring->head + length);
+}
@@ -0,0 +1,60 @@
+/*
+ * kt-ring.h
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KT_RING_H
+#define KT_RING_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+  A byte ring buffer used to ingest the output of the pty.
+
+  Where possible the storage is mapped twice, back to back, so that the
+  readable and the writable regions are always contiguous in memory, even
+  when they wrap around the end of the buffer. This lets the pty be read
+  with a single read() per wakeup and lets consumers parse the data in
+  place.
+
+  The ring is safe to use from one writer thread and one reader thread at
+  the same time.
+ */
+typedef struct _KtRing KtRing;
+
+KtRing *kt_ring_new(gsize size);
+void kt_ring_free(KtRing *ring);
+
+gsize kt_ring_get_size(KtRing *ring);
+gsize kt_ring_get_fill(KtRing *ring);
+gboolean kt_ring_is_mirrored(KtRing *ring);
+
+/* Writer side */
+guint8 *kt_ring_write_ptr(KtRing *ring, gsize *avail);
+void kt_ring_commit(KtRing *ring, gsize length);
+
+/* Reader side */
+const guint8 *kt_ring_read_ptr(KtRing *ring, gsize *avail);
+void kt_ring_consume(KtRing *ring, gsize length);
+
+G_END_DECLS
+#endif /* KT_RING_H */
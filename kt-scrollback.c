@@ -0,0 +1,1928 @@
+/*
+ * kt-scrollback.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "kt-scrollback.h"
+#include "kt-util.h"
+
+#include <gio/gio.h>
+
+#define BLOCK_LINES 256
+#define CACHE_BLOCKS 4
+#define COMPRESS_LEVEL 1 /* Level 6 is 1.5 times smaller but 4 times slower */
+#define CHUNK_LINES BLOCK_LINES
+#define JOIN_MAX CHUNK_LINES /* Longer logical lines rewrap in pieces */
+#define REFLOW_CHUNKS 8 /* Chunks counted per idle call */
+
+/*
+  A block starts with the offsets of its lines. Each line is then its
+  number of cells, flags, number of style runs and number of extra
+  guint32, followed by the code points of its cells, the runs, each a
+  guint32 length and the full KtStyle, and the extras: the grapheme
+  clusters, each its length then its code points, which the cells holding
+  them point to by offset. That way the lines don't depend on the grid's
+  tables.
+ */
+#define LINE_HEADER (4 * sizeof(guint16))
+
+typedef struct {
+        guint32 length;
+        KtStyle style;
+} StyleRun;
+#define BLOCK_HEADER (BLOCK_LINES * sizeof(guint32))
+
+typedef struct {
+        guint8 *data; /* Raw, or deflated once compressed is set */
+        GBytes *bytes; /* data once the block is full, shared by snapshots */
+        gsize length;
+        gsize size; /* Allocated, while the block is filling */
+        gsize raw_length;
+        guint lines;
+        gboolean compressed;
+        guint8 *plain; /* Inflated copy, while cached */
+        guint64 used; /* When the cached copy was last used */
+} ColdBlock;
+
+/*
+  For rewrapping, every line kept, spilled ones too, has a mark in memory:
+  the cells it adds to its logical line, whether the logical line goes on
+  in the next line and whether it has wide characters. The marks are kept
+  in chunks of CHUNK_LINES lines, which count the rows that the logical
+  lines ending in them take at the current width.
+
+  Lines are always pushed at the current width, so each one adds a row.
+  When the width changes the chunks go stale: until a chunk is counted
+  again, from an idle callback or when one of its rows is asked for, it
+  only gives an upper bound. Rows are numbered back from the newest one,
+  and the chunks are counted newest first, so the rows near the screen
+  get right first and keep their numbers.
+ */
+#define MARK_LENGTH 0x3fff
+#define MARK_WRAPPED (1 << 14)
+#define MARK_WIDE (1 << 15)
+
+typedef struct {
+        guint16 marks[CHUNK_LINES];
+        gboolean counted; /* cells, ends and wide are right */
+        guint64 cells; /* In the logical lines ending in the chunk */
+        guint ends; /* Logical lines ending in the chunk */
+        gboolean wide;
+        guint generation; /* The width generation rows is for, 0 if none */
+        guint64 rows;
+} Chunk;
+
+/* Where the rows of a logical line start and end, in its cells */
+typedef struct {
+        guint width;
+        guint col;
+        guint64 row;
+        guint64 offset; /* Of the next cell */
+        guint64 target; /* The row whose cells are wanted */
+        guint64 start;
+        guint64 end;
+} Layout;
+
+struct _KtScrollback {
+        guint max_lines;
+        gsize max_bytes; /* Of stored blocks, 0 if no limit */
+        guint64 first; /* Absolute number of the oldest line */
+        guint lines;
+
+        GPtrArray *blocks; /* Oldest first, all but the last one full */
+        guint compress_next; /* First block that wasn't looked at yet */
+        guint compress_source;
+        GConverter *compressor;
+        GConverter *decompressor;
+        guint8 *scratch; /* Deflated output, before it is copied out */
+        gsize scratch_size;
+
+        ColdBlock *cache[CACHE_BLOCKS];
+        guint64 tick;
+
+        KtSpill *spill; /* Where dropped blocks go, if anywhere */
+        guint64 spilled; /* Lines that went there */
+
+        /* Rewrapping */
+        GPtrArray *chunks; /* Chunk number chunks_first on */
+        guint64 chunks_first;
+        guint64 kept; /* The first line kept, when last looked */
+        guint width;
+        guint generation;
+        guint open; /* Lines of the last logical line, if it goes on */
+        gboolean pad; /* The last line's last cell may be left empty */
+        guint64 reflow_next; /* Chunk number + 1 to count from idle */
+        guint reflow_source;
+        gboolean hint; /* The chunk a row was last found in, and its */
+        guint64 hint_chunk; /* rows back until then, until a line is */
+        guint64 hint_back; /* pushed or the width changes */
+
+        gsize raw_bytes;
+        gsize stored_bytes;
+};
+
+/*
+  The stores of the process share a budget of stored bytes. Once they go
+  over it, the oldest blocks of the largest store go first, after
+  compressing what it has pending.
+ */
+static GPtrArray *all_stores = NULL;
+static gsize all_budget = 0; /* 0 if no limit */
+static guint64 all_dropped = 0; /* Lines dropped for the budget */
+
+/*
+  A snapshot shares the full blocks, which no longer change but for being
+  replaced by their deflated copy, copies the block filling and the index
+  of the spill, and stores the lines added to it in blocks of its own. It
+  is then read on its own, so it can be from another thread.
+ */
+typedef struct {
+        GBytes *bytes;
+        gsize raw_length;
+        gboolean compressed;
+} SnapshotBlock;
+
+struct _KtScrollbackSnapshot {
+        guint64 first; /* Number of the oldest line */
+        KtSpillSnapshot *spill;
+        guint64 spill_offset; /* From a line's number to its record's */
+        guint64 blocks_first; /* Number of the first line in blocks */
+        GArray *blocks; /* Of SnapshotBlock, full */
+        ColdBlock *open; /* The lines after blocks */
+
+        /* Reading */
+        GConverter *decompressor;
+        guint cached[2]; /* The blocks in plain, G_MAXUINT if none, */
+        guint8 *plain[2]; /* two as reading goes back and forth over */
+        gsize plain_size[2]; /* the edge of one */
+        guint last; /* The slot used last */
+};
+
+/* Private methods */
+static void block_free(gpointer data)
+{
+        ColdBlock *block = data;
+
+        if (block->bytes)
+                g_bytes_unref(block->bytes);
+        else
+                FREE(&block->data);
+        FREE(&block->plain);
+        FREE(&block);
+}
+
+/* The block is full, its data is only read from now on */
+static void block_seal(ColdBlock *block)
+{
+        block->bytes = g_bytes_new_with_free_func(block->data, block->length,
+                                                  free, block->data);
+}
+
+static ColdBlock *block_new(void)
+{
+        ColdBlock *block;
+
+        block = NEW(ColdBlock, 1);
+        MEMSET(block, 1);
+
+        block->size = BLOCK_HEADER + BLOCK_LINES * LINE_HEADER;
+        block->data = NEW(guint8, block->size);
+        block->length = BLOCK_HEADER;
+
+        return block;
+}
+
+static gboolean cell_is_blank(const KtCell *cell)
+{
+        return cell->ch == 0 && cell->style == KT_STYLE_DEFAULT;
+}
+
+static void block_reserve(ColdBlock *block, gsize need)
+{
+        if (need > block->size) {
+                block->size = MAX(need, block->size * 2);
+                /* Aborts if out of memory, like NEW() */
+                block->data = g_realloc(block->data, block->size);
+        }
+}
+
+/* Returns: The number of cells stored, without the trailing blank ones */
+static guint block_append(ColdBlock *block, const KtGridLine *line,
+                          guint cols, KtStyleTable *styles,
+                          KtClusterTable *clusters)
+{
+        guint16 header[4];
+        guint32 *out, *extra;
+        StyleRun *run;
+        gsize start = block->length;
+        guint n, runs, extras, i, k;
+
+        for (n = MIN(cols, G_MAXUINT16); n > 0; n--) {
+                if (!cell_is_blank(&line->cells[n - 1]))
+                        break;
+        }
+
+        for (i = 0, runs = 0, extras = 0; i < n; i++) {
+                if (i == 0 || line->cells[i].style != line->cells[i - 1].style)
+                        runs++;
+                if (line->cells[i].ch & KT_CELL_CLUSTER) {
+                        kt_cluster_table_get(clusters,
+                                             KT_CELL_CHAR(&line->cells[i]),
+                                             &k);
+                        extras += 1 + k;
+                }
+        }
+
+        /* Clusters only keep their first code point past that */
+        extras = MIN(extras, G_MAXUINT16);
+
+        block_reserve(block, start + LINE_HEADER +
+                      (gsize)n * sizeof(guint32) +
+                      (gsize)runs * sizeof(StyleRun) +
+                      (gsize)extras * sizeof(guint32));
+
+        ((guint32 *)block->data)[block->lines++] = start;
+
+        out = (guint32 *)(block->data + start + LINE_HEADER);
+        run = (StyleRun *)(out + n) - 1;
+        extra = (guint32 *)(run + 1 + runs);
+
+        for (i = 0, k = 0; i < n; i++) {
+                const KtCell *cell = &line->cells[i];
+
+                if (i == 0 || cell->style != cell[-1].style) {
+                        run++;
+                        run->length = 0;
+                        run->style = *kt_style_table_get(styles, cell->style);
+                }
+                run->length++;
+
+                out[i] = cell->ch;
+                if (cell->ch & KT_CELL_CLUSTER) {
+                        const gunichar *chars;
+                        guint len;
+
+                        chars = kt_cluster_table_get(clusters,
+                                                     KT_CELL_CHAR(cell),
+                                                     &len);
+                        if (len == 0 || k + 1 + len > extras) {
+                                out[i] = KT_CELL_PACK(len ? chars[0] : 0,
+                                                      cell->ch &
+                                                      KT_CELL_WIDE);
+                                continue;
+                        }
+
+                        out[i] = KT_CELL_PACK(k, cell->ch & ~0x1fffff);
+                        extra[k++] = len;
+                        memcpy(&extra[k], chars, len * sizeof(gunichar));
+                        k += len;
+                }
+        }
+
+        header[0] = n;
+        header[1] = line->flags & ~KT_LINE_DIRTY;
+        header[2] = runs;
+        header[3] = k;
+        memcpy(block->data + start, header, LINE_HEADER);
+
+        block->length = (guint8 *)(extra + k) - block->data;
+
+        return n;
+}
+
+static gsize line_length(const guint8 *data)
+{
+        guint16 header[4];
+
+        memcpy(header, data, LINE_HEADER);
+
+        return LINE_HEADER + (gsize)header[0] * sizeof(guint32) +
+                (gsize)header[2] * sizeof(StyleRun) +
+                (gsize)header[3] * sizeof(guint32);
+}
+
+/**
+ * line_decode_range: Copy count cells of a line out from cell from on,
+ * padded with blank cells. Only the styles and clusters of those cells are
+ * interned.
+ */
+static void line_decode_range(const guint8 *data, KtCell *cells, guint from,
+                              guint count, KtStyleTable *styles,
+                              KtClusterTable *clusters)
+{
+        const guint32 *in, *extra;
+        const StyleRun *run;
+        guint16 header[4];
+        guint i, j, pos, start, end;
+
+        memcpy(header, data, LINE_HEADER);
+        in = (const guint32 *)(data + LINE_HEADER);
+        run = (const StyleRun *)(in + header[0]);
+        extra = (const guint32 *)(run + header[2]);
+
+        for (i = 0; i < count; i++) {
+                guint32 ch = from + i < header[0] ? in[from + i] : 0;
+
+                if (ch & KT_CELL_CLUSTER) {
+                        const guint32 *cluster = extra + (ch & 0x1fffff);
+                        guint id;
+
+                        id = kt_cluster_table_intern(clusters, cluster + 1,
+                                                     cluster[0]);
+                        if (id == KT_CLUSTER_NONE)
+                                ch = KT_CELL_PACK(cluster[1],
+                                                  ch & KT_CELL_WIDE);
+                        else
+                                ch = KT_CELL_PACK(id, ch & ~0x1fffff);
+                }
+
+                cells[i].ch = ch;
+                cells[i].style = KT_STYLE_DEFAULT;
+        }
+
+        for (j = 0, pos = 0; j < header[2] && pos < from + count;
+             pos += run[j].length, j++) {
+                guint id;
+
+                start = MAX(pos, from);
+                end = MIN(pos + run[j].length, from + count);
+                if (start >= end)
+                        continue;
+
+                /* The grid made room, unless every cell has its own */
+                id = kt_style_table_intern(styles, &run[j].style);
+                if (id == KT_STYLE_NONE)
+                        id = KT_STYLE_DEFAULT;
+
+                for (i = start; i < end; i++)
+                        cells[i - from].style = id;
+        }
+}
+
+/* A wide character can't start in the last column */
+static void line_fix_last(KtGridLine *line, guint cols,
+                          KtClusterTable *clusters)
+{
+        KtCell *last = &line->cells[cols - 1];
+
+        if (last->ch & KT_CELL_WIDE) {
+                if (last->ch & KT_CELL_CLUSTER)
+                        kt_cluster_table_unref(clusters, KT_CELL_CHAR(last));
+                last->ch = 0;
+        }
+}
+
+/* Copy a line out, cut or padded with blank cells to cols */
+static void line_decode(const guint8 *data, KtGridLine *line, guint cols,
+                        KtStyleTable *styles, KtClusterTable *clusters)
+{
+        guint16 header[4];
+
+        memcpy(header, data, LINE_HEADER);
+        line_decode_range(data, line->cells, 0, cols, styles, clusters);
+        line_fix_last(line, cols, clusters);
+        line->flags = header[1];
+}
+
+/**
+ * sb_convert: Run all of in through a zlib converter into a buffer of
+ * out_size bytes.
+ *
+ * Returns: The number of bytes written, or 0 if it didn't fit or failed.
+ */
+static gsize sb_convert(GConverter *conv, const guint8 *in, gsize in_size,
+                        guint8 *out, gsize out_size)
+{
+        GConverterResult res;
+        gsize done = 0, written = 0;
+        GError *err = NULL;
+
+        g_converter_reset(conv);
+
+        do {
+                gsize r, w;
+
+                res = g_converter_convert(conv, in + done, in_size - done,
+                                          out + written, out_size - written,
+                                          G_CONVERTER_INPUT_AT_END, &r, &w,
+                                          &err);
+                if (res == G_CONVERTER_ERROR) {
+                        if (!g_error_matches(err, G_IO_ERROR,
+                                             G_IO_ERROR_NO_SPACE))
+                                warn("%s", err->message);
+                        g_error_free(err);
+                        return 0;
+                }
+
+                done += r;
+                written += w;
+        } while (res != G_CONVERTER_FINISHED);
+
+        return written;
+}
+
+static void sb_scratch_reserve(KtScrollback *sb, gsize size)
+{
+        if (sb->scratch_size < size) {
+                FREE(&sb->scratch);
+                sb->scratch_size = size;
+                sb->scratch = NEW(guint8, sb->scratch_size);
+        }
+}
+
+static void sb_compress_block(KtScrollback *sb, ColdBlock *block)
+{
+        gsize length;
+
+        sb_scratch_reserve(sb, block->length);
+
+        /* Only worth keeping if it saves something */
+        length = sb_convert(sb->compressor, block->data, block->length,
+                            sb->scratch, block->length);
+        if (length == 0)
+                return;
+
+        sb->stored_bytes -= block->length - length;
+
+        /* A fresh allocation of the right size rather than shrinking, which
+           fragments the heap */
+        g_bytes_unref(block->bytes);
+        block->data = NEW(guint8, length);
+        memcpy(block->data, sb->scratch, length);
+        block->length = length;
+        block->compressed = TRUE;
+        block_seal(block);
+}
+
+static gboolean sb_compress_cb(gpointer data)
+{
+        KtScrollback *sb = data;
+        ColdBlock *block;
+
+        if (sb->compress_next < sb->blocks->len) {
+                block = g_ptr_array_index(sb->blocks, sb->compress_next);
+                if (block->lines == BLOCK_LINES) {
+                        sb_compress_block(sb, block);
+                        sb->compress_next++;
+                        return G_SOURCE_CONTINUE;
+                }
+        }
+
+        sb->compress_source = 0;
+
+        return G_SOURCE_REMOVE;
+}
+
+static void sb_cache_drop(KtScrollback *sb, ColdBlock *block)
+{
+        guint i;
+
+        for (i = 0; i < CACHE_BLOCKS; i++) {
+                if (sb->cache[i] == block)
+                        sb->cache[i] = NULL;
+        }
+
+        FREE(&block->plain);
+}
+
+/**
+ * sb_block_data: The raw data of a block, inflating it into the cache if it
+ * was compressed.
+ */
+static const guint8 *sb_block_data(KtScrollback *sb, ColdBlock *block)
+{
+        guint i, slot = 0;
+
+        if (!block->compressed)
+                return block->data;
+
+        block->used = ++sb->tick;
+        if (block->plain)
+                return block->plain;
+
+        /* Take a free slot, or the least recently used one */
+        for (i = 0; i < CACHE_BLOCKS; i++) {
+                if (sb->cache[i] == NULL) {
+                        slot = i;
+                        break;
+                }
+                if (sb->cache[i]->used < sb->cache[slot]->used)
+                        slot = i;
+        }
+
+        if (sb->cache[slot])
+                sb_cache_drop(sb, sb->cache[slot]);
+
+        block->plain = NEW(guint8, block->raw_length);
+        if (sb_convert(sb->decompressor, block->data, block->length,
+                       block->plain, block->raw_length) != block->raw_length) {
+                warn("Could not inflate a block of scrollback");
+                FREE(&block->plain);
+                return NULL;
+        }
+
+        sb->cache[slot] = block;
+
+        return block->plain;
+}
+
+/* Hand the lines of a block over to the spill, one record each */
+static void sb_spill_block(KtScrollback *sb, ColdBlock *block)
+{
+        const guint8 *data = block->data;
+        guint i;
+
+        if (block->compressed) {
+                sb_scratch_reserve(sb, block->raw_length);
+                data = sb->scratch;
+                if (sb_convert(sb->decompressor, block->data, block->length,
+                               sb->scratch, block->raw_length) !=
+                    block->raw_length) {
+                        warn("Could not inflate a block of scrollback");
+                        data = NULL;
+                }
+        }
+
+        for (i = 0; i < block->lines; i++) {
+                const guint8 *line;
+
+                /* Keep the numbering right even if the block is lost */
+                if (data == NULL) {
+                        kt_spill_append(sb->spill, NULL, 0);
+                        continue;
+                }
+
+                line = data + ((const guint32 *)data)[i];
+                kt_spill_append(sb->spill, line, line_length(line));
+        }
+
+        sb->spilled += block->lines;
+}
+
+static void sb_trim_chunks(KtScrollback *sb);
+
+/* Drop the drop oldest blocks, to the spill if there is one */
+static void sb_drop_blocks(KtScrollback *sb, guint drop)
+{
+        guint i;
+
+        for (i = 0; i < drop; i++) {
+                ColdBlock *block = g_ptr_array_index(sb->blocks, i);
+
+                if (sb->spill)
+                        sb_spill_block(sb, block);
+                sb_cache_drop(sb, block);
+                sb->raw_bytes -= block->raw_length;
+                sb->stored_bytes -= block->length;
+                sb->lines -= block->lines;
+                sb->first += block->lines;
+        }
+
+        g_ptr_array_remove_range(sb->blocks, 0, drop);
+        sb->compress_next -= MIN(drop, sb->compress_next);
+        sb_trim_chunks(sb);
+}
+
+/**
+ * sb_compress_pending: Compress the full blocks the idle callback didn't
+ * get to yet.
+ *
+ * Returns: TRUE if there were any.
+ */
+static gboolean sb_compress_pending(KtScrollback *sb)
+{
+        guint next = sb->compress_next;
+
+        while (sb->compress_next < sb->blocks->len) {
+                ColdBlock *block = g_ptr_array_index(sb->blocks,
+                                                     sb->compress_next);
+
+                if (block->lines < BLOCK_LINES)
+                        break;
+                sb_compress_block(sb, block);
+                sb->compress_next++;
+        }
+
+        return sb->compress_next != next;
+}
+
+/* Drop the oldest blocks that aren't needed to keep max_lines, or that
+   don't fit max_bytes */
+static void sb_trim(KtScrollback *sb)
+{
+        guint drop = 0;
+
+        while (drop + 1 < sb->blocks->len &&
+               sb->lines - (drop + 1) * BLOCK_LINES >= sb->max_lines)
+                drop++;
+
+        if (drop > 0)
+                sb_drop_blocks(sb, drop);
+
+        if (sb->max_bytes == 0 || sb->stored_bytes <= sb->max_bytes)
+                return;
+
+        sb_compress_pending(sb);
+        while (sb->stored_bytes > sb->max_bytes && sb->blocks->len > 1)
+                sb_drop_blocks(sb, 1);
+}
+
+/* Keep all the stores within the budget */
+static void sb_budget_trim(void)
+{
+        guint64 dropped = 0;
+
+        if (all_budget == 0 || all_stores == NULL)
+                return;
+
+        for (;;) {
+                KtScrollback *largest = NULL;
+                gsize used = 0;
+                guint i;
+
+                for (i = 0; i < all_stores->len; i++) {
+                        KtScrollback *sb = g_ptr_array_index(all_stores, i);
+
+                        used += sb->stored_bytes;
+                        if (sb->blocks->len > 1 && (largest == NULL ||
+                                                    sb->stored_bytes >
+                                                    largest->stored_bytes))
+                                largest = sb;
+                }
+
+                if (used <= all_budget || largest == NULL)
+                        break;
+
+                /* Compressing may be enough */
+                if (sb_compress_pending(largest))
+                        continue;
+
+                dropped += BLOCK_LINES;
+                sb_drop_blocks(largest, 1);
+        }
+
+        if (dropped > 0) {
+                all_dropped += dropped;
+                debug("Scrollback over its budget of %zu bytes, dropped %"
+                      G_GUINT64_FORMAT " lines.", all_budget, dropped);
+        }
+}
+
+/* The stored data of a line, in a block or in the spill */
+static const guint8 *sb_line_data(KtScrollback *sb, guint64 number)
+{
+        ColdBlock *block;
+        const guint8 *data;
+        guint index;
+
+        if (number < sb->first && sb->spill) {
+                gsize length;
+
+                /* The spill numbers its records from its first one */
+                data = kt_spill_get(sb->spill, number + sb->spilled -
+                                    sb->first, &length);
+                if (data == NULL || length < LINE_HEADER)
+                        return NULL;
+
+                return data;
+        }
+
+        if (number < sb->first || number >= sb->first + sb->lines)
+                return NULL;
+
+        index = number - sb->first;
+        block = g_ptr_array_index(sb->blocks, index / BLOCK_LINES);
+        data = sb_block_data(sb, block);
+        if (data == NULL)
+                return NULL;
+
+        return data + ((const guint32 *)data)[index % BLOCK_LINES];
+}
+
+/* The stored data of a line of a snapshot */
+static const guint8 *snapshot_line_data(KtScrollbackSnapshot *snap,
+                                        guint64 number)
+{
+        const SnapshotBlock *block = NULL;
+        const guint8 *data;
+        guint64 index;
+        gsize length;
+
+        if (number < snap->first ||
+            number >= kt_scrollback_snapshot_get_end(snap))
+                return NULL;
+
+        if (number < snap->blocks_first) {
+                if (snap->spill == NULL)
+                        return NULL;
+
+                /* The record may have been overwritten since */
+                data = kt_spill_snapshot_get(snap->spill,
+                                             number + snap->spill_offset,
+                                             &length);
+                if (data == NULL || length < LINE_HEADER ||
+                    line_length(data) > length)
+                        return NULL;
+
+                return data;
+        }
+
+        index = (number - snap->blocks_first) / BLOCK_LINES;
+        if (index >= snap->blocks->len) {
+                data = snap->open->data;
+        } else {
+                block = &g_array_index(snap->blocks, SnapshotBlock, index);
+                data = g_bytes_get_data(block->bytes, &length);
+        }
+
+        if (index < snap->blocks->len && block->compressed) {
+                guint slot = snap->last;
+
+                /* Else the one used before, or the other one goes */
+                if (snap->cached[slot] != index)
+                        slot = !slot;
+                if (snap->cached[slot] != index) {
+                        if (snap->plain_size[slot] < block->raw_length) {
+                                FREE(&snap->plain[slot]);
+                                snap->plain_size[slot] = block->raw_length;
+                                snap->plain[slot] = NEW(guint8,
+                                                        block->raw_length);
+                        }
+                        snap->cached[slot] = G_MAXUINT;
+                        if (sb_convert(snap->decompressor, data, length,
+                                       snap->plain[slot],
+                                       block->raw_length) !=
+                            block->raw_length) {
+                                warn("Could not inflate a block of "
+                                     "scrollback");
+                                return NULL;
+                        }
+                        snap->cached[slot] = index;
+                }
+                snap->last = slot;
+                data = snap->plain[slot];
+        }
+
+        return data + ((const guint32 *)data)[(number - snap->blocks_first) %
+                                              BLOCK_LINES];
+}
+
+/**
+ * line_text: Go through the characters of a line as UTF-8, an empty cell
+ * being a space, appending them to text if not NULL.
+ *
+ * Returns: The cell the character at byte offset is in, or the number of
+ * cells stored if it is past them.
+ */
+static guint line_text(const guint8 *data, GString *text, gsize offset)
+{
+        const guint32 *in, *extra;
+        guint16 header[4];
+        gsize bytes = 0, length = 0;
+        gchar *out = NULL;
+        guint i, j;
+
+        memcpy(header, data, LINE_HEADER);
+        in = (const guint32 *)(data + LINE_HEADER);
+        extra = (const guint32 *)((const StyleRun *)(in + header[0]) +
+                                  header[2]);
+
+        /* Written in place, no code point takes more than 4 bytes */
+        if (text) {
+                length = text->len;
+                g_string_set_size(text, length +
+                                  ((gsize)header[0] + header[3]) * 4);
+                out = text->str + length;
+        }
+
+        for (i = 0; i < header[0]; i++) {
+                const guint32 *chars = &in[i];
+                guint32 ch = in[i] & 0x1fffff;
+                guint n = 1;
+
+                if (in[i] & KT_CELL_WIDE_TAIL)
+                        continue;
+
+                if (in[i] & KT_CELL_CLUSTER) {
+                        /* What is read from the spill may be anything */
+                        if (ch >= header[3] ||
+                            extra[ch] > (guint)header[3] - ch - 1)
+                                continue;
+                        chars = &extra[ch + 1];
+                        n = extra[ch];
+                }
+
+                for (j = 0; j < n; j++) {
+                        gunichar c = chars[j] & 0x1fffff;
+
+                        if (c == 0)
+                                c = ' ';
+
+                        if (c < 0x80) {
+                                if (out)
+                                        out[bytes] = c;
+                                bytes++;
+                                continue;
+                        }
+
+                        if (!g_unichar_validate(c))
+                                c = 0xfffd;
+                        bytes += g_unichar_to_utf8(c, out ? out + bytes :
+                                                   NULL);
+                }
+
+                if (bytes > offset)
+                        return i;
+        }
+
+        if (text)
+                g_string_truncate(text, length + bytes);
+
+        return header[0];
+}
+
+static inline Chunk *sb_chunk(KtScrollback *sb, guint64 number)
+{
+        return g_ptr_array_index(sb->chunks,
+                                 number / CHUNK_LINES - sb->chunks_first);
+}
+
+static inline guint16 *sb_mark(KtScrollback *sb, guint64 number)
+{
+        return &sb_chunk(sb, number)->marks[number % CHUNK_LINES];
+}
+
+static void chunk_invalidate(Chunk *chunk)
+{
+        chunk->counted = FALSE;
+        chunk->generation = 0;
+}
+
+static gboolean sb_reflow_cb(gpointer data);
+
+/* Count chunk number c again soon, and all the chunks before it */
+static void sb_reflow_schedule(KtScrollback *sb, guint64 c)
+{
+        sb->reflow_next = MAX(sb->reflow_next, c + 1);
+
+        if (sb->reflow_source == 0)
+                sb->reflow_source = g_idle_add_full(G_PRIORITY_LOW,
+                                                    sb_reflow_cb, sb, NULL);
+}
+
+/* Whether line number still has a mark */
+static inline gboolean sb_has_mark(KtScrollback *sb, guint64 number)
+{
+        return number / CHUNK_LINES >= sb->chunks_first;
+}
+
+/**
+ * sb_mark_line: Give the line just appended its mark, keeping the totals
+ * of its chunk. A line that continues the previous one in the same chunk
+ * adds a row to it, as it is as wide as the others. If pad, the last cell
+ * of the previous line was left empty for a wide character.
+ */
+static void sb_mark_line(KtScrollback *sb, guint16 mark, gboolean pad)
+{
+        guint64 number = sb->first + sb->lines - 1;
+        gboolean joined = FALSE;
+        Chunk *chunk;
+
+        if (number / CHUNK_LINES >= sb->chunks_first + sb->chunks->len) {
+                if (sb->chunks->len == 0)
+                        sb->chunks_first = number / CHUNK_LINES;
+
+                chunk = NEW(Chunk, 1);
+                MEMSET(chunk, 1);
+                chunk->counted = TRUE;
+                chunk->generation = sb->generation;
+                g_ptr_array_add(sb->chunks, chunk);
+        }
+
+        chunk = sb_chunk(sb, number);
+        chunk->marks[number % CHUNK_LINES] = mark;
+        sb->hint = FALSE;
+
+        if (sb->open > 0 && number > 0 && !sb_has_mark(sb, number - 1))
+                sb->open = 0;
+
+        if (sb->open > 0 && sb->open < JOIN_MAX)
+                joined = TRUE;
+        else if (sb->open > 0)
+                *sb_mark(sb, number - 1) &= ~MARK_WRAPPED;
+
+        if (joined && pad) {
+                (*sb_mark(sb, number - 1))--;
+                if (number % CHUNK_LINES && chunk->counted)
+                        chunk->cells--;
+        }
+
+        if (joined && number % CHUNK_LINES == 0) {
+                /* The logical line now ends in this chunk */
+                chunk_invalidate(sb_chunk(sb, number - 1));
+                chunk_invalidate(chunk);
+                sb_reflow_schedule(sb, number / CHUNK_LINES);
+        } else if (chunk->counted) {
+                chunk->cells += mark & MARK_LENGTH;
+                chunk->ends += !joined;
+                chunk->wide |= (mark & MARK_WIDE) != 0;
+                if (chunk->generation == sb->generation)
+                        chunk->rows++;
+        }
+
+        if (!(mark & MARK_WRAPPED))
+                sb->open = 0;
+        else if (joined)
+                sb->open++;
+        else
+                sb->open = 1;
+}
+
+/* Drop the chunks of lines no longer kept */
+static void sb_trim_chunks(KtScrollback *sb)
+{
+        guint64 first = kt_scrollback_get_first(sb);
+        guint drop = 0;
+
+        if (first == sb->kept)
+                return;
+        sb->kept = first;
+
+        while (drop < sb->chunks->len &&
+               (sb->chunks_first + drop + 1) * CHUNK_LINES <= first)
+                drop++;
+
+        if (drop > 0) {
+                g_ptr_array_remove_range(sb->chunks, 0, drop);
+                sb->chunks_first += drop;
+        }
+
+        /* Partly gone, its first logical line may have changed */
+        if (sb->chunks->len > 0 && first % CHUNK_LINES)
+                chunk_invalidate(g_ptr_array_index(sb->chunks, 0));
+}
+
+/* Whether a logical line ends with line number */
+static inline gboolean sb_line_ends(KtScrollback *sb, guint64 number)
+{
+        return number == sb->first + sb->lines - 1 ||
+                !(*sb_mark(sb, number) & MARK_WRAPPED);
+}
+
+/* The first line of the logical line ending with line end */
+static guint64 sb_line_start(KtScrollback *sb, guint64 end, guint64 first)
+{
+        while (end > first && (*sb_mark(sb, end - 1) & MARK_WRAPPED))
+                end--;
+
+        return end;
+}
+
+static void layout_init(Layout *layout, guint width, guint64 target)
+{
+        MEMSET(layout, 1);
+        layout->width = MAX(width, 1);
+        layout->target = target;
+        layout->end = G_MAXUINT64;
+}
+
+static inline void layout_break(Layout *layout)
+{
+        if (layout->row == layout->target)
+                layout->end = layout->offset;
+
+        layout->row++;
+        layout->col = 0;
+
+        if (layout->row == layout->target)
+                layout->start = layout->offset;
+}
+
+/* n cells without wide characters */
+static void layout_cells(Layout *layout, guint64 n)
+{
+        while (n > 0) {
+                guint64 take;
+
+                if (layout->col >= layout->width)
+                        layout_break(layout);
+
+                take = MIN(n, layout->width - layout->col);
+                layout->col += take;
+                layout->offset += take;
+                n -= take;
+        }
+}
+
+/* A wide character, which goes to the next row rather than be cut */
+static void layout_wide(Layout *layout)
+{
+        if (layout->col + 2 > layout->width && layout->col > 0)
+                layout_break(layout);
+
+        layout->col += 2;
+        layout->offset += 2;
+}
+
+/**
+ * sb_line_layout: Lay the logical line from line start to line end out at
+ * the current width, finding the cells of row layout->target.
+ *
+ * Returns: The number of rows it takes.
+ */
+static guint64 sb_line_layout(KtScrollback *sb, guint64 start, guint64 end,
+                              Layout *layout)
+{
+        guint64 cells = 0, number;
+        gboolean wide = FALSE;
+
+        for (number = start; number <= end; number++) {
+                guint16 mark = *sb_mark(sb, number);
+
+                cells += mark & MARK_LENGTH;
+                wide |= (mark & MARK_WIDE) != 0;
+        }
+
+        /* Only wide characters need the cells looked at */
+        if (!wide) {
+                guint64 rows = MAX((cells + layout->width - 1) /
+                                   layout->width, 1);
+
+                layout->row = rows - 1;
+                layout->start = layout->target * layout->width;
+                layout->end = MIN(cells, layout->start + layout->width);
+
+                return rows;
+        }
+
+        for (number = start; number <= end; number++) {
+                guint16 mark = *sb_mark(sb, number);
+                guint length = mark & MARK_LENGTH;
+                const guint32 *in;
+                const guint8 *data = NULL;
+                guint16 header[4];
+                guint i = 0, j, n;
+
+                if (mark & MARK_WIDE)
+                        data = sb_line_data(sb, number);
+
+                if (data) {
+                        memcpy(header, data, LINE_HEADER);
+                        in = (const guint32 *)(data + LINE_HEADER);
+                        n = MIN(header[0], length);
+
+                        while (i < n) {
+                                for (j = i; j < n; j++) {
+                                        if (in[j] & KT_CELL_WIDE)
+                                                break;
+                                }
+                                layout_cells(layout, j - i);
+                                if (j < n) {
+                                        layout_wide(layout);
+                                        j += 2;
+                                }
+                                i = j;
+                        }
+                }
+
+                if (i < length)
+                        layout_cells(layout, length - i);
+        }
+
+        if (layout->row == layout->target && layout->end == G_MAXUINT64)
+                layout->end = layout->offset;
+
+        return layout->row + 1;
+}
+
+/* The totals of a chunk, which don't depend on the width */
+static void sb_chunk_count(KtScrollback *sb, guint64 c, guint64 first)
+{
+        Chunk *chunk = g_ptr_array_index(sb->chunks, c - sb->chunks_first);
+        guint64 begin = MAX(c * CHUNK_LINES, first);
+        guint64 end = MIN((c + 1) * CHUNK_LINES, sb->first + sb->lines);
+        guint64 number;
+
+        chunk->cells = 0;
+        chunk->ends = 0;
+        chunk->wide = FALSE;
+
+        for (number = begin; number < end; number++) {
+                guint64 start, i;
+
+                if (!sb_line_ends(sb, number))
+                        continue;
+
+                start = sb_line_start(sb, number, first);
+                for (i = start; i <= number; i++) {
+                        guint16 mark = *sb_mark(sb, i);
+
+                        chunk->cells += mark & MARK_LENGTH;
+                        chunk->wide |= (mark & MARK_WIDE) != 0;
+                }
+                chunk->ends++;
+        }
+
+        chunk->counted = TRUE;
+}
+
+/**
+ * sb_chunk_find: Go through the logical lines ending in chunk number c,
+ * newest first, until row back, counting back from the chunk's last row.
+ *
+ * Returns: The rows gone through, all of the chunk's unless back is in
+ * it, and then start and end are the lines of its logical line and
+ * layout where its cells are.
+ */
+static guint64 sb_chunk_find(KtScrollback *sb, guint64 c, guint64 first,
+                             guint64 back, guint64 *start, guint64 *end,
+                             Layout *layout)
+{
+        guint64 begin = MAX(c * CHUNK_LINES, first);
+        guint64 number = MIN((c + 1) * CHUNK_LINES, sb->first + sb->lines);
+        guint64 rows = 0;
+
+        while (number > begin) {
+                guint64 n;
+
+                number--;
+                if (!sb_line_ends(sb, number))
+                        continue;
+
+                *end = number;
+                *start = sb_line_start(sb, number, first);
+
+                layout_init(layout, sb->width, G_MAXUINT64);
+                n = sb_line_layout(sb, *start, *end, layout);
+                if (back < rows + n) {
+                        layout_init(layout, sb->width,
+                                    n - 1 - (back - rows));
+                        sb_line_layout(sb, *start, *end, layout);
+                        return rows;
+                }
+
+                rows += n;
+                number = *start;
+        }
+
+        return rows;
+}
+
+/**
+ * sb_chunk_rows: The rows of the logical lines ending in chunk number c,
+ * at the current width if exact or the chunk was counted at it, else an
+ * upper bound.
+ */
+static guint64 sb_chunk_rows(KtScrollback *sb, guint64 c, guint64 first,
+                             gboolean exact)
+{
+        Chunk *chunk = g_ptr_array_index(sb->chunks, c - sb->chunks_first);
+        guint64 start, end;
+        Layout layout;
+        guint width;
+
+        if (!chunk->counted)
+                sb_chunk_count(sb, c, first);
+
+        if (chunk->generation == sb->generation)
+                return chunk->rows;
+
+        if (!exact) {
+                /* Rows hold one cell less at worst, for a wide character */
+                width = MAX(sb->width, 1);
+                if (chunk->wide && width > 1)
+                        width--;
+
+                return chunk->cells / width + chunk->ends;
+        }
+
+        chunk->rows = sb_chunk_find(sb, c, first, G_MAXUINT64, &start, &end,
+                                    &layout);
+        chunk->generation = sb->generation;
+
+        return chunk->rows;
+}
+
+/**
+ * sb_row_chunk: Find the chunk holding row back, counting the chunks
+ * exactly on the way. Going from where the last row was found makes
+ * reading neighbouring rows cheap however old they are.
+ *
+ * Returns: The chunk number, with back now counted from its last row, or
+ * G_MAXUINT64 if there is no such row.
+ */
+static guint64 sb_row_chunk(KtScrollback *sb, guint64 first, guint64 *back)
+{
+        guint64 last = sb->chunks_first + sb->chunks->len - 1;
+        guint64 c = last, base = 0, rows;
+
+        if (sb->chunks->len == 0)
+                return G_MAXUINT64;
+
+        if (sb->hint && sb->hint_chunk >= sb->chunks_first &&
+            sb->hint_chunk <= last) {
+                c = sb->hint_chunk;
+                base = sb->hint_back;
+        }
+
+        /* Newer chunks first if it is past the hint */
+        while (*back < base) {
+                c++;
+                base -= sb_chunk_rows(sb, c, first, TRUE);
+        }
+
+        for (;;) {
+                rows = sb_chunk_rows(sb, c, first, TRUE);
+                if (*back < base + rows)
+                        break;
+                if (c == sb->chunks_first)
+                        return G_MAXUINT64;
+                base += rows;
+                c--;
+        }
+
+        sb->hint = TRUE;
+        sb->hint_chunk = c;
+        sb->hint_back = base;
+        *back -= base;
+
+        return c;
+}
+
+static gboolean sb_reflow_cb(gpointer data)
+{
+        KtScrollback *sb = data;
+        guint64 first = kt_scrollback_get_first(sb);
+        guint n;
+
+        for (n = 0; n < REFLOW_CHUNKS; n++) {
+                if (sb->reflow_next <= sb->chunks_first) {
+                        sb->reflow_next = 0;
+                        sb->reflow_source = 0;
+                        return G_SOURCE_REMOVE;
+                }
+
+                sb->reflow_next--;
+                sb_chunk_rows(sb, sb->reflow_next, first, TRUE);
+        }
+
+        return G_SOURCE_CONTINUE;
+}
+
+/* Public methods */
+
+/**
+ * kt_scrollback_new: Create a store keeping at least max_lines lines, give
+ * or take a block.
+ */
+KtScrollback *kt_scrollback_new(guint max_lines)
+{
+        KtScrollback *sb;
+
+        sb = NEW(KtScrollback, 1);
+        MEMSET(sb, 1);
+
+        sb->max_lines = max_lines;
+        sb->blocks = g_ptr_array_new_with_free_func(block_free);
+        sb->compressor = G_CONVERTER(g_zlib_compressor_new(
+                        G_ZLIB_COMPRESSOR_FORMAT_RAW, COMPRESS_LEVEL));
+        sb->decompressor = G_CONVERTER(g_zlib_decompressor_new(
+                        G_ZLIB_COMPRESSOR_FORMAT_RAW));
+        sb->chunks = g_ptr_array_new_with_free_func(free);
+        sb->generation = 1;
+
+        if (all_stores == NULL)
+                all_stores = g_ptr_array_new();
+        g_ptr_array_add(all_stores, sb);
+
+        return sb;
+}
+
+void kt_scrollback_free(KtScrollback *sb)
+{
+        if (sb == NULL)
+                return;
+
+        if (sb->raw_bytes)
+                debug("Scrollback of %u lines, %zu bytes, %zu stored "
+                      "(%.1fx).", sb->lines, sb->raw_bytes, sb->stored_bytes,
+                      (double)sb->raw_bytes / sb->stored_bytes);
+
+        if (sb->compress_source)
+                g_source_remove(sb->compress_source);
+        if (sb->reflow_source)
+                g_source_remove(sb->reflow_source);
+
+        g_ptr_array_remove_fast(all_stores, sb);
+        if (all_stores->len == 0) {
+                g_ptr_array_unref(all_stores);
+                all_stores = NULL;
+        }
+
+        g_ptr_array_unref(sb->blocks);
+        g_ptr_array_unref(sb->chunks);
+        kt_spill_free(sb->spill);
+        g_object_unref(sb->compressor);
+        g_object_unref(sb->decompressor);
+
+        FREE(&sb->scratch);
+        FREE(&sb);
+}
+
+/**
+ * kt_scrollback_push: Append a line of cols cells, whose style and cluster
+ * IDs are from styles and clusters. It becomes line first + lines. cols
+ * is expected to be the width set last.
+ */
+void kt_scrollback_push(KtScrollback *sb, const KtGridLine *line, guint cols,
+                        KtStyleTable *styles, KtClusterTable *clusters)
+{
+        ColdBlock *block = NULL;
+        gboolean wrapped = (line->flags & KT_LINE_WRAPPED) != 0;
+        guint16 mark;
+        gsize length;
+        guint n, i;
+
+        g_return_if_fail(sb != NULL && line != NULL);
+
+        if (sb->blocks->len > 0)
+                block = g_ptr_array_index(sb->blocks, sb->blocks->len - 1);
+
+        if (block == NULL || block->lines == BLOCK_LINES) {
+                block = block_new();
+                g_ptr_array_add(sb->blocks, block);
+                sb->raw_bytes += block->length;
+                sb->stored_bytes += block->length;
+        }
+
+        length = block->length;
+        n = block_append(block, line, cols, styles, clusters);
+        block->raw_length = block->length;
+        sb->raw_bytes += block->length - length;
+        sb->stored_bytes += block->length - length;
+        sb->lines++;
+
+        /* A wrapped line goes on in the next one from its last column */
+        mark = MIN(wrapped ? cols : n, MARK_LENGTH);
+        if (wrapped)
+                mark |= MARK_WRAPPED;
+        for (i = 0; i < n; i++) {
+                if (line->cells[i].ch & KT_CELL_WIDE) {
+                        mark |= MARK_WIDE;
+                        break;
+                }
+        }
+
+        sb_mark_line(sb, mark, sb->pad && cols > 0 &&
+                     (line->cells[0].ch & KT_CELL_WIDE));
+        sb->pad = wrapped && cols > 1 && line->cells[cols - 1].ch == 0;
+
+        if (block->lines == BLOCK_LINES) {
+                block_seal(block);
+                if (sb->compress_source == 0)
+                        sb->compress_source =
+                                g_idle_add_full(G_PRIORITY_LOW,
+                                                sb_compress_cb, sb, NULL);
+                sb_trim(sb);
+                sb_budget_trim();
+        }
+
+        sb_trim_chunks(sb);
+}
+
+/**
+ * kt_scrollback_set_spill: Write the blocks dropped from memory to spill
+ * rather than losing them. The store takes spill over.
+ */
+void kt_scrollback_set_spill(KtScrollback *sb, KtSpill *spill)
+{
+        g_return_if_fail(sb != NULL);
+
+        kt_spill_free(sb->spill);
+        sb->spill = spill;
+        sb->spilled = 0;
+}
+
+/**
+ * kt_scrollback_set_max_bytes: Keep no more than max_bytes of stored lines
+ * in memory, give or take a block, dropping or spilling the oldest ones.
+ * 0 means no limit.
+ */
+void kt_scrollback_set_max_bytes(KtScrollback *sb, gsize max_bytes)
+{
+        g_return_if_fail(sb != NULL);
+
+        sb->max_bytes = max_bytes;
+        sb_trim(sb);
+}
+
+/**
+ * kt_scrollback_set_budget: Share a budget of bytes stored in memory
+ * between all the stores of the process. 0 means no budget.
+ */
+void kt_scrollback_set_budget(gsize bytes)
+{
+        all_budget = bytes;
+        sb_budget_trim();
+}
+
+/**
+ * kt_scrollback_get_budget: The budget shared by all the stores, the bytes
+ * they store in memory, how many there are and how many lines were dropped
+ * to keep within the budget.
+ */
+void kt_scrollback_get_budget(gsize *budget, gsize *used, guint *stores,
+                              guint64 *dropped)
+{
+        gsize total = 0;
+        guint i;
+
+        for (i = 0; all_stores && i < all_stores->len; i++) {
+                KtScrollback *sb = g_ptr_array_index(all_stores, i);
+
+                total += sb->stored_bytes;
+        }
+
+        if (budget)
+                *budget = all_budget;
+        if (used)
+                *used = total;
+        if (stores)
+                *stores = all_stores ? all_stores->len : 0;
+        if (dropped)
+                *dropped = all_dropped;
+}
+
+/**
+ * kt_scrollback_get_first()
+ *
+ * Returns: The absolute number of the oldest line kept.
+ */
+guint64 kt_scrollback_get_first(KtScrollback *sb)
+{
+        g_return_val_if_fail(sb != NULL, 0);
+
+        if (sb->spill)
+                return sb->first - sb->spilled + kt_spill_get_first(sb->spill);
+
+        return sb->first;
+}
+
+/**
+ * kt_scrollback_get_lines()
+ *
+ * Returns: The number of lines kept, in memory or spilled.
+ */
+guint64 kt_scrollback_get_lines(KtScrollback *sb)
+{
+        g_return_val_if_fail(sb != NULL, 0);
+
+        return sb->first + sb->lines - kt_scrollback_get_first(sb);
+}
+
+/**
+ * kt_scrollback_get_line: Copy a line into line->cells, cut or padded with
+ * blank cells to cols, interning its styles and clusters into styles and
+ * clusters. The cells own a reference on their clusters.
+ *
+ * Returns: TRUE if successful, FALSE if the line isn't kept.
+ */
+gboolean kt_scrollback_get_line(KtScrollback *sb, guint64 number,
+                                KtGridLine *line, guint cols,
+                                KtStyleTable *styles,
+                                KtClusterTable *clusters)
+{
+        const guint8 *data;
+
+        g_return_val_if_fail(sb != NULL && line != NULL, FALSE);
+
+        data = sb_line_data(sb, number);
+        if (data == NULL)
+                return FALSE;
+
+        line_decode(data, line, cols, styles, clusters);
+
+        return TRUE;
+}
+
+/**
+ * kt_scrollback_set_width: Lay the lines out at cols cells from now on.
+ * The rows are counted again from an idle callback, newest first, or when
+ * asked for. A logical line going on past the newest line is cut there.
+ */
+void kt_scrollback_set_width(KtScrollback *sb, guint cols)
+{
+        g_return_if_fail(sb != NULL);
+
+        if (cols == sb->width)
+                return;
+
+        if (sb->open > 0) {
+                *sb_mark(sb, sb->first + sb->lines - 1) &= ~MARK_WRAPPED;
+                sb->open = 0;
+        }
+        sb->pad = FALSE;
+
+        sb->width = cols;
+        sb->hint = FALSE;
+        if (++sb->generation == 0)
+                sb->generation = 1;
+
+        if (sb->chunks->len > 0)
+                sb_reflow_schedule(sb, sb->chunks_first + sb->chunks->len - 1);
+}
+
+/**
+ * kt_scrollback_get_rows: The rows the lines take at the current width.
+ * Until they are all counted again after the width changed this is an
+ * upper bound, but the rows already counted keep their numbers.
+ */
+guint64 kt_scrollback_get_rows(KtScrollback *sb)
+{
+        guint64 first, c, rows = 0;
+
+        g_return_val_if_fail(sb != NULL, 0);
+
+        first = kt_scrollback_get_first(sb);
+        for (c = sb->chunks_first; c < sb->chunks_first + sb->chunks->len;
+             c++)
+                rows += sb_chunk_rows(sb, c, first, FALSE);
+
+        return rows;
+}
+
+/**
+ * kt_scrollback_get_row: Copy the row back rows up from the newest one, at
+ * the current width, into line->cells like kt_scrollback_get_line().
+ *
+ * Returns: TRUE if successful, FALSE if there is no such row.
+ */
+gboolean kt_scrollback_get_row(KtScrollback *sb, guint64 back,
+                               KtGridLine *line, guint cols,
+                               KtStyleTable *styles,
+                               KtClusterTable *clusters)
+{
+        guint64 first, c, start, end, number, offset = 0;
+        Layout layout;
+        guint col = 0, i;
+
+        g_return_val_if_fail(sb != NULL && line != NULL, FALSE);
+
+        if (cols == 0)
+                return FALSE;
+
+        first = kt_scrollback_get_first(sb);
+        c = sb_row_chunk(sb, first, &back);
+        if (c == G_MAXUINT64)
+                return FALSE;
+
+        layout_init(&layout, sb->width, G_MAXUINT64);
+        sb_chunk_find(sb, c, first, back, &start, &end, &layout);
+        if (layout.target == G_MAXUINT64)
+                return FALSE;
+
+        /* The row's cells may come from several lines */
+        for (number = start; number <= end && col < cols; number++) {
+                guint length = *sb_mark(sb, number) & MARK_LENGTH;
+                guint64 from = MAX(layout.start, offset);
+                guint64 to = MIN(layout.end, offset + length);
+
+                if (from < to) {
+                        const guint8 *data = sb_line_data(sb, number);
+                        guint count = MIN(to - from, cols - col);
+
+                        if (data)
+                                line_decode_range(data, line->cells + col,
+                                                  from - offset, count,
+                                                  styles, clusters);
+                        else
+                                MEMSET(line->cells + col, count);
+                        col += count;
+                }
+
+                offset += length;
+        }
+
+        for (i = col; i < cols; i++) {
+                line->cells[i].ch = 0;
+                line->cells[i].style = KT_STYLE_DEFAULT;
+        }
+
+        line_fix_last(line, cols, clusters);
+        /* The newest line may go on in the caller's lines */
+        line->flags = layout.target < layout.row ||
+                (*sb_mark(sb, end) & MARK_WRAPPED) ? KT_LINE_WRAPPED : 0;
+
+        return TRUE;
+}
+
+/**
+ * kt_scrollback_get_stats: Bytes of the lines as appended, and as stored
+ * now.
+ */
+void kt_scrollback_get_stats(KtScrollback *sb, gsize *raw, gsize *stored)
+{
+        g_return_if_fail(sb != NULL);
+
+        if (raw)
+                *raw = sb->raw_bytes;
+        if (stored)
+                *stored = sb->stored_bytes;
+}
+
+/**
+ * kt_scrollback_get_memory: Bytes held in memory, the stored lines, the
+ * cached copies of blocks, the marks and the index of the spilled lines.
+ */
+gsize kt_scrollback_get_memory(KtScrollback *sb)
+{
+        gsize bytes;
+        guint i;
+
+        g_return_val_if_fail(sb != NULL, 0);
+
+        bytes = sizeof(KtScrollback) + sb->stored_bytes + sb->scratch_size +
+                sb->blocks->len * (sizeof(ColdBlock) + sizeof(gpointer)) +
+                sb->chunks->len * (sizeof(Chunk) + sizeof(gpointer));
+
+        for (i = 0; i < CACHE_BLOCKS; i++) {
+                if (sb->cache[i])
+                        bytes += sb->cache[i]->raw_length;
+        }
+
+        if (sb->spill)
+                bytes += kt_spill_get_memory(sb->spill);
+
+        return bytes;
+}
+
+/**
+ * kt_scrollback_find_row: Find where cell col of line number is at the
+ * current width, counting the rows newer than it exactly if they aren't.
+ *
+ * Returns: TRUE if the line is kept, and then back is its row counting
+ * back from the newest one, like kt_scrollback_get_row() takes it, and
+ * row_col the column in it.
+ */
+gboolean kt_scrollback_find_row(KtScrollback *sb, guint64 number, guint col,
+                                guint64 *back, guint *row_col)
+{
+        guint64 first, end, start, c, last, n, i, offset, rows = 0;
+        guint64 lo, hi, line_rows;
+        Layout layout;
+
+        g_return_val_if_fail(sb != NULL, FALSE);
+
+        first = kt_scrollback_get_first(sb);
+        if (number < first || number >= sb->first + sb->lines ||
+            !sb_has_mark(sb, number))
+                return FALSE;
+
+        /* The logical line the cell is in, and where in it */
+        for (end = number; !sb_line_ends(sb, end); end++)
+                ;
+        start = sb_line_start(sb, end, first);
+
+        offset = MIN(col, *sb_mark(sb, number) & MARK_LENGTH);
+        for (i = start; i < number; i++)
+                offset += *sb_mark(sb, i) & MARK_LENGTH;
+
+        /* The rows of the logical lines after it */
+        c = end / CHUNK_LINES;
+        last = sb->chunks_first + sb->chunks->len - 1;
+        for (n = last; n > c; n--)
+                rows += sb_chunk_rows(sb, n, first, TRUE);
+
+        n = MIN((c + 1) * CHUNK_LINES, sb->first + sb->lines);
+        while (n > end + 1) {
+                guint64 s;
+
+                n--;
+                if (!sb_line_ends(sb, n))
+                        continue;
+
+                s = sb_line_start(sb, n, first);
+                layout_init(&layout, sb->width, G_MAXUINT64);
+                rows += sb_line_layout(sb, s, n, &layout);
+                n = s;
+        }
+
+        /* The last of its rows starting at or before the cell */
+        layout_init(&layout, sb->width, G_MAXUINT64);
+        line_rows = sb_line_layout(sb, start, end, &layout);
+        lo = 0;
+        hi = line_rows - 1;
+        while (lo < hi) {
+                guint64 mid = lo + (hi - lo + 1) / 2;
+
+                layout_init(&layout, sb->width, mid);
+                sb_line_layout(sb, start, end, &layout);
+                if (layout.start <= offset)
+                        lo = mid;
+                else
+                        hi = mid - 1;
+        }
+
+        layout_init(&layout, sb->width, lo);
+        sb_line_layout(sb, start, end, &layout);
+
+        *back = rows + line_rows - 1 - lo;
+        *row_col = offset - layout.start;
+
+        return TRUE;
+}
+
+/**
+ * kt_scrollback_snapshot_new: Take the lines kept by sb, if not NULL. The
+ * lines added next are numbered on from them, or from first if there is no
+ * sb.
+ */
+KtScrollbackSnapshot *kt_scrollback_snapshot_new(KtScrollback *sb,
+                                                 guint64 first)
+{
+        KtScrollbackSnapshot *snap;
+        guint i;
+
+        snap = NEW(KtScrollbackSnapshot, 1);
+        MEMSET(snap, 1);
+
+        snap->blocks = g_array_new(FALSE, FALSE, sizeof(SnapshotBlock));
+        snap->decompressor = G_CONVERTER(g_zlib_decompressor_new(
+                        G_ZLIB_COMPRESSOR_FORMAT_RAW));
+        snap->cached[0] = G_MAXUINT;
+        snap->cached[1] = G_MAXUINT;
+        snap->first = first;
+        snap->blocks_first = first;
+
+        if (sb == NULL)
+                return snap;
+
+        snap->first = kt_scrollback_get_first(sb);
+        snap->blocks_first = sb->first;
+        if (sb->spill && snap->first < sb->first) {
+                snap->spill = kt_spill_snapshot_new(sb->spill);
+                snap->spill_offset = sb->spilled - sb->first;
+        }
+
+        for (i = 0; i < sb->blocks->len; i++) {
+                ColdBlock *block = g_ptr_array_index(sb->blocks, i);
+                SnapshotBlock shared;
+
+                if (block->bytes == NULL) {
+                        /* The one filling, the lines added go on in it */
+                        snap->open = block_new();
+                        block_reserve(snap->open, block->size);
+                        memcpy(snap->open->data, block->data, block->length);
+                        snap->open->length = block->length;
+                        snap->open->lines = block->lines;
+                        break;
+                }
+
+                shared.bytes = g_bytes_ref(block->bytes);
+                shared.raw_length = block->raw_length;
+                shared.compressed = block->compressed;
+                g_array_append_val(snap->blocks, shared);
+        }
+
+        return snap;
+}
+
+void kt_scrollback_snapshot_free(KtScrollbackSnapshot *snap)
+{
+        guint i;
+
+        if (snap == NULL)
+                return;
+
+        for (i = 0; i < snap->blocks->len; i++)
+                g_bytes_unref(g_array_index(snap->blocks, SnapshotBlock,
+                                            i).bytes);
+        g_array_unref(snap->blocks);
+        if (snap->open)
+                block_free(snap->open);
+        kt_spill_snapshot_free(snap->spill);
+        g_object_unref(snap->decompressor);
+        FREE(&snap->plain[0]);
+        FREE(&snap->plain[1]);
+        FREE(&snap);
+}
+
+/**
+ * kt_scrollback_snapshot_add: Add a line after the others, like
+ * kt_scrollback_push() does. The snapshot can only be handed over to
+ * another thread once all the lines are added.
+ */
+void kt_scrollback_snapshot_add(KtScrollbackSnapshot *snap,
+                                const KtGridLine *line, guint cols,
+                                KtStyleTable *styles,
+                                KtClusterTable *clusters)
+{
+        SnapshotBlock sealed;
+
+        g_return_if_fail(snap != NULL && line != NULL);
+
+        if (snap->open == NULL)
+                snap->open = block_new();
+
+        block_append(snap->open, line, cols, styles, clusters);
+        snap->open->raw_length = snap->open->length;
+        if (snap->open->lines < BLOCK_LINES)
+                return;
+
+        block_seal(snap->open);
+        sealed.bytes = snap->open->bytes;
+        sealed.raw_length = snap->open->raw_length;
+        sealed.compressed = FALSE;
+        g_array_append_val(snap->blocks, sealed);
+
+        snap->open->bytes = NULL;
+        snap->open->data = NULL;
+        block_free(snap->open);
+        snap->open = NULL;
+}
+
+guint64 kt_scrollback_snapshot_get_first(KtScrollbackSnapshot *snap)
+{
+        g_return_val_if_fail(snap != NULL, 0);
+
+        return snap->first;
+}
+
+/**
+ * kt_scrollback_snapshot_get_end()
+ *
+ * Returns: The number after the newest line.
+ */
+guint64 kt_scrollback_snapshot_get_end(KtScrollbackSnapshot *snap)
+{
+        g_return_val_if_fail(snap != NULL, 0);
+
+        return snap->blocks_first + (guint64)snap->blocks->len * BLOCK_LINES +
+                (snap->open ? snap->open->lines : 0);
+}
+
+/**
+ * kt_scrollback_snapshot_get_text: Append the characters of a line to text
+ * as UTF-8, an empty cell being a space and the trailing ones left out.
+ * Reading lines in order, or backwards, is the cheapest.
+ *
+ * Returns: TRUE if successful, and then flags are the line's, FALSE if it
+ * isn't kept or couldn't be read.
+ */
+gboolean kt_scrollback_snapshot_get_text(KtScrollbackSnapshot *snap,
+                                         guint64 number, GString *text,
+                                         guint *flags)
+{
+        const guint8 *data;
+        guint16 header[4];
+
+        g_return_val_if_fail(snap != NULL && text != NULL, FALSE);
+
+        data = snapshot_line_data(snap, number);
+        if (data == NULL)
+                return FALSE;
+
+        memcpy(header, data, LINE_HEADER);
+        if (flags)
+                *flags = header[1];
+
+        line_text(data, text, G_MAXSIZE);
+
+        return TRUE;
+}
+
+/**
+ * kt_scrollback_snapshot_get_col()
+ *
+ * Returns: The cell of a line that the byte at offset of its text is in.
+ */
+guint kt_scrollback_snapshot_get_col(KtScrollbackSnapshot *snap,
+                                     guint64 number, gsize offset)
+{
+        const guint8 *data;
+
+        g_return_val_if_fail(snap != NULL, 0);
+
+        data = snapshot_line_data(snap, number);
+        if (data == NULL)
+                return 0;
+
+        return line_text(data, NULL, offset);
+}
@@ -0,0 +1,104 @@
+/*
+ * kt-scrollback.h
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KT_SCROLLBACK_H
+#define KT_SCROLLBACK_H
+
+#include <glib.h>
+
+#include "kt-grid.h"
+#include "kt-spill.h"
+
+G_BEGIN_DECLS
+
+/*
+  Cold storage for the history that doesn't fit the grid's ring.
+
+  Lines are appended oldest first, with their trailing blank cells left
+  out and their styles as runs, into blocks of a few hundred lines. Full blocks are deflated from an
+  idle callback and only inflated again, into a small cache of recently used
+  blocks, when one of their lines is looked at. Old blocks are dropped
+  whole once there are more lines than asked for, or written out to a
+  KtSpill if there is one. The blocks kept in memory can also be held to a
+  number of bytes, per store and across all the stores of the process.
+
+  The lines can also be read as rows at another width, rewrapping the
+  logical lines that wrapped when they were pushed. The rows are numbered
+  back from the newest one.
+
+  A KtScrollbackSnapshot holds the lines kept at the time it was taken,
+  and more lines can be added to it. It shares the blocks that are full,
+  so taking it is cheap, and it can be read from another thread as text.
+ */
+typedef struct _KtScrollback KtScrollback;
+typedef struct _KtScrollbackSnapshot KtScrollbackSnapshot;
+
+KtScrollback *kt_scrollback_new(guint max_lines);
+void kt_scrollback_free(KtScrollback *sb);
+
+void kt_scrollback_set_spill(KtScrollback *sb, KtSpill *spill);
+void kt_scrollback_set_max_bytes(KtScrollback *sb, gsize max_bytes);
+
+void kt_scrollback_push(KtScrollback *sb, const KtGridLine *line, guint cols,
+                        KtStyleTable *styles, KtClusterTable *clusters);
+guint64 kt_scrollback_get_first(KtScrollback *sb);
+guint64 kt_scrollback_get_lines(KtScrollback *sb);
+gboolean kt_scrollback_get_line(KtScrollback *sb, guint64 number,
+                                KtGridLine *line, guint cols,
+                                KtStyleTable *styles,
+                                KtClusterTable *clusters);
+void kt_scrollback_get_stats(KtScrollback *sb, gsize *raw, gsize *stored);
+gsize kt_scrollback_get_memory(KtScrollback *sb);
+
+/* Shared by all the stores */
+void kt_scrollback_set_budget(gsize bytes);
+void kt_scrollback_get_budget(gsize *budget, gsize *used, guint *stores,
+                              guint64 *dropped);
+
+/* Rewrapping */
+void kt_scrollback_set_width(KtScrollback *sb, guint cols);
+guint64 kt_scrollback_get_rows(KtScrollback *sb);
+gboolean kt_scrollback_get_row(KtScrollback *sb, guint64 back,
+                               KtGridLine *line, guint cols,
+                               KtStyleTable *styles,
+                               KtClusterTable *clusters);
+gboolean kt_scrollback_find_row(KtScrollback *sb, guint64 number, guint col,
+                                guint64 *back, guint *row_col);
+
+/* Snapshots */
+KtScrollbackSnapshot *kt_scrollback_snapshot_new(KtScrollback *sb,
+                                                 guint64 first);
+void kt_scrollback_snapshot_free(KtScrollbackSnapshot *snap);
+void kt_scrollback_snapshot_add(KtScrollbackSnapshot *snap,
+                                const KtGridLine *line, guint cols,
+                                KtStyleTable *styles,
+                                KtClusterTable *clusters);
+guint64 kt_scrollback_snapshot_get_first(KtScrollbackSnapshot *snap);
+guint64 kt_scrollback_snapshot_get_end(KtScrollbackSnapshot *snap);
+gboolean kt_scrollback_snapshot_get_text(KtScrollbackSnapshot *snap,
+                                         guint64 number, GString *text,
+                                         guint *flags);
+guint kt_scrollback_snapshot_get_col(KtScrollbackSnapshot *snap,
+                                     guint64 number, gsize offset);
+
+G_END_DECLS
+#endif /* KT_SCROLLBACK_H */
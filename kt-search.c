@@ -0,0 +1,569 @@
+/*
+ * kt-search.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "kt-search.h"
+#include "kt-scrollback.h"
+#include "kt-util.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#define BATCH_LINES 1024 /* Lines searched between looks at the queue */
+#define MAX_MATCHES 65536 /* The search stops there */
+
+typedef struct {
+        const guint8 *bytes;
+        gsize length;
+        guint8 first; /* The first and last bytes, folded if caseless */
+        guint8 last;
+        guint8 first_fold; /* 0x20 if the byte is a letter to fold */
+        guint8 last_fold;
+        gboolean caseless;
+} Needle;
+
+typedef struct {
+        gint id;
+        KtScrollbackSnapshot *snap;
+        gchar *query;
+        Needle needle;
+        GRegex *regex; /* Or NULL for the needle */
+} SearchJob;
+
+/*
+  find_needle() returns the first place in [p, end) where the needle is,
+  or NULL. Candidates are where both its first and its last byte are at
+  the right distance, which rules out most of them before comparing the
+  rest; the widest implementation the CPU supports is picked once.
+ */
+typedef const guint8 *(*FindFunc)(const guint8 *p, const guint8 *end,
+                                  const Needle *needle);
+
+static FindFunc find_needle;
+
+struct _KtSearch {
+        GThread *thread;
+        GAsyncQueue *jobs; /* Of SearchJob, or the search itself to stop */
+        gint current; /* ID of the job wanted, the others are dropped */
+
+        KtSearchFunc func;
+        gpointer user_data;
+
+        /* Handed over from the worker to the main loop, under lock */
+        GMutex lock;
+        GArray *found; /* Of KtSearchMatch */
+        gboolean done;
+        guint deliver_source;
+        guint64 lines;
+        guint64 usec;
+};
+
+/* Private methods */
+static inline gboolean needle_at(const Needle *needle, const guint8 *p)
+{
+        if (needle->caseless)
+                return g_ascii_strncasecmp((const gchar *)p,
+                                           (const gchar *)needle->bytes,
+                                           needle->length) == 0;
+
+        return memcmp(p, needle->bytes, needle->length) == 0;
+}
+
+static const guint8 *find_scalar(const guint8 *p, const guint8 *end,
+                                 const Needle *needle)
+{
+        for (; (gsize)(end - p) >= needle->length; p++) {
+                if ((p[0] | needle->first_fold) == needle->first &&
+                    (p[needle->length - 1] | needle->last_fold) ==
+                    needle->last && needle_at(needle, p))
+                        return p;
+        }
+
+        return NULL;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static const guint8 *find_sse2(const guint8 *p, const guint8 *end,
+                               const Needle *needle)
+{
+        const __m128i first = _mm_set1_epi8(needle->first);
+        const __m128i last = _mm_set1_epi8(needle->last);
+        const __m128i first_fold = _mm_set1_epi8(needle->first_fold);
+        const __m128i last_fold = _mm_set1_epi8(needle->last_fold);
+        gsize tail = needle->length - 1;
+
+        while ((gsize)(end - p) >= tail + 16) {
+                __m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i *)p),
+                                         first_fold);
+                __m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i *)
+                                                         (p + tail)),
+                                         last_fold);
+                guint mask = _mm_movemask_epi8(
+                        _mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                      _mm_cmpeq_epi8(b, last)));
+
+                while (mask) {
+                        guint i = __builtin_ctz(mask);
+
+                        if (needle_at(needle, p + i))
+                                return p + i;
+                        mask &= mask - 1;
+                }
+                p += 16;
+        }
+
+        return find_scalar(p, end, needle);
+}
+
+__attribute__((target("avx2")))
+static const guint8 *find_avx2(const guint8 *p, const guint8 *end,
+                               const Needle *needle)
+{
+        const __m256i first = _mm256_set1_epi8(needle->first);
+        const __m256i last = _mm256_set1_epi8(needle->last);
+        const __m256i first_fold = _mm256_set1_epi8(needle->first_fold);
+        const __m256i last_fold = _mm256_set1_epi8(needle->last_fold);
+        gsize tail = needle->length - 1;
+
+        while ((gsize)(end - p) >= tail + 32) {
+                __m256i a = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)
+                                                               p),
+                                            first_fold);
+                __m256i b = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)
+                                                               (p + tail)),
+                                            last_fold);
+                guint mask = _mm256_movemask_epi8(
+                        _mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                         _mm256_cmpeq_epi8(b, last)));
+
+                while (mask) {
+                        guint i = __builtin_ctz(mask);
+
+                        if (needle_at(needle, p + i))
+                                return p + i;
+                        mask &= mask - 1;
+                }
+                p += 32;
+        }
+
+        return find_sse2(p, end, needle);
+}
+#endif
+
+static FindFunc find_select(void)
+{
+#ifdef HAVE_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+                return find_avx2;
+        if (__builtin_cpu_supports("sse2"))
+                return find_sse2;
+#endif
+        return find_scalar;
+}
+
+static void needle_init(Needle *needle, const gchar *query, gboolean caseless)
+{
+        const guint8 *bytes = (const guint8 *)query;
+        gsize length = strlen(query);
+
+        needle->bytes = bytes;
+        needle->length = length;
+        needle->caseless = caseless;
+        needle->first = bytes[0];
+        needle->last = bytes[length - 1];
+        needle->first_fold = 0;
+        needle->last_fold = 0;
+
+        if (caseless && g_ascii_isalpha(needle->first)) {
+                needle->first = g_ascii_tolower(needle->first);
+                needle->first_fold = 0x20;
+        }
+        if (caseless && g_ascii_isalpha(needle->last)) {
+                needle->last = g_ascii_tolower(needle->last);
+                needle->last_fold = 0x20;
+        }
+}
+
+static void job_free(SearchJob *job)
+{
+        kt_scrollback_snapshot_free(job->snap);
+        if (job->regex)
+                g_regex_unref(job->regex);
+        g_free(job->query);
+        FREE(&job);
+}
+
+static gboolean search_deliver_cb(gpointer data)
+{
+        KtSearch *search = data;
+        GArray *found;
+        gboolean done;
+
+        g_mutex_lock(&search->lock);
+        found = search->found;
+        search->found = g_array_new(FALSE, FALSE, sizeof(KtSearchMatch));
+        done = search->done;
+        search->done = FALSE;
+        search->deliver_source = 0;
+        g_mutex_unlock(&search->lock);
+
+        if (done)
+                debug("Searched %" G_GUINT64_FORMAT " lines in %.1f ms, "
+                      "%.0f lines/s.", search->lines, search->usec / 1000.0,
+                      search->lines * 1e6 / MAX(search->usec, 1));
+
+        if (found->len > 0 || done)
+                search->func((const KtSearchMatch *)found->data, found->len,
+                             done, search->user_data);
+        g_array_unref(found);
+
+        return G_SOURCE_REMOVE;
+}
+
+/* Hand matches over to the main loop, unless the job was dropped */
+static void search_deliver(KtSearch *search, SearchJob *job,
+                           const GArray *matches, gboolean done,
+                           guint64 lines, guint64 usec)
+{
+        g_mutex_lock(&search->lock);
+
+        if (job->id == g_atomic_int_get(&search->current)) {
+                g_array_append_vals(search->found, matches->data,
+                                    matches->len);
+                search->done = done;
+                search->lines = lines;
+                search->usec = usec;
+                if ((matches->len > 0 || done) &&
+                    search->deliver_source == 0)
+                        search->deliver_source =
+                                g_idle_add(search_deliver_cb, search);
+        }
+
+        g_mutex_unlock(&search->lock);
+}
+
+/* The line of the byte at offset of the batch, and the byte in the line */
+static guint64 batch_line(const GArray *starts, guint64 lo, gsize offset,
+                          gsize *in_line)
+{
+        guint low = 0, high = starts->len - 1;
+
+        while (low < high) {
+                guint mid = low + (high - low + 1) / 2;
+
+                if (g_array_index(starts, gsize, mid) <= offset)
+                        low = mid;
+                else
+                        high = mid - 1;
+        }
+
+        *in_line = offset - g_array_index(starts, gsize, low);
+
+        return lo + low;
+}
+
+static void batch_match(SearchJob *job, const GArray *starts, guint64 lo,
+                        gsize start, gsize end, GArray *matches)
+{
+        KtSearchMatch match;
+        gsize offset;
+
+        match.line = batch_line(starts, lo, start, &offset);
+        match.col = kt_scrollback_snapshot_get_col(job->snap, match.line,
+                                                   offset);
+        match.end_line = batch_line(starts, lo, end - 1, &offset);
+        match.end_col = kt_scrollback_snapshot_get_col(job->snap,
+                                                       match.end_line,
+                                                       offset);
+
+        g_array_append_val(matches, match);
+}
+
+static void batch_search(SearchJob *job, const GString *text, gsize begin,
+                         const GArray *starts, guint64 lo, GArray *matches)
+{
+        GMatchInfo *info = NULL;
+        gint start, end;
+
+        if (job->regex == NULL) {
+                const guint8 *p = (const guint8 *)text->str + begin;
+                const guint8 *stop = (const guint8 *)text->str + text->len;
+
+                while ((p = find_needle(p, stop, &job->needle)) != NULL) {
+                        start = p - (const guint8 *)text->str;
+                        batch_match(job, starts, lo, start,
+                                    start + job->needle.length, matches);
+                        p += job->needle.length;
+                }
+
+                return;
+        }
+
+        g_regex_match_full(job->regex, text->str, text->len, begin,
+                           G_REGEX_MATCH_NOTEMPTY, &info, NULL);
+        while (g_match_info_matches(info)) {
+                if (g_match_info_fetch_pos(info, 0, &start, &end) &&
+                    end > start)
+                        batch_match(job, starts, lo, start, end, matches);
+                g_match_info_next(info, NULL);
+        }
+        g_match_info_free(info);
+}
+
+static void search_run(KtSearch *search, SearchJob *job)
+{
+        GString *text = g_string_sized_new(64 * 1024);
+        GArray *starts = g_array_new(FALSE, FALSE, sizeof(gsize));
+        GArray *matches = g_array_new(FALSE, FALSE, sizeof(KtSearchMatch));
+        guint64 first, hi, lines = 0, found = 0, span = BATCH_LINES;
+        gint64 started = g_get_monotonic_time();
+
+        first = kt_scrollback_snapshot_get_first(job->snap);
+        hi = kt_scrollback_snapshot_get_end(job->snap);
+
+        while (hi > first && found < MAX_MATCHES) {
+                guint64 lo = hi - MIN(hi - first, span);
+                guint64 number, begin_line = lo;
+                gsize begin = 0;
+
+                if (job->id != g_atomic_int_get(&search->current))
+                        break;
+
+                g_string_truncate(text, 0);
+                g_array_set_size(starts, 0);
+                g_array_set_size(matches, 0);
+
+                for (number = lo; number < hi; number++) {
+                        gsize at = text->len;
+                        guint flags = 0;
+
+                        g_array_append_val(starts, at);
+                        kt_scrollback_snapshot_get_text(job->snap, number,
+                                                        text, &flags);
+                        if (flags & KT_LINE_WRAPPED)
+                                continue;
+
+                        g_string_append_c(text, '\n');
+
+                        /* The lines before the first logical line may go
+                           on from older ones, they go with them */
+                        if (begin_line == lo && lo > first &&
+                            number + 1 < hi) {
+                                begin_line = number + 1;
+                                begin = text->len;
+                        }
+                }
+
+                /* The batch is all in one logical line that goes on from
+                   older lines: take more of them, so that a match isn't
+                   split across two batches. Doubling keeps the lines read
+                   again linear. */
+                if (begin_line == lo && lo > first) {
+                        span *= 2;
+                        continue;
+                }
+                span = BATCH_LINES;
+
+                batch_search(job, text, begin, starts, lo, matches);
+                found += matches->len;
+                lines += hi - begin_line;
+                hi = begin_line;
+
+                search_deliver(search, job, matches, FALSE, lines,
+                               g_get_monotonic_time() - started);
+        }
+
+        g_array_set_size(matches, 0);
+        search_deliver(search, job, matches, TRUE, lines,
+                       g_get_monotonic_time() - started);
+
+        g_string_free(text, TRUE);
+        g_array_unref(starts);
+        g_array_unref(matches);
+}
+
+static gpointer search_thread(KtSearch *search)
+{
+        for (;;) {
+                SearchJob *job = g_async_queue_pop(search->jobs);
+
+                if ((gpointer)job == (gpointer)search)
+                        break;
+
+                /* Only the newest one is still wanted */
+                if (job->id == g_atomic_int_get(&search->current))
+                        search_run(search, job);
+                job_free(job);
+        }
+
+        return NULL;
+}
+
+/* Public methods */
+KtSearch *kt_search_new(KtSearchFunc func, gpointer user_data)
+{
+        static gsize select_done = 0;
+        KtSearch *search;
+        GError *error = NULL;
+
+        g_return_val_if_fail(func != NULL, NULL);
+
+        if (g_once_init_enter(&select_done)) {
+                find_needle = find_select();
+                g_once_init_leave(&select_done, 1);
+        }
+
+        search = NEW(KtSearch, 1);
+        MEMSET(search, 1);
+
+        search->func = func;
+        search->user_data = user_data;
+        search->jobs = g_async_queue_new();
+        search->found = g_array_new(FALSE, FALSE, sizeof(KtSearchMatch));
+        g_mutex_init(&search->lock);
+
+        search->thread = g_thread_try_new("kt-search",
+                                          (GThreadFunc)search_thread,
+                                          search, &error);
+        if (search->thread == NULL) {
+                error("Could not start the search thread: %s",
+                      error->message);
+                g_error_free(error);
+                g_async_queue_unref(search->jobs);
+                g_array_unref(search->found);
+                g_mutex_clear(&search->lock);
+                FREE(&search);
+                return NULL;
+        }
+
+        return search;
+}
+
+void kt_search_free(KtSearch *search)
+{
+        if (search == NULL)
+                return;
+
+        kt_search_cancel(search);
+        g_async_queue_push(search->jobs, search);
+        g_thread_join(search->thread);
+        g_async_queue_unref(search->jobs);
+
+        if (search->deliver_source)
+                g_source_remove(search->deliver_source);
+        g_array_unref(search->found);
+        g_mutex_clear(&search->lock);
+
+        FREE(&search);
+}
+
+/**
+ * kt_search_start: Search the history and the screen of grid for query,
+ * dropping the search going on if any. The results come from the main
+ * loop.
+ *
+ * Returns: TRUE if the search started, FALSE if query isn't a valid
+ * pattern, and then error is set.
+ */
+gboolean kt_search_start(KtSearch *search, KtGrid *grid, const gchar *query,
+                         guint flags, GError **error)
+{
+        gboolean caseless = (flags & KT_SEARCH_CASELESS) != 0;
+        GRegex *regex = NULL;
+        SearchJob *job;
+        const gchar *p;
+
+        g_return_val_if_fail(search != NULL && grid != NULL, FALSE);
+        g_return_val_if_fail(query != NULL && *query != '\0', FALSE);
+
+        if (flags & KT_SEARCH_REGEX) {
+                regex = g_regex_new(query, G_REGEX_OPTIMIZE |
+                                    G_REGEX_MULTILINE |
+                                    (caseless ? G_REGEX_CASELESS : 0), 0,
+                                    error);
+                if (regex == NULL)
+                        return FALSE;
+        } else if (caseless) {
+                /* Only ASCII is folded in the scan */
+                for (p = query; *p && !(*p & 0x80); p++)
+                        ;
+                if (*p) {
+                        gchar *escaped = g_regex_escape_string(query, -1);
+
+                        regex = g_regex_new(escaped, G_REGEX_OPTIMIZE |
+                                            G_REGEX_CASELESS, 0, error);
+                        g_free(escaped);
+                        if (regex == NULL)
+                                return FALSE;
+                }
+        }
+
+        kt_search_cancel(search);
+
+        job = NEW(SearchJob, 1);
+        MEMSET(job, 1);
+        job->id = g_atomic_int_get(&search->current);
+        job->query = g_strdup(query);
+        job->regex = regex;
+        needle_init(&job->needle, job->query, caseless);
+        job->snap = kt_grid_snapshot(grid);
+
+        g_async_queue_push(search->jobs, job);
+
+        return TRUE;
+}
+
+/**
+ * kt_search_cancel: Drop the search going on, no more results come from
+ * it.
+ */
+void kt_search_cancel(KtSearch *search)
+{
+        g_return_if_fail(search != NULL);
+
+        g_mutex_lock(&search->lock);
+        g_atomic_int_inc(&search->current);
+        g_array_set_size(search->found, 0);
+        search->done = FALSE;
+        g_mutex_unlock(&search->lock);
+}
+
+/**
+ * kt_search_get_stats: The lines gone through by the last search, and how
+ * long it took, so far if it is still going on.
+ */
+void kt_search_get_stats(KtSearch *search, guint64 *lines, guint64 *usec)
+{
+        g_return_if_fail(search != NULL);
+
+        g_mutex_lock(&search->lock);
+        if (lines)
+                *lines = search->lines;
+        if (usec)
+                *usec = search->usec;
+        g_mutex_unlock(&search->lock);
+}
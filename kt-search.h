@@ -0,0 +1,73 @@
+/*
+ * kt-search.h
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KT_SEARCH_H
+#define KT_SEARCH_H
+
+#include <glib.h>
+
+#include "kt-grid.h"
+
+G_BEGIN_DECLS
+
+/*
+  Searching the history and the screen of a grid without holding the main
+  loop up: a worker thread goes through a snapshot of them, newest lines
+  first, and hands the matches over to the main loop as it finds them.
+  Starting another search, or cancelling, drops the one going on.
+
+  The query is looked for as is, with a vectorized scan for its first and
+  last bytes, or as a GRegex pattern with KT_SEARCH_REGEX. Logical lines
+  are searched whole, so a match can go on past a soft wrap.
+
+  Matches are given by position, as kt_grid_snapshot() numbers the lines,
+  and kt_grid_find_position() tells where they are now.
+ */
+typedef struct _KtSearch KtSearch;
+
+typedef struct {
+        guint64 line; /* Position of the first character */
+        guint col;
+        guint64 end_line; /* and of the last one */
+        guint end_col;
+} KtSearchMatch;
+
+enum {
+        KT_SEARCH_CASELESS = 1 << 0, /* Unicode for GRegex, else ASCII */
+        KT_SEARCH_REGEX = 1 << 1,
+};
+
+/* The matches of a call are in order, and the calls go from the newest
+   lines to the oldest. done is set on the last one. */
+typedef void (*KtSearchFunc)(const KtSearchMatch *matches, guint n,
+                             gboolean done, gpointer user_data);
+
+KtSearch *kt_search_new(KtSearchFunc func, gpointer user_data);
+void kt_search_free(KtSearch *search);
+
+gboolean kt_search_start(KtSearch *search, KtGrid *grid, const gchar *query,
+                         guint flags, GError **error);
+void kt_search_cancel(KtSearch *search);
+void kt_search_get_stats(KtSearch *search, guint64 *lines, guint64 *usec);
+
+G_END_DECLS
+#endif /* KT_SEARCH_H */
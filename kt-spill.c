@@ -0,0 +1,536 @@
+/*
+ * kt-spill.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "kt-spill.h"
+#include "kt-util.h"
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <basedir.h>
+
+#define INDEX_MIN 64
+#define INDEX_STRIDE 256 /* Records per index entry */
+#define WRITE_BUFFER (64 * 1024)
+
+/* A record is its length, a guint32, then the data, padded to 4 bytes */
+#define RECORD_HEADER sizeof(guint32)
+#define RECORD_SIZE(length) (RECORD_HEADER + (((length) + 3) & ~(gsize)3))
+
+struct _KtSpill {
+        int fd;
+        const guint8 *map; /* The whole file, max_bytes */
+        gsize max_bytes;
+        gsize tail; /* Where the next record goes */
+        gboolean failed; /* A write failed, nothing more is kept */
+
+        /* Records not written yet, they go at tail - pending */
+        guint8 *buffer;
+        gsize pending;
+
+        /* The offsets of the records numbered a multiple of INDEX_STRIDE,
+           entry number / INDEX_STRIDE of a ring of index_size. The others
+           are found by walking the records from there, so that the index
+           stays small next to the file even when the records are. */
+        guint64 *index;
+        gsize index_size;
+        gsize count;
+        guint64 first; /* Number of the oldest record */
+        guint64 oldest; /* and its offset */
+        guint64 lap; /* Number of the record at offset 0 */
+        guint64 cursor; /* The last record looked up, and its offset */
+        guint64 cursor_offset;
+};
+
+struct _KtSpillSnapshot {
+        const guint8 *map;
+        gsize max_bytes;
+        guint64 *index; /* The entries of the store's, oldest first */
+        gsize count;
+        guint64 first;
+        guint64 oldest;
+        guint64 lap;
+        guint64 cursor;
+        guint64 cursor_offset;
+};
+
+/* Private methods */
+static int spill_open(void)
+{
+        xdgHandle xdg;
+        gchar *dir, *path;
+        int fd = -1;
+
+        if (xdgInitHandle(&xdg) == NULL)
+                return -1;
+
+        dir = g_build_filename(xdgCacheHome(&xdg), "kixterm", NULL);
+        xdgWipeHandle(&xdg);
+
+        if (g_mkdir_with_parents(dir, 0700) == -1) {
+                warn("Could not create %s: %s", dir, g_strerror(errno));
+                goto out;
+        }
+
+        path = g_build_filename(dir, "scrollback-XXXXXX", NULL);
+        fd = g_mkstemp(path);
+        if (fd == -1)
+                warn("Could not create %s: %s", path, g_strerror(errno));
+        else
+                /* Gone with the last reference, however kixterm exits */
+                unlink(path);
+        g_free(path);
+
+out:
+        g_free(dir);
+
+        return fd;
+}
+
+/**
+ * spill_walk: Find record number by walking the records from the one
+ * numbered from, at offset. All of them are kept, so only the start of
+ * this lap, at record lap, has to be known to follow them.
+ *
+ * Returns: The offset of the record, or G_MAXUINT64 if the walk leaves the
+ * file, as it can when a snapshot reads records overwritten since.
+ */
+static guint64 spill_walk(const guint8 *map, gsize max_bytes, guint64 from,
+                          guint64 offset, guint64 number, guint64 lap)
+{
+        guint32 header;
+
+        for (; from < number; from++) {
+                if (from + 1 == lap) {
+                        offset = 0;
+                        continue;
+                }
+
+                if (offset + RECORD_HEADER > max_bytes)
+                        return G_MAXUINT64;
+                memcpy(&header, map + offset, RECORD_HEADER);
+                if (header > max_bytes - offset - RECORD_HEADER)
+                        return G_MAXUINT64;
+                offset += RECORD_SIZE(header);
+        }
+
+        return offset;
+}
+
+/* The entry of the group of record number */
+static guint64 *spill_index_entry(KtSpill *spill, guint64 number)
+{
+        return &spill->index[(number / INDEX_STRIDE) % spill->index_size];
+}
+
+static void spill_index_grow(KtSpill *spill)
+{
+        guint64 *index;
+        guint64 group, last;
+
+        index = NEW(guint64, spill->index_size * 2);
+        last = (spill->first + spill->count) / INDEX_STRIDE;
+        for (group = spill->first / INDEX_STRIDE; group < last; group++)
+                index[group % (spill->index_size * 2)] =
+                        spill->index[group % spill->index_size];
+
+        FREE(&spill->index);
+        spill->index = index;
+        spill->index_size *= 2;
+}
+
+static void spill_drop_all(KtSpill *spill)
+{
+        spill->first += spill->count;
+        spill->count = 0;
+}
+
+/* Drop the records up to the next entry of the index, to know where the
+   oldest one is without reading the file. That is a few more than needed. */
+static void spill_drop_oldest(KtSpill *spill)
+{
+        guint64 next = spill->first - spill->first % INDEX_STRIDE +
+                INDEX_STRIDE;
+
+        if (next >= spill->first + spill->count) {
+                spill_drop_all(spill);
+                return;
+        }
+
+        spill->count -= next - spill->first;
+        spill->first = next;
+        spill->oldest = *spill_index_entry(spill, next);
+}
+
+/**
+ * spill_flush: Write the buffered records out.
+ *
+ * Returns: TRUE if successful, FALSE if not, and then nothing is kept.
+ */
+static gboolean spill_flush(KtSpill *spill)
+{
+        gsize done = 0;
+        ssize_t ret;
+
+        while (done < spill->pending) {
+                ret = pwrite(spill->fd, spill->buffer + done,
+                             spill->pending - done,
+                             spill->tail - spill->pending + done);
+                if (ret == -1 && errno == EINTR)
+                        continue;
+                if (ret <= 0) {
+                        warn("Could not write to the scrollback file: %s",
+                             ret == -1 ? g_strerror(errno) : "no space");
+                        spill->failed = TRUE;
+                        spill->pending = 0;
+                        spill_drop_all(spill);
+                        return FALSE;
+                }
+                done += ret;
+        }
+
+        spill->pending = 0;
+
+        return TRUE;
+}
+
+/* Public methods */
+
+/**
+ * kt_spill_new: Create the backing file, taking up to max_bytes.
+ *
+ * Returns: The store, or NULL if the file couldn't be set up.
+ */
+KtSpill *kt_spill_new(gsize max_bytes)
+{
+        KtSpill *spill;
+        void *map;
+        int fd;
+
+        fd = spill_open();
+        if (fd == -1)
+                return NULL;
+
+        /* Sparse, the blocks are only allocated as records are written */
+        if (ftruncate(fd, max_bytes) == -1) {
+                warn("Could not size the scrollback file: %s",
+                     g_strerror(errno));
+                close(fd);
+                return NULL;
+        }
+
+        map = mmap(NULL, max_bytes, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+                warn("Could not map the scrollback file: %s",
+                     g_strerror(errno));
+                close(fd);
+                return NULL;
+        }
+
+        spill = NEW(KtSpill, 1);
+        MEMSET(spill, 1);
+
+        spill->fd = fd;
+        spill->map = map;
+        spill->max_bytes = max_bytes;
+        spill->index_size = INDEX_MIN;
+        spill->index = NEW(guint64, spill->index_size);
+        spill->cursor = G_MAXUINT64;
+        spill->buffer = NEW(guint8, WRITE_BUFFER);
+
+        debug("Spilling scrollback to a file of up to %zu bytes.",
+              max_bytes);
+
+        return spill;
+}
+
+void kt_spill_free(KtSpill *spill)
+{
+        if (spill == NULL)
+                return;
+
+        debug("Scrollback file held %zu lines.", spill->count);
+
+        munmap((void *)spill->map, spill->max_bytes);
+        close(spill->fd);
+        FREE(&spill->index);
+        FREE(&spill->buffer);
+        FREE(&spill);
+}
+
+/**
+ * kt_spill_append: Add a record, it gets number kt_spill_get_end(). Older
+ * records are dropped as needed to make room.
+ */
+void kt_spill_append(KtSpill *spill, const guint8 *data, gsize length)
+{
+        guint32 header = length;
+        gsize size = RECORD_SIZE(length);
+        guint8 *out;
+
+        g_return_if_fail(spill != NULL);
+
+        if (!spill->failed && length > 0 &&
+            size > MIN(spill->max_bytes, WRITE_BUFFER)) {
+                /* Too big to keep: an empty record takes its number, as
+                   for the lines of a lost block, and the others stay */
+                kt_spill_append(spill, NULL, 0);
+                return;
+        }
+
+        if (spill->failed || size > MIN(spill->max_bytes, WRITE_BUFFER)) {
+                /* Keep the numbering going, the record is just not there */
+                spill_drop_all(spill);
+                spill->first++;
+                return;
+        }
+
+        if (spill->tail + size > spill->max_bytes ||
+            spill->pending + size > WRITE_BUFFER) {
+                if (!spill_flush(spill)) {
+                        spill->first++;
+                        return;
+                }
+                if (spill->tail + size > spill->max_bytes) {
+                        /* The records left past the end of this lap go
+                           first, they are the oldest */
+                        while (spill->count > 0 &&
+                               spill->oldest >= spill->tail)
+                                spill_drop_oldest(spill);
+                        spill->tail = 0;
+                        spill->lap = spill->first + spill->count;
+                }
+        }
+
+        /* Forget the records about to be overwritten */
+        while (spill->count > 0) {
+                if (spill->oldest < spill->tail ||
+                    spill->oldest >= spill->tail + size)
+                        break;
+                spill_drop_oldest(spill);
+        }
+
+        out = spill->buffer + spill->pending;
+        memcpy(out, &header, RECORD_HEADER);
+        memcpy(out + RECORD_HEADER, data, length);
+        memset(out + RECORD_HEADER + length, 0, size - RECORD_HEADER - length);
+
+        if (spill->count == 0)
+                spill->oldest = spill->tail;
+
+        if ((spill->first + spill->count) % INDEX_STRIDE == 0) {
+                if ((spill->first + spill->count) / INDEX_STRIDE -
+                    spill->first / INDEX_STRIDE >= spill->index_size)
+                        spill_index_grow(spill);
+                *spill_index_entry(spill, spill->first + spill->count) =
+                        spill->tail;
+        }
+        spill->count++;
+        spill->tail += size;
+        spill->pending += size;
+}
+
+/**
+ * kt_spill_get_memory()
+ *
+ * Returns: The bytes of memory held for the store, the file left out.
+ */
+gsize kt_spill_get_memory(KtSpill *spill)
+{
+        g_return_val_if_fail(spill != NULL, 0);
+
+        return sizeof(KtSpill) + spill->index_size * sizeof(guint64) +
+                WRITE_BUFFER;
+}
+
+/**
+ * kt_spill_get_first()
+ *
+ * Returns: The number of the oldest record kept.
+ */
+guint64 kt_spill_get_first(KtSpill *spill)
+{
+        g_return_val_if_fail(spill != NULL, 0);
+
+        return spill->first;
+}
+
+/**
+ * kt_spill_get_end()
+ *
+ * Returns: The number the next record will get.
+ */
+guint64 kt_spill_get_end(KtSpill *spill)
+{
+        g_return_val_if_fail(spill != NULL, 0);
+
+        return spill->first + spill->count;
+}
+
+/**
+ * kt_spill_get: Look a record up.
+ *
+ * Returns: The data of the record in the mapping, or NULL if it isn't kept.
+ */
+const guint8 *kt_spill_get(KtSpill *spill, guint64 number, gsize *length)
+{
+        const guint8 *record;
+        guint64 offset;
+        guint32 header;
+
+        g_return_val_if_fail(spill != NULL, NULL);
+
+        if (spill->pending > 0 && !spill_flush(spill))
+                return NULL;
+
+        if (number < spill->first || number >= spill->first + spill->count)
+                return NULL;
+
+        /* From the last record looked up, the oldest one or the index */
+        if (spill->cursor >= spill->first && spill->cursor <= number &&
+            spill->cursor / INDEX_STRIDE == number / INDEX_STRIDE)
+                offset = spill_walk(spill->map, spill->max_bytes,
+                                    spill->cursor, spill->cursor_offset,
+                                    number, spill->lap);
+        else if (number / INDEX_STRIDE == spill->first / INDEX_STRIDE)
+                offset = spill_walk(spill->map, spill->max_bytes,
+                                    spill->first, spill->oldest,
+                                    number, spill->lap);
+        else
+                offset = spill_walk(spill->map, spill->max_bytes,
+                                    number - number % INDEX_STRIDE,
+                                    *spill_index_entry(spill, number),
+                                    number, spill->lap);
+        if (offset == G_MAXUINT64)
+                return NULL;
+
+        spill->cursor = number;
+        spill->cursor_offset = offset;
+
+        record = spill->map + offset;
+        memcpy(&header, record, RECORD_HEADER);
+        if (length)
+                *length = header;
+
+        return record + RECORD_HEADER;
+}
+
+/**
+ * kt_spill_snapshot_new: Take the records kept now, for reading them from
+ * another thread.
+ *
+ * Returns: The snapshot, or NULL if the file couldn't be mapped again.
+ */
+KtSpillSnapshot *kt_spill_snapshot_new(KtSpill *spill)
+{
+        KtSpillSnapshot *snap;
+        guint64 group, first_group;
+        void *map;
+
+        g_return_val_if_fail(spill != NULL, NULL);
+
+        if (spill->pending > 0)
+                spill_flush(spill);
+
+        /* A mapping of its own, the store may be gone before the snapshot */
+        map = mmap(NULL, spill->max_bytes, PROT_READ, MAP_SHARED, spill->fd,
+                   0);
+        if (map == MAP_FAILED) {
+                warn("Could not map the scrollback file: %s",
+                     g_strerror(errno));
+                return NULL;
+        }
+
+        snap = NEW(KtSpillSnapshot, 1);
+        snap->map = map;
+        snap->max_bytes = spill->max_bytes;
+        snap->count = spill->count;
+        snap->first = spill->first;
+        snap->oldest = spill->oldest;
+        snap->lap = spill->lap;
+        snap->cursor = G_MAXUINT64;
+
+        first_group = spill->first / INDEX_STRIDE;
+        snap->index = NEW(guint64, spill->count / INDEX_STRIDE + 2);
+        for (group = first_group;
+             group * INDEX_STRIDE < spill->first + spill->count; group++)
+                snap->index[group - first_group] =
+                        spill->index[group % spill->index_size];
+
+        return snap;
+}
+
+void kt_spill_snapshot_free(KtSpillSnapshot *snap)
+{
+        if (snap == NULL)
+                return;
+
+        munmap((void *)snap->map, snap->max_bytes);
+        FREE(&snap->index);
+        FREE(&snap);
+}
+
+/**
+ * kt_spill_snapshot_get: Look a record of the snapshot up. It may have been
+ * overwritten since the snapshot was taken, and then the data is whatever
+ * is there now.
+ *
+ * Returns: The data of the record in the mapping, or NULL if it isn't kept.
+ */
+const guint8 *kt_spill_snapshot_get(KtSpillSnapshot *snap, guint64 number,
+                                    gsize *length)
+{
+        guint64 offset;
+        guint32 header;
+
+        g_return_val_if_fail(snap != NULL, NULL);
+
+        if (number < snap->first || number >= snap->first + snap->count)
+                return NULL;
+
+        if (snap->cursor >= snap->first && snap->cursor <= number &&
+            snap->cursor / INDEX_STRIDE == number / INDEX_STRIDE)
+                offset = spill_walk(snap->map, snap->max_bytes, snap->cursor,
+                                    snap->cursor_offset, number, snap->lap);
+        else if (number / INDEX_STRIDE == snap->first / INDEX_STRIDE)
+                offset = spill_walk(snap->map, snap->max_bytes, snap->first,
+                                    snap->oldest, number, snap->lap);
+        else
+                offset = spill_walk(snap->map, snap->max_bytes,
+                                    number - number % INDEX_STRIDE,
+                                    snap->index[number / INDEX_STRIDE -
+                                                snap->first / INDEX_STRIDE],
+                                    number, snap->lap);
+        if (offset == G_MAXUINT64 || offset + RECORD_HEADER > snap->max_bytes)
+                return NULL;
+
+        snap->cursor = number;
+        snap->cursor_offset = offset;
+
+        memcpy(&header, snap->map + offset, RECORD_HEADER);
+        if (header > snap->max_bytes - offset - RECORD_HEADER)
+                return NULL;
+        if (length)
+                *length = header;
+
+        return snap->map + offset + RECORD_HEADER;
+}
@@ -0,0 +1,63 @@
+/*
+ * kt-spill.h
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KT_SPILL_H
+#define KT_SPILL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+  An append only store of records, one per line of scrollback, in an
+  unlinked file under $XDG_CACHE_HOME. The file is read back through a
+  shared mapping and an index of the offset of every 256th record, so the
+  pages of old lines are only in memory while they are looked at and the
+  kernel can take them back at any time.
+
+  The file is capped at max_bytes and wraps around, overwriting the oldest
+  records, when it is full.
+
+  A KtSpillSnapshot maps the file again and copies the index, so it can be
+  read from another thread and outlive the store. The records it points to
+  may be overwritten meanwhile; what is read back is only checked to stay
+  within the file.
+ */
+typedef struct _KtSpill KtSpill;
+typedef struct _KtSpillSnapshot KtSpillSnapshot;
+
+KtSpill *kt_spill_new(gsize max_bytes);
+void kt_spill_free(KtSpill *spill);
+
+void kt_spill_append(KtSpill *spill, const guint8 *data, gsize length);
+gsize kt_spill_get_memory(KtSpill *spill);
+guint64 kt_spill_get_first(KtSpill *spill);
+guint64 kt_spill_get_end(KtSpill *spill);
+const guint8 *kt_spill_get(KtSpill *spill, guint64 number, gsize *length);
+
+KtSpillSnapshot *kt_spill_snapshot_new(KtSpill *spill);
+void kt_spill_snapshot_free(KtSpillSnapshot *snap);
+const guint8 *kt_spill_snapshot_get(KtSpillSnapshot *snap, guint64 number,
+                                    gsize *length);
+
+G_END_DECLS
+#endif /* KT_SPILL_H */
@@ -0,0 +1,188 @@
+/*
+ * kt-style.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "kt-style.h"
+#include "kt-util.h"
+
+#define STYLES_MIN 64
+
+/*
+  The styles are kept in an array indexed by ID, and found by value
+  through an open addressing hash of ID + 1, 0 being a free slot, with at
+  least twice as many slots as styles.
+ */
+struct _KtStyleTable {
+        KtStyle *styles;
+        guint size;
+        guint allocated;
+
+        guint32 *slots;
+        guint mask;
+
+        guint last; /* The last ID interned, SGR tends to repeat itself */
+};
+
+/* Private methods */
+static inline gboolean style_equal(const KtStyle *a, const KtStyle *b)
+{
+        return a->fg == b->fg && a->bg == b->bg && a->ul == b->ul &&
+                a->attrs == b->attrs;
+}
+
+static inline guint style_hash(const KtStyle *style)
+{
+        guint32 h = style->fg * 0x9e3779b1u;
+
+        h = (h ^ style->bg) * 0x85ebca6bu;
+        h = (h ^ style->ul) * 0xc2b2ae35u;
+        h = (h ^ style->attrs) * 0x9e3779b1u;
+
+        return h ^ h >> 16;
+}
+
+static void table_insert_slot(KtStyleTable *table, guint id)
+{
+        guint i = style_hash(&table->styles[id]) & table->mask;
+
+        while (table->slots[i])
+                i = (i + 1) & table->mask;
+
+        table->slots[i] = id + 1;
+}
+
+static void table_grow(KtStyleTable *table)
+{
+        KtStyle *styles;
+        guint id;
+
+        table->allocated *= 2;
+        styles = NEW(KtStyle, table->allocated);
+        memcpy(styles, table->styles, table->size * sizeof(KtStyle));
+        FREE(&table->styles);
+        table->styles = styles;
+
+        FREE(&table->slots);
+        table->mask = table->allocated * 2 - 1;
+        table->slots = NEW(guint32, table->mask + 1);
+        MEMSET(table->slots, table->mask + 1);
+
+        for (id = 0; id < table->size; id++)
+                table_insert_slot(table, id);
+}
+
+/* Public methods */
+KtStyleTable *kt_style_table_new(void)
+{
+        KtStyleTable *table;
+
+        table = NEW(KtStyleTable, 1);
+        MEMSET(table, 1);
+
+        table->allocated = STYLES_MIN;
+        table->styles = NEW(KtStyle, table->allocated);
+        table->mask = table->allocated * 2 - 1;
+        table->slots = NEW(guint32, table->mask + 1);
+        MEMSET(table->slots, table->mask + 1);
+
+        /* The default style */
+        MEMSET(&table->styles[0], 1);
+        table->size = 1;
+        table_insert_slot(table, KT_STYLE_DEFAULT);
+
+        return table;
+}
+
+void kt_style_table_free(KtStyleTable *table)
+{
+        if (table == NULL)
+                return;
+
+        FREE(&table->styles);
+        FREE(&table->slots);
+        FREE(&table);
+}
+
+/**
+ * kt_style_table_intern: Find the ID of a style, adding it if needed.
+ *
+ * Returns: The ID, or KT_STYLE_NONE if the style is new and the table is
+ * full.
+ */
+guint kt_style_table_intern(KtStyleTable *table, const KtStyle *style)
+{
+        guint i, id;
+
+        g_return_val_if_fail(table != NULL && style != NULL, KT_STYLE_NONE);
+
+        if (style_equal(&table->styles[table->last], style))
+                return table->last;
+
+        for (i = style_hash(style) & table->mask; table->slots[i];
+             i = (i + 1) & table->mask) {
+                id = table->slots[i] - 1;
+                if (style_equal(&table->styles[id], style))
+                        return table->last = id;
+        }
+
+        if (table->size == KT_STYLE_MAX)
+                return KT_STYLE_NONE;
+
+        if (table->size == table->allocated)
+                table_grow(table);
+
+        id = table->size++;
+        table->styles[id] = *style;
+        table_insert_slot(table, id);
+
+        return table->last = id;
+}
+
+/**
+ * kt_style_table_get()
+ *
+ * Returns: The style of an ID, the default style for an unknown one.
+ */
+const KtStyle *kt_style_table_get(KtStyleTable *table, guint id)
+{
+        g_return_val_if_fail(table != NULL, NULL);
+
+        if (id >= table->size)
+                id = KT_STYLE_DEFAULT;
+
+        return &table->styles[id];
+}
+
+guint kt_style_table_get_size(KtStyleTable *table)
+{
+        g_return_val_if_fail(table != NULL, 0);
+
+        return table->size;
+}
+
+/* Bytes held by the table */
+gsize kt_style_table_get_memory(KtStyleTable *table)
+{
+        g_return_val_if_fail(table != NULL, 0);
+
+        return sizeof(KtStyleTable) + table->allocated * sizeof(KtStyle) +
+                (table->mask + 1) * sizeof(guint32);
+}
@@ -0,0 +1,71 @@
+/*
+ * kt-style.h
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KT_STYLE_H
+#define KT_STYLE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Attributes */
+#define KT_ATTR_BOLD (1 << 0)
+#define KT_ATTR_DIM (1 << 1)
+#define KT_ATTR_ITALIC (1 << 2)
+#define KT_ATTR_UNDERLINE (1 << 3)
+#define KT_ATTR_BLINK (1 << 4)
+#define KT_ATTR_REVERSE (1 << 5)
+#define KT_ATTR_INVISIBLE (1 << 6)
+#define KT_ATTR_STRIKE (1 << 7)
+
+/* How a cell is drawn. The colours are KT_CELL_COLOR_* values, an
+   underline colour of KT_CELL_COLOR_DEFAULT follows the foreground. The
+   all zero style is the default one. */
+typedef struct {
+        guint32 fg;
+        guint32 bg;
+        guint32 ul;
+        guint32 attrs;
+} KtStyle;
+
+/*
+  Styles interned to small IDs, so that cells only carry an ID. The
+  default style is always KT_STYLE_DEFAULT. A table holds up to
+  KT_STYLE_MAX styles and is never trimmed, its owner starts a new one
+  when it is full.
+ */
+#define KT_STYLE_DEFAULT 0
+#define KT_STYLE_MAX (1 << 18)
+#define KT_STYLE_NONE G_MAXUINT
+
+typedef struct _KtStyleTable KtStyleTable;
+
+KtStyleTable *kt_style_table_new(void);
+void kt_style_table_free(KtStyleTable *table);
+
+guint kt_style_table_intern(KtStyleTable *table, const KtStyle *style);
+const KtStyle *kt_style_table_get(KtStyleTable *table, guint id);
+guint kt_style_table_get_size(KtStyleTable *table);
+gsize kt_style_table_get_memory(KtStyleTable *table);
+
+G_END_DECLS
+#endif /* KT_STYLE_H */
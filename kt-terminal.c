@@ -22,12 +22,66 @@
 
 #include "kt-terminal.h"
 #include "kt-pty.h"
+#include "kt-pty-pool.h"
+#include "kt-ring.h"
+#include "kt-pty-reader.h"
+#include "kt-uring.h"
 
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/uio.h>
 
-#define BUF_SIZE 8192
+/*
+  The pty source runs at the same priority as the X connection watch so that
+  neither can starve the other. Every main loop iteration goes through
+  kt_poll(), which drains the X event queue, so keeping each pty dispatch
+  within a byte and time budget bounds the latency of X input while the
+  child is flooding the terminal.
+ */
+#define PTY_SOURCE_PRIORITY G_PRIORITY_DEFAULT
+
+/*
+  Input for the child is queued in fixed size chunks. Small writes issued
+  during the same main loop iteration (keystrokes) are coalesced into the
+  tail chunk and the queue is flushed with writev() once the master fd is
+  writable.
+ */
+#define WRITE_CHUNK_SIZE 4096
+#define WRITE_IOV_MAX 64
+/* Retry period when the io_uring submission queue had no room for a write */
+#define WRITE_RETRY_MSEC 1
+
+/*
+  Where the data is already in the ring (io_uring, reader thread) it is
+  handed out in slices of this size, so that the time budget is checked
+  between them.
+ */
+#define DISPATCH_SLICE (16 * 1024)
+
+/*
+  Data a sink left in the ring is offered again on the next main loop
+  iteration, or after this long if the sink took none of it.
+ */
+#define SINK_RETRY_MSEC 10
+
+/*
+  Every TIOCSWINSZ makes the child redraw everything, so while the window is
+  being dragged the size is only passed on once it has stopped changing for
+  this long (trailing edge).
+ */
+#define RESIZE_DEBOUNCE_MSEC 60
+
+typedef struct {
+        gsize start;
+        gsize end;
+        guint8 data[WRITE_CHUNK_SIZE];
+} WriteChunk;
+
+typedef struct {
+        GBytes *bytes;
+        gboolean paste; /* FALSE for a write queued behind a paste */
+} PasteChunk;
 
 enum {
         PROP_0,
@@ -38,6 +92,7 @@ enum {
 enum {
         SIGNAL_CHILD_EXITED,
         SIGNAL_GOT_TTY_DATA,
+        SIGNAL_WRITE_READY,
         SIGNAL_LAST
 };
 
@@ -47,6 +102,40 @@ struct _KtTerminalPrivate {
         GIOChannel *channel;
         guint io_event_source;
 
+        KtRing *ring; /* pty ingest buffer */
+        gboolean read_paused; /* pty not polled while the ring is full */
+        KtPtyReader *reader; /* Only set in threaded mode */
+        KtUring *uring; /* Only set with the io_uring backend */
+        KtTerminalStats stats;
+        gint64 create_time; /* Monotonic time of kt_terminal_new() */
+        gboolean pooled; /* The shell came from the pty pool */
+
+        /* Size */
+        gint rows;
+        gint cols;
+        gint pty_rows; /* Size last set on the pty */
+        gint pty_cols;
+        guint resize_source;
+        gint64 resize_start; /* First request of the current resize */
+        gboolean resize_settling; /* Waiting for the child to redraw */
+
+        /* Consumer of the pty output */
+        KtTerminalSink sink;
+        gpointer sink_data;
+        guint redispatch_source;
+
+        /* Input to the child */
+        GIOChannel *write_channel;
+        guint write_source;
+        GQueue write_queue; /* WriteChunks */
+        gsize write_queued; /* Bytes in write_queue */
+        GQueue paste_queue; /* PasteChunks waiting for room in write_queue */
+        gsize paste_offset;
+        gsize paste_writes; /* Bytes of writes in paste_queue */
+        gboolean write_blocked; /* A writer was turned away */
+        gboolean write_in_flight; /* io_uring write submitted */
+        struct iovec write_iov[WRITE_IOV_MAX];
+
         GPid child_pid;
         guint child_watch_source;
 
@@ -64,14 +153,31 @@ static GParamSpec *param_specs[PROP_LAST] = {NULL, };
 static void terminal_set_size(KtTerminal *term)
 {
         KtTerminalPrivate *priv = term->priv;
-        gint rows, cols;
 
-        rows = priv->prefs->rows;
-        cols = priv->prefs->cols;
+        if (priv->rows == priv->pty_rows && priv->cols == priv->pty_cols)
+                return;
 
-        if (!kt_pty_set_size(priv->pty, rows, cols)) {
+        if (!kt_pty_set_size(priv->pty, priv->rows, priv->cols)) {
                 error("Could not set pty size.");
+                return;
         }
+
+        priv->pty_rows = priv->rows;
+        priv->pty_cols = priv->cols;
+        priv->stats.resizes++;
+}
+
+static gboolean resize_timeout_cb(KtTerminal *term)
+{
+        KtTerminalPrivate *priv = term->priv;
+
+        priv->resize_source = 0;
+        terminal_set_size(term);
+
+        /* The resize is over once the child has redrawn */
+        priv->resize_settling = TRUE;
+
+        return G_SOURCE_REMOVE;
 }
 
 static void input_event_source_destroy(KtTerminal *term)
@@ -79,40 +185,215 @@ static void input_event_source_destroy(KtTerminal *term)
         term->priv->io_event_source = 0;
 }
 
+/**
+ * terminal_dispatch: Hand the data sitting in the ring to the listeners,
+ * in place. The registered sink gets the data directly, "got-tty-data" is
+ * only emitted when there is no sink.
+ *
+ * Returns: The number of bytes consumed, at most max.
+ */
+static gsize terminal_dispatch(KtTerminal *term, gsize max)
+{
+        KtTerminalPrivate *priv = term->priv;
+        const guint8 *data;
+        gsize length;
+        gsize done = 0;
+
+        while (done < max &&
+               (data = kt_ring_read_ptr(priv->ring, &length)) && length) {
+                gsize consumed;
+
+                length = MIN(length, max - done);
+
+                if (priv->sink.data) {
+                        consumed = priv->sink.data(term, data, length,
+                                                   priv->sink_data);
+                } else {
+                        KtBuffer *buffer = kt_buffer_new(data, length);
+
+                        g_signal_emit(term, signals[SIGNAL_GOT_TTY_DATA],
+                                      0, buffer);
+                        kt_buffer_free(buffer);
+                        consumed = length;
+                }
+
+                kt_ring_consume(priv->ring, consumed);
+                priv->stats.bytes_dispatched += consumed;
+                done += consumed;
+
+                /* The sink wants the rest offered again later */
+                if (consumed < length)
+                        break;
+        }
+
+        if (done && priv->resize_settling) {
+                priv->resize_settling = FALSE;
+                priv->stats.resize_usec = g_get_monotonic_time() -
+                        priv->resize_start;
+                debug("Resize to %dx%d settled after %" G_GINT64_FORMAT
+                      " usec.", priv->cols, priv->rows,
+                      priv->stats.resize_usec);
+        }
+
+        if (done && priv->stats.first_output_usec == 0) {
+                priv->stats.first_output_usec =
+                        MAX(g_get_monotonic_time() - priv->create_time, 1);
+                debug("First output %" G_GINT64_FORMAT " usec after creation"
+                      " (%s shell).", priv->stats.first_output_usec,
+                      priv->pooled ? "pooled" : "fresh");
+        }
+
+        return done;
+}
+
+static gboolean io_read_cb(GIOChannel *channel,
+                           GIOCondition cond,
+                           KtTerminal *term);
+
+static void terminal_watch_pty(KtTerminal *term, GIOFunc read_cb)
+{
+        KtTerminalPrivate *priv = term->priv;
+
+        if (priv->io_event_source != 0)
+                return;
+
+        priv->io_event_source = g_io_add_watch_full(priv->channel,
+                                                    PTY_SOURCE_PRIORITY,
+                                                    G_IO_IN | G_IO_HUP,
+                                                    read_cb,
+                                                    term,
+                                                    (GDestroyNotify)input_event_source_destroy);
+}
+
+static void terminal_redispatch(KtTerminal *term, gboolean stalled);
+
+/* Offer the data left in the ring to the sink again. */
+static gboolean redispatch_cb(KtTerminal *term)
+{
+        KtTerminalPrivate *priv = term->priv;
+        gsize done;
+
+        priv->redispatch_source = 0;
+
+        /* The other backends dispatch from their wakeup callbacks */
+        if (priv->uring) {
+                kt_uring_poke(priv->uring);
+                return G_SOURCE_REMOVE;
+        }
+
+        if (priv->reader) {
+                kt_pty_reader_poke(priv->reader);
+                return G_SOURCE_REMOVE;
+        }
+
+        done = terminal_dispatch(term, priv->prefs->read_budget_bytes ?
+                                 priv->prefs->read_budget_bytes : G_MAXSIZE);
+
+        if (priv->read_paused &&
+            kt_ring_get_fill(priv->ring) < kt_ring_get_size(priv->ring)) {
+                priv->read_paused = FALSE;
+                terminal_watch_pty(term, (GIOFunc)io_read_cb);
+        }
+
+        if (kt_ring_get_fill(priv->ring) > 0)
+                terminal_redispatch(term, done == 0);
+
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * terminal_redispatch: The sink left data in the ring, make sure it is
+ * offered again even if the pty stays quiet. A sink that took none of it
+ * is given SINK_RETRY_MSEC rather than being spun on.
+ */
+static void terminal_redispatch(KtTerminal *term, gboolean stalled)
+{
+        KtTerminalPrivate *priv = term->priv;
+
+        if (priv->redispatch_source != 0)
+                return;
+
+        if (stalled) {
+                priv->redispatch_source = g_timeout_add_full(PTY_SOURCE_PRIORITY,
+                                                             SINK_RETRY_MSEC,
+                                                             (GSourceFunc)redispatch_cb,
+                                                             term,
+                                                             NULL);
+        } else if (priv->uring) {
+                kt_uring_poke(priv->uring);
+        } else if (priv->reader) {
+                kt_pty_reader_poke(priv->reader);
+        } else {
+                priv->redispatch_source = g_idle_add_full(PTY_SOURCE_PRIORITY,
+                                                          (GSourceFunc)redispatch_cb,
+                                                          term,
+                                                          NULL);
+        }
+}
+
 static gboolean io_read_cb(GIOChannel *channel,
                            GIOCondition cond,
                            KtTerminal *term)
 {
+        KtTerminalPrivate *priv = term->priv;
         int err = 0;
         gboolean eof = FALSE;
+        gsize done = 0;
 
-        if (cond & G_IO_IN) {
-                guint32 data[BUF_SIZE];
+        priv->stats.wakeups++;
+
+        if (cond & (G_IO_IN | G_IO_HUP)) {
                 int fd = g_io_channel_unix_get_fd(channel);
+                gint64 deadline;
+                gsize budget;
 
-                memset(&data, 0, BUF_SIZE);
+                /* A budget of 0 means no limit */
+                budget = priv->prefs->read_budget_bytes ?
+                        priv->prefs->read_budget_bytes : G_MAXSIZE;
+                deadline = priv->prefs->read_budget_usec ?
+                        g_get_monotonic_time() + priv->prefs->read_budget_usec :
+                        G_MAXINT64;
 
                 do {
-                        int ret;
+                        guint8 *data;
+                        gsize avail;
+                        ssize_t ret;
+
+                        data = kt_ring_write_ptr(priv->ring, &avail);
+                        if (avail == 0) {
+                                /* Make room before reading any further */
+                                terminal_dispatch(term, G_MAXSIZE);
+                                data = kt_ring_write_ptr(priv->ring, &avail);
+                                if (avail == 0)
+                                        break;
+                        }
+
+                        ret = read(fd, data, MIN(avail, budget));
+                        priv->stats.read_calls++;
 
-                        ret = read(fd, data, BUF_SIZE - 1);
                         if (ret == -1) {
                                 err = errno;
                                 break;
                         } else if (ret == 0) {
                                 eof = TRUE;
                                 break;
-                        } else {
-                                KtBuffer *buffer = kt_buffer_new(data, ret);
-                                g_signal_emit(term,
-                                              signals[SIGNAL_GOT_TTY_DATA],
-                                              0,
-                                              buffer);
-                                kt_buffer_free(buffer);
                         }
 
+                        kt_ring_commit(priv->ring, ret);
+                        priv->stats.bytes_read += ret;
 
+                        /* Leave the rest for the next iteration, the fd
+                           stays readable so the source fires again right
+                           after the X events have been handled. */
+                        budget -= ret;
+                        if (budget == 0 ||
+                            g_get_monotonic_time() >= deadline) {
+                                priv->stats.budget_hits++;
+                                break;
+                        }
                 } while(1);
+
+                done = terminal_dispatch(term, G_MAXSIZE);
         }
 
         switch (err) {
@@ -125,10 +406,22 @@ static gboolean io_read_cb(GIOChannel *channel,
         case EBUSY:
                 break;
         default:
-                warn("error reading from child.", g_strerror(err));
+                warn("error reading from child: %s.", g_strerror(err));
                 break;
         }
 
+        if (kt_ring_get_fill(priv->ring) > 0) {
+                /* The sink left some behind, the pty may well stay quiet */
+                terminal_redispatch(term, done == 0);
+
+                /* Nothing more can be read until the sink makes room */
+                if (!eof && kt_ring_get_fill(priv->ring) ==
+                    kt_ring_get_size(priv->ring)) {
+                        priv->read_paused = TRUE;
+                        return FALSE;
+                }
+        }
+
         if (eof) {
                 /* FIXME: Need to signal eof here. */
                 return FALSE;
@@ -137,16 +430,402 @@ static gboolean io_read_cb(GIOChannel *channel,
         return TRUE;
 }
 
+/* Threaded mode: drain what the reader thread has put in the ring. */
+static gboolean reader_wakeup_cb(GIOChannel *channel,
+                                 GIOCondition cond,
+                                 KtTerminal *term)
+{
+        KtTerminalPrivate *priv = term->priv;
+        gint64 deadline;
+        gsize budget;
+        gint err = 0;
+
+        priv->stats.wakeups++;
+
+        kt_pty_reader_ack(priv->reader);
+
+        budget = priv->prefs->read_budget_bytes ?
+                priv->prefs->read_budget_bytes : G_MAXSIZE;
+        deadline = priv->prefs->read_budget_usec ?
+                g_get_monotonic_time() + priv->prefs->read_budget_usec :
+                G_MAXINT64;
+
+        do {
+                gsize done;
+
+                done = terminal_dispatch(term, MIN(budget, DISPATCH_SLICE));
+                kt_pty_reader_consumed(priv->reader);
+                budget -= done;
+
+                if (kt_ring_get_fill(priv->ring) == 0) {
+                        if (kt_pty_reader_rearm(priv->reader))
+                                break;
+                        continue;
+                }
+
+                if (budget == 0 || done == 0 ||
+                    g_get_monotonic_time() >= deadline) {
+                        /* No wakeup is armed, schedule one ourselves */
+                        if (done)
+                                priv->stats.budget_hits++;
+                        terminal_redispatch(term, done == 0);
+                        break;
+                }
+        } while (1);
+
+        if (kt_pty_reader_is_eof(priv->reader, &err) &&
+            kt_ring_get_fill(priv->ring) == 0) {
+                if (err)
+                        warn("error reading from child: %s.", g_strerror(err));
+                /* FIXME: Need to signal eof here. */
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/* io_uring backend: a read (or write) completed. */
+static gboolean uring_wakeup_cb(GIOChannel *channel,
+                                GIOCondition cond,
+                                KtTerminal *term)
+{
+        KtTerminalPrivate *priv = term->priv;
+        gsize bytes_read = 0;
+        gboolean alive;
+        gint64 deadline;
+        gsize budget;
+        gint err = 0;
+
+        priv->stats.wakeups++;
+
+        alive = kt_uring_reap(priv->uring, &bytes_read, &err);
+        if (bytes_read) {
+                priv->stats.read_calls++;
+                priv->stats.bytes_read += bytes_read;
+        }
+
+        budget = priv->prefs->read_budget_bytes ?
+                priv->prefs->read_budget_bytes : G_MAXSIZE;
+        deadline = priv->prefs->read_budget_usec ?
+                g_get_monotonic_time() + priv->prefs->read_budget_usec :
+                G_MAXINT64;
+
+        do {
+                gsize done;
+
+                done = terminal_dispatch(term, MIN(budget, DISPATCH_SLICE));
+                budget -= done;
+
+                if (kt_ring_get_fill(priv->ring) == 0)
+                        break;
+
+                if (budget == 0 || done == 0 ||
+                    g_get_monotonic_time() >= deadline) {
+                        /* Come back for the rest later */
+                        if (done)
+                                priv->stats.budget_hits++;
+                        terminal_redispatch(term, done == 0);
+                        break;
+                }
+        } while (1);
+
+        /* The next read goes out together with any queued writes */
+        kt_uring_arm_read(priv->uring);
+        kt_uring_submit(priv->uring);
+
+        if (!alive && kt_ring_get_fill(priv->ring) == 0) {
+                if (err)
+                        warn("error reading from child: %s.", g_strerror(err));
+                /* FIXME: Need to signal eof here. */
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/**
+ * write_queue_append: Queue data for the child, without going over limit.
+ *
+ * Returns: The number of bytes queued.
+ */
+static gsize write_queue_append(KtTerminal *term,
+                                const guint8 *data,
+                                gsize length,
+                                gsize limit)
+{
+        KtTerminalPrivate *priv = term->priv;
+        gsize done = 0;
+
+        if (priv->write_queued >= limit)
+                return 0;
+
+        length = MIN(length, limit - priv->write_queued);
+
+        while (done < length) {
+                WriteChunk *chunk = g_queue_peek_tail(&priv->write_queue);
+                gsize n;
+
+                if (chunk == NULL || chunk->end == WRITE_CHUNK_SIZE) {
+                        chunk = g_new(WriteChunk, 1);
+                        chunk->start = chunk->end = 0;
+                        g_queue_push_tail(&priv->write_queue, chunk);
+                }
+
+                n = MIN(length - done, WRITE_CHUNK_SIZE - chunk->end);
+                memcpy(chunk->data + chunk->end, data + done, n);
+                chunk->end += n;
+                done += n;
+        }
+
+        priv->write_queued += done;
+
+        return done;
+}
+
+static void write_queue_advance(KtTerminal *term, gsize length)
+{
+        KtTerminalPrivate *priv = term->priv;
+
+        priv->write_queued -= length;
+
+        while (length) {
+                WriteChunk *chunk = g_queue_peek_head(&priv->write_queue);
+                gsize n = MIN(length, chunk->end - chunk->start);
+
+                chunk->start += n;
+                length -= n;
+
+                if (chunk->start == chunk->end)
+                        g_free(g_queue_pop_head(&priv->write_queue));
+        }
+}
+
+static void paste_chunk_free(PasteChunk *chunk)
+{
+        g_bytes_unref(chunk->bytes);
+        g_free(chunk);
+}
+
+static void write_queue_clear(KtTerminal *term)
+{
+        KtTerminalPrivate *priv = term->priv;
+
+        g_queue_clear_full(&priv->write_queue, g_free);
+        g_queue_clear_full(&priv->paste_queue, (GDestroyNotify)paste_chunk_free);
+        priv->write_queued = 0;
+        priv->paste_offset = 0;
+        priv->paste_writes = 0;
+}
+
+static gint write_queue_fill_iov(KtTerminal *term)
+{
+        KtTerminalPrivate *priv = term->priv;
+        GList *l;
+        gint n = 0;
+
+        for (l = priv->write_queue.head; l && n < WRITE_IOV_MAX; l = l->next) {
+                WriteChunk *chunk = l->data;
+
+                priv->write_iov[n].iov_base = chunk->data + chunk->start;
+                priv->write_iov[n].iov_len = chunk->end - chunk->start;
+                n++;
+        }
+
+        return n;
+}
+
+static void paste_queue_push(KtTerminal *term,
+                             const gchar *data,
+                             gsize length,
+                             gboolean paste)
+{
+        KtTerminalPrivate *priv = term->priv;
+        PasteChunk *chunk;
+
+        chunk = g_new(PasteChunk, 1);
+        chunk->bytes = g_bytes_new(data, length);
+        chunk->paste = paste;
+        g_queue_push_tail(&priv->paste_queue, chunk);
+
+        if (!paste)
+                priv->paste_writes += length;
+}
+
+/* Move pasted data into the write queue as room frees up. */
+static void write_queue_refill(KtTerminal *term)
+{
+        KtTerminalPrivate *priv = term->priv;
+        PasteChunk *chunk;
+
+        while ((chunk = g_queue_peek_head(&priv->paste_queue))) {
+                const guint8 *data;
+                gsize length;
+                gsize n;
+
+                data = g_bytes_get_data(chunk->bytes, &length);
+                n = write_queue_append(term,
+                                       data + priv->paste_offset,
+                                       length - priv->paste_offset,
+                                       priv->prefs->write_queue_size);
+                priv->paste_offset += n;
+                if (!chunk->paste)
+                        priv->paste_writes -= n;
+
+                if (priv->paste_offset < length)
+                        break;
+
+                paste_chunk_free(g_queue_pop_head(&priv->paste_queue));
+                priv->paste_offset = 0;
+        }
+}
+
+/*
+  Whether a writer that was turned away can come back. Behind a paste,
+  only what the writers queued there counts.
+ */
+static gboolean write_queue_drained(KtTerminal *term)
+{
+        KtTerminalPrivate *priv = term->priv;
+        gsize half = priv->prefs->write_queue_size / 2;
+
+        if (!g_queue_is_empty(&priv->paste_queue))
+                return priv->paste_writes <= half;
+
+        return priv->write_queued <= half;
+}
+
+static void terminal_schedule_write(KtTerminal *term);
+
+/* Bookkeeping after some of the queue went out to the child. */
+static void terminal_wrote(KtTerminal *term, gsize length)
+{
+        KtTerminalPrivate *priv = term->priv;
+
+        write_queue_advance(term, length);
+        priv->stats.bytes_written += length;
+
+        write_queue_refill(term);
+
+        if (priv->write_blocked && write_queue_drained(term)) {
+                priv->write_blocked = FALSE;
+                g_signal_emit(term, signals[SIGNAL_WRITE_READY], 0);
+        }
+}
+
+static void write_source_destroy(KtTerminal *term)
+{
+        term->priv->write_source = 0;
+}
+
+/* The io_uring submission queue has room again, hopefully. */
+static gboolean write_retry_cb(KtTerminal *term)
+{
+        term->priv->write_source = 0;
+        terminal_schedule_write(term);
+
+        return G_SOURCE_REMOVE;
+}
+
+static gboolean io_write_cb(GIOChannel *channel,
+                            GIOCondition cond,
+                            KtTerminal *term)
+{
+        KtTerminalPrivate *priv = term->priv;
+        gint fd = g_io_channel_unix_get_fd(channel);
+
+        while (priv->write_queued) {
+                ssize_t ret;
+
+                ret = writev(fd, priv->write_iov, write_queue_fill_iov(term));
+                priv->stats.write_calls++;
+
+                if (ret == -1) {
+                        if (errno == EINTR)
+                                continue;
+                        if (errno == EAGAIN)
+                                return TRUE; /* pty input buffer is full */
+
+                        warn("error writing to child: %s.", g_strerror(errno));
+                        write_queue_clear(term);
+                        break;
+                }
+
+                terminal_wrote(term, ret);
+        }
+
+        return FALSE;
+}
+
+static void uring_write_done(gssize result, KtTerminal *term)
+{
+        KtTerminalPrivate *priv = term->priv;
+
+        priv->write_in_flight = FALSE;
+
+        if (result > 0) {
+                terminal_wrote(term, result);
+        } else if (result != -EAGAIN && result != -EINTR) {
+                warn("error writing to child: %s.", g_strerror(-result));
+                write_queue_clear(term);
+        }
+
+        terminal_schedule_write(term);
+}
+
+/* Arrange for the write queue to be flushed, unless that is pending. */
+static void terminal_schedule_write(KtTerminal *term)
+{
+        KtTerminalPrivate *priv = term->priv;
+
+        if (priv->write_queued == 0)
+                return;
+
+        if (priv->uring) {
+                if (priv->write_in_flight || priv->write_source != 0)
+                        return;
+
+                priv->write_in_flight =
+                        kt_uring_queue_writev(priv->uring,
+                                              priv->write_iov,
+                                              write_queue_fill_iov(term),
+                                              (KtUringWriteFunc)uring_write_done,
+                                              term);
+                if (priv->write_in_flight) {
+                        priv->stats.write_calls++;
+                        return;
+                }
+
+                /* io_uring left the master fd blocking, a writev() from
+                   the G_IO_OUT watch could stall the main loop. */
+                priv->write_source = g_timeout_add_full(PTY_SOURCE_PRIORITY,
+                                                        WRITE_RETRY_MSEC,
+                                                        (GSourceFunc)write_retry_cb,
+                                                        term,
+                                                        NULL);
+                return;
+        }
+
+        /* The watch only exists while there is something to write */
+        if (priv->write_source == 0) {
+                priv->write_source = g_io_add_watch_full(priv->write_channel,
+                                                         PTY_SOURCE_PRIORITY,
+                                                         G_IO_OUT,
+                                                         (GIOFunc)io_write_cb,
+                                                         term,
+                                                         (GDestroyNotify)write_source_destroy);
+        }
+}
+
 static void terminal_setup_pty(KtTerminal *term)
 {
         KtTerminalPrivate *priv = term->priv;
+        GIOFunc read_cb;
         gint mfd;
         long flags;
 
         mfd = kt_pty_get_fd(priv->pty);
 
-        priv->channel = g_io_channel_unix_new(mfd);
-        g_io_channel_set_close_on_unref(priv->channel, FALSE);
+        priv->ring = kt_ring_new(priv->prefs->ring_size);
 
         flags = fcntl(mfd, F_GETFL);
         if ((flags & O_NONBLOCK) == 0)
@@ -154,14 +833,36 @@ static void terminal_setup_pty(KtTerminal *term)
 
         terminal_set_size(term);
 
-        if (priv->io_event_source == 0) {
-                priv->io_event_source = g_io_add_watch_full(priv->channel,
-                                                            G_PRIORITY_DEFAULT_IDLE,
-                                                            G_IO_IN | G_IO_HUP,
-                                                            (GIOFunc) io_read_cb,
-                                                            term,
-                                                            (GDestroyNotify)input_event_source_destroy);
+        if (priv->prefs->io_uring) {
+                priv->uring = kt_uring_new(mfd, priv->ring);
+                if (priv->uring == NULL)
+                        warn("Falling back to polling the pty.");
+        }
+
+        if (priv->prefs->threaded_reader && priv->uring == NULL) {
+                priv->reader = kt_pty_reader_new(mfd, priv->ring);
+                if (priv->reader == NULL)
+                        warn("Falling back to reading the pty in the main loop.");
         }
+
+        if (priv->uring) {
+                priv->channel =
+                        g_io_channel_unix_new(kt_uring_get_event_fd(priv->uring));
+                read_cb = (GIOFunc)uring_wakeup_cb;
+        } else if (priv->reader) {
+                priv->channel =
+                        g_io_channel_unix_new(kt_pty_reader_get_wakeup_fd(priv->reader));
+                read_cb = (GIOFunc)reader_wakeup_cb;
+        } else {
+                priv->channel = g_io_channel_unix_new(mfd);
+                read_cb = (GIOFunc)io_read_cb;
+        }
+        g_io_channel_set_close_on_unref(priv->channel, FALSE);
+
+        priv->write_channel = g_io_channel_unix_new(mfd);
+        g_io_channel_set_close_on_unref(priv->write_channel, FALSE);
+
+        terminal_watch_pty(term, read_cb);
 }
 
 static void terminal_emit_child_exited(KtTerminal *term, int status)
@@ -260,9 +961,42 @@ static void kt_terminal_finalize(GObject *object)
                 priv->child_watch_source = 0;
         }
 
+        if (priv->io_event_source != 0)
+                g_source_remove(priv->io_event_source);
+
+        if (priv->resize_source != 0)
+                g_source_remove(priv->resize_source);
+
+        if (priv->redispatch_source != 0)
+                g_source_remove(priv->redispatch_source);
+
+        if (priv->uring)
+                priv->stats.submit_calls = kt_uring_get_enter_calls(priv->uring);
+
+        debug("pty read budget was exhausted %" G_GUINT64_FORMAT
+              " times in %" G_GUINT64_FORMAT " wakeups.",
+              priv->stats.budget_hits, priv->stats.wakeups);
+        debug("pty: %" G_GUINT64_FORMAT " bytes in %" G_GUINT64_FORMAT
+              " syscalls (%s).", priv->stats.bytes_read,
+              priv->stats.read_calls + priv->stats.submit_calls +
+              priv->stats.wakeups,
+              priv->uring ? "io_uring" : priv->reader ? "thread" : "poll");
+
+        if (priv->write_source != 0)
+                g_source_remove(priv->write_source);
+
+        kt_pty_reader_free(priv->reader);
+        kt_uring_free(priv->uring);
+
+        write_queue_clear(term);
+        if (priv->write_channel)
+                g_io_channel_unref(priv->write_channel);
+
         if (priv->channel)
                 g_io_channel_unref(priv->channel);
 
+        kt_ring_free(priv->ring);
+
         if (priv->pty)
                 g_object_unref(priv->pty);
 
@@ -321,6 +1055,22 @@ static void kt_terminal_class_init(KtTerminalClass *klass)
                              G_TYPE_NONE,
                              1,
                              KT_TYPE_BUFFER | G_SIGNAL_TYPE_STATIC_SCOPE);
+
+        /**
+           "write-ready" signal.
+           Emitted once the write queue has drained after a writer was
+           turned away because it was full.
+         */
+        signals[SIGNAL_WRITE_READY] =
+                g_signal_new("write-ready",
+                             G_TYPE_FROM_CLASS(klass),
+                             G_SIGNAL_RUN_LAST,
+                             G_STRUCT_OFFSET(KtTerminalClass, write_ready),
+                             NULL,
+                             NULL,
+                             g_cclosure_marshal_VOID__VOID,
+                             G_TYPE_NONE,
+                             0);
 }
 
 static void kt_terminal_init(KtTerminal *term)
@@ -333,6 +1083,25 @@ static void kt_terminal_init(KtTerminal *term)
         priv->pty = NULL;
         priv->io_event_source = 0;
         priv->channel = NULL;
+        priv->ring = NULL;
+        priv->read_paused = FALSE;
+        priv->reader = NULL;
+        priv->uring = NULL;
+        priv->write_channel = NULL;
+        priv->write_source = 0;
+        g_queue_init(&priv->write_queue);
+        g_queue_init(&priv->paste_queue);
+        priv->write_queued = 0;
+        priv->paste_offset = 0;
+        priv->paste_writes = 0;
+        priv->write_blocked = FALSE;
+        priv->write_in_flight = FALSE;
+        MEMSET(&priv->sink, 1);
+        priv->sink_data = NULL;
+        priv->redispatch_source = 0;
+        MEMSET(&priv->stats, 1);
+        priv->resize_source = 0;
+        priv->resize_settling = FALSE;
 }
 
 /* Public methods */
@@ -348,6 +1117,18 @@ KtTerminal *kt_terminal_new(KtPrefs *prefs, xcb_window_t wid)
                                 NULL);
 
         priv = terminal->priv;
+        priv->create_time = g_get_monotonic_time();
+        priv->rows = prefs->rows;
+        priv->cols = prefs->cols;
+
+        /* Take a warm shell from the pool if there is one */
+        if (kt_pty_pool_get_default())
+                priv->pty = kt_pty_pool_acquire(kt_pty_pool_get_default());
+
+        if (priv->pty) {
+                priv->pooled = TRUE;
+                goto setup;
+        }
 
         /* Create new pseudo terminal */
         priv->pty = kt_pty_new(prefs, wid);
@@ -362,6 +1143,8 @@ KtTerminal *kt_terminal_new(KtPrefs *prefs, xcb_window_t wid)
                 goto failed;
         }
 
+setup:
+
         /* Setup the pty */
         terminal_setup_pty(terminal);
 
@@ -375,3 +1158,142 @@ failed:
         g_object_unref(terminal);
         return NULL;
 }
+
+/**
+ * kt_terminal_get_stats: Copy the pty i/o counters of the terminal.
+ */
+void kt_terminal_get_stats(KtTerminal *term, KtTerminalStats *stats)
+{
+        g_return_if_fail(KT_IS_TERMINAL(term));
+        g_return_if_fail(stats != NULL);
+
+        *stats = term->priv->stats;
+
+        if (term->priv->reader)
+                kt_pty_reader_get_counters(term->priv->reader,
+                                           &stats->bytes_read,
+                                           &stats->read_calls);
+
+        if (term->priv->uring)
+                stats->submit_calls = kt_uring_get_enter_calls(term->priv->uring);
+}
+
+/**
+ * kt_terminal_write: Queue input for the child. Nothing is written right
+ * away, so writes made during the same main loop iteration go out together.
+ *
+ * While a paste is going out, the data is queued behind it instead, and
+ * the limit applies to what was written there.
+ *
+ * Returns: The number of bytes queued. If that is less than length the
+ * queue is full and "write-ready" is emitted once it has drained.
+ */
+gsize kt_terminal_write(KtTerminal *term, const gchar *data, gsize length)
+{
+        KtTerminalPrivate *priv;
+        gsize limit;
+        gsize done;
+
+        g_return_val_if_fail(KT_IS_TERMINAL(term), 0);
+
+        priv = term->priv;
+        limit = priv->prefs->write_queue_size;
+
+        if (!g_queue_is_empty(&priv->paste_queue)) {
+                /* Keep the order when a paste is still going out */
+                done = priv->paste_writes < limit ?
+                        MIN(length, limit - priv->paste_writes) : 0;
+                if (done)
+                        paste_queue_push(term, data, done, FALSE);
+        } else {
+                done = write_queue_append(term, (const guint8 *)data, length,
+                                          limit);
+        }
+
+        if (done < length)
+                priv->write_blocked = TRUE;
+
+        terminal_schedule_write(term);
+
+        return done;
+}
+
+/**
+ * kt_terminal_paste: Queue a paste for the child. Unlike
+ * kt_terminal_write(), all of the data is accepted; it is fed to the write
+ * queue as the child consumes its input.
+ */
+void kt_terminal_paste(KtTerminal *term, const gchar *data, gsize length)
+{
+        g_return_if_fail(KT_IS_TERMINAL(term));
+
+        if (length == 0)
+                return;
+
+        paste_queue_push(term, data, length, TRUE);
+        write_queue_refill(term);
+
+        terminal_schedule_write(term);
+}
+
+/**
+ * kt_terminal_set_size: Resize the terminal. The pty follows once the size
+ * has been stable for RESIZE_DEBOUNCE_MSEC, so calling this for every step
+ * of an interactive resize is cheap.
+ */
+void kt_terminal_set_size(KtTerminal *term, gint rows, gint cols)
+{
+        KtTerminalPrivate *priv;
+
+        g_return_if_fail(KT_IS_TERMINAL(term));
+
+        priv = term->priv;
+
+        if (rows == priv->rows && cols == priv->cols)
+                return;
+
+        priv->rows = rows;
+        priv->cols = cols;
+
+        if (priv->resize_source != 0)
+                g_source_remove(priv->resize_source);
+        else if (!priv->resize_settling)
+                priv->resize_start = g_get_monotonic_time();
+
+        priv->resize_settling = FALSE;
+        priv->resize_source = g_timeout_add(RESIZE_DEBOUNCE_MSEC,
+                                            (GSourceFunc)resize_timeout_cb,
+                                            term);
+}
+
+/**
+ * kt_terminal_set_sink: Register the consumer of the pty output.
+ *
+ * The sink is called with contiguous spans of the output as they come in,
+ * straight from the ingest ring, and returns how much of it it consumed.
+ * Whatever it leaves is offered again on the next main loop iteration, or
+ * SINK_RETRY_MSEC later if it took nothing; meanwhile the pty is not read
+ * past what the ring holds. Pass NULL to go back to emitting
+ * "got-tty-data".
+ */
+void kt_terminal_set_sink(KtTerminal *term,
+                          const KtTerminalSink *sink,
+                          gpointer user_data)
+{
+        KtTerminalPrivate *priv;
+
+        g_return_if_fail(KT_IS_TERMINAL(term));
+
+        priv = term->priv;
+
+        if (sink)
+                priv->sink = *sink;
+        else
+                MEMSET(&priv->sink, 1);
+
+        priv->sink_data = user_data;
+
+        /* The new consumer may take what the old one left */
+        if (priv->ring && kt_ring_get_fill(priv->ring) > 0)
+                terminal_redispatch(term, FALSE);
+}
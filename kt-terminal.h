@@ -42,6 +42,38 @@ typedef struct _KtTerminalPrivate KtTerminalPrivate;
 #define KT_IS_TERMINAL_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass), KT_TERMINAL_TYPE))
 #define KT_TERMINAL_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS((obj), KT_TERMINAL_TYPE, KtTerminalClass))
 
+/*
+  Counters for measuring the pty throughput. Every wakeup costs a poll (and
+  with io_uring an eventfd read), so the number of syscalls spent on the
+  pty is about read_calls + submit_calls + wakeups for any backend.
+ */
+typedef struct {
+        guint64 bytes_read; /* Bytes read from the pty */
+        guint64 bytes_dispatched; /* Bytes handed to the listeners */
+        guint64 read_calls; /* Reads of the master fd */
+        guint64 submit_calls; /* io_uring_enter() calls */
+        guint64 wakeups; /* Dispatches of the pty source */
+        guint64 budget_hits; /* Dispatches cut short by the read budget */
+        guint64 bytes_written; /* Bytes written to the pty */
+        guint64 write_calls; /* writev() calls or io_uring writes */
+        gint64 first_output_usec; /* From creation to the first output */
+        guint64 resizes; /* Sizes passed on to the pty */
+        gint64 resize_usec; /* From the last resize to the child's redraw */
+} KtTerminalStats;
+
+/*
+  Direct consumer of the pty output. This is the hot path: no signal
+  emission or allocation per chunk, "got-tty-data" is only emitted when no
+  sink is registered.
+ */
+typedef struct {
+        /* Returns the number of bytes consumed */
+        gsize (*data)(KtTerminal *term,
+                      const guint8 *data,
+                      gsize length,
+                      gpointer user_data);
+} KtTerminalSink;
+
 struct _KtTerminal {
         GObject parent_instance;
 
@@ -57,11 +89,20 @@ struct _KtTerminalClass {
         void (*paste)(KtTerminal *terminal);
         void (*child_exited)(KtTerminal *terminal, int status);
         void (*got_tty_data)(KtTerminal *terminal, KtBuffer *buffer);
+        void (*write_ready)(KtTerminal *terminal);
 };
 
 GType kt_terminal_get_type(void);
 KtTerminal *kt_terminal_new(KtPrefs *prefs, xcb_window_t wid);
 
+void kt_terminal_get_stats(KtTerminal *term, KtTerminalStats *stats);
+gsize kt_terminal_write(KtTerminal *term, const gchar *data, gsize length);
+void kt_terminal_paste(KtTerminal *term, const gchar *data, gsize length);
+void kt_terminal_set_size(KtTerminal *term, gint rows, gint cols);
+void kt_terminal_set_sink(KtTerminal *term,
+                          const KtTerminalSink *sink,
+                          gpointer user_data);
+
 G_END_DECLS
 
 #endif /* KT_TERMINAL_H */
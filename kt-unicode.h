@@ -0,0 +1,111 @@
+/*
+ * kt-unicode.h
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef KT_UNICODE_H
+#define KT_UNICODE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+  One property byte per code point: the column width (0, 1 or 2) in the
+  low bits, then the grapheme cluster break class and whether the code
+  point is Extended_Pictographic. Controls, format characters, marks and
+  Hangul medial and final jamo are zero wide; East Asian Wide and
+  Fullwidth code points, and regional indicators so that a flag takes two
+  columns, are double wide.
+ */
+#define KT_UNICODE_WIDTH_MASK 0x03
+#define KT_UNICODE_GCB_SHIFT 2
+#define KT_UNICODE_GCB_MASK (0x0f << KT_UNICODE_GCB_SHIFT)
+#define KT_UNICODE_PICTOGRAPHIC (1 << 6)
+
+/* Grapheme_Cluster_Break values, UAX #29 */
+typedef enum {
+        KT_GCB_OTHER,
+        KT_GCB_CR,
+        KT_GCB_LF,
+        KT_GCB_CONTROL,
+        KT_GCB_EXTEND,
+        KT_GCB_ZWJ,
+        KT_GCB_REGIONAL_INDICATOR,
+        KT_GCB_PREPEND,
+        KT_GCB_SPACING_MARK,
+        KT_GCB_L,
+        KT_GCB_V,
+        KT_GCB_T,
+        KT_GCB_LV,
+        KT_GCB_LVT,
+} KtGraphemeBreak;
+
+/* gen-unicode only needs the layout above */
+#ifndef KT_UNICODE_GEN
+
+/*
+  Generated from the files in unicode/ by gen-unicode: KT_UNICODE_VERSION,
+  KT_UNICODE_SHIFT, KT_UNICODE_BLOCKS and the two stages, a block index
+  per 1 << KT_UNICODE_SHIFT code points and the KT_UNICODE_BLOCKS
+  distinct blocks.
+ */
+#include "kt-unicode-table.h"
+
+extern const KtUnicodeIndex kt_unicode_stage1[];
+extern const guint8 kt_unicode_stage2[];
+
+static inline guint kt_unicode_props(gunichar c)
+{
+        if (c > 0x10ffff)
+                return 1;
+
+        return kt_unicode_stage2[(kt_unicode_stage1[c >> KT_UNICODE_SHIFT] <<
+                                  KT_UNICODE_SHIFT) +
+                                 (c & ((1 << KT_UNICODE_SHIFT) - 1))];
+}
+
+static inline guint kt_unicode_width(gunichar c)
+{
+        if (c < 0x7f)
+                return c >= 0x20;
+
+        return kt_unicode_props(c) & KT_UNICODE_WIDTH_MASK;
+}
+
+static inline KtGraphemeBreak kt_unicode_grapheme_break(gunichar c)
+{
+        if (c < 0x7f)
+                return c >= 0x20 ? KT_GCB_OTHER :
+                        c == '\r' ? KT_GCB_CR :
+                        c == '\n' ? KT_GCB_LF : KT_GCB_CONTROL;
+
+        return (kt_unicode_props(c) & KT_UNICODE_GCB_MASK) >>
+                KT_UNICODE_GCB_SHIFT;
+}
+
+static inline gboolean kt_unicode_is_pictographic(gunichar c)
+{
+        return c >= 0xa9 && (kt_unicode_props(c) & KT_UNICODE_PICTOGRAPHIC);
+}
+
+#endif /* KT_UNICODE_GEN */
+
+G_END_DECLS
+#endif /* KT_UNICODE_H */
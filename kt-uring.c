@@ -0,0 +1,399 @@
+/*
+ * kt-uring.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "kt-uring.h"
+#include "kt-util.h"
+
+#ifdef HAVE_LIBURING
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+
+#include <liburing.h>
+
+#define URING_ENTRIES 64
+/* For non-seekable files, read and write at the current position */
+#define URING_NO_OFFSET ((__u64)-1)
+/* How long kt_uring_free() waits for the cancelled requests */
+#define URING_CANCEL_TIMEOUT_SEC 1
+
+typedef struct {
+        KtUringWriteFunc func;
+        gpointer data;
+} UringWrite;
+
+struct _KtUring {
+        struct io_uring uring;
+        gint fd; /* pty master fd */
+        gint event_fd; /* completion notifications */
+        KtRing *ring;
+
+        gboolean read_pending;
+        gboolean eof;
+        gint err;
+        GQueue writes; /* UringWrites in flight */
+
+        guint queued; /* Submissions not yet handed to the kernel */
+        guint flush_source;
+
+        guint64 enter_calls; /* io_uring_enter() calls */
+};
+
+/* Tags the read and the cancel submissions, writes carry an UringWrite. */
+static gchar uring_read_tag;
+static gchar uring_cancel_tag;
+
+/* Private methods */
+static gboolean uring_flush_cb(KtUring *uring)
+{
+        uring->flush_source = 0;
+        kt_uring_submit(uring);
+
+        return G_SOURCE_REMOVE;
+}
+
+static struct io_uring_sqe *uring_get_sqe(KtUring *uring)
+{
+        struct io_uring_sqe *sqe;
+
+        sqe = io_uring_get_sqe(&uring->uring);
+        if (sqe == NULL) {
+                /* Submission queue full, flush it and try again */
+                kt_uring_submit(uring);
+                sqe = io_uring_get_sqe(&uring->uring);
+        }
+
+        return sqe;
+}
+
+static void uring_cancel(KtUring *uring, gpointer tag)
+{
+        struct io_uring_sqe *sqe;
+
+        sqe = uring_get_sqe(uring);
+        if (sqe == NULL)
+                return;
+
+        io_uring_prep_cancel(sqe, tag, 0);
+        io_uring_sqe_set_data(sqe, &uring_cancel_tag);
+        uring->queued++;
+}
+
+static void uring_complete_read(KtUring *uring, gint res, gsize *bytes_read)
+{
+        uring->read_pending = FALSE;
+
+        if (res > 0) {
+                kt_ring_commit(uring->ring, res);
+                *bytes_read += res;
+        } else if (res == 0 || res == -EIO) {
+                uring->eof = TRUE;
+        } else if (res != -EAGAIN && res != -EINTR) {
+                uring->err = -res;
+                uring->eof = TRUE;
+        }
+}
+
+/* Public methods */
+KtUring *kt_uring_new(gint fd, KtRing *ring)
+{
+        KtUring *uring;
+        long flags;
+        gint ret;
+
+        uring = NEW(KtUring, 1);
+        uring->fd = fd;
+        uring->ring = ring;
+        g_queue_init(&uring->writes);
+
+        ret = io_uring_queue_init(URING_ENTRIES, &uring->uring, 0);
+        if (ret < 0) {
+                warn("io_uring is not available: %s", g_strerror(-ret));
+                FREE(&uring);
+                return NULL;
+        }
+
+        uring->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (uring->event_fd == -1 ||
+            io_uring_register_eventfd(&uring->uring, uring->event_fd) < 0) {
+                error("Could not set up the io_uring eventfd.");
+                goto failed;
+        }
+
+        /* io_uring honours O_NONBLOCK and would fail reads with EAGAIN
+           instead of waiting for data, so let the kernel block for us. */
+        flags = fcntl(fd, F_GETFL);
+        if (flags & O_NONBLOCK)
+                fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+
+        kt_uring_arm_read(uring);
+        kt_uring_submit(uring);
+
+        return uring;
+
+failed:
+        if (uring->event_fd != -1)
+                close(uring->event_fd);
+        io_uring_queue_exit(&uring->uring);
+        FREE(&uring);
+        return NULL;
+}
+
+void kt_uring_free(KtUring *uring)
+{
+        struct __kernel_timespec timeout = {
+                .tv_sec = URING_CANCEL_TIMEOUT_SEC,
+        };
+        struct io_uring_cqe *cqe;
+        GList *l;
+
+        if (uring == NULL)
+                return;
+
+        if (uring->flush_source != 0)
+                g_source_remove(uring->flush_source);
+
+        /* The kernel may still be reading into the ring and writing from
+           buffers of the caller, which are about to go away. Cancel all
+           that is in flight and wait for the completions before the queue
+           is torn down. */
+        if (uring->read_pending)
+                uring_cancel(uring, &uring_read_tag);
+        for (l = uring->writes.head; l; l = l->next)
+                uring_cancel(uring, l->data);
+        kt_uring_submit(uring);
+
+        while (uring->read_pending || !g_queue_is_empty(&uring->writes)) {
+                gpointer tag;
+
+                if (io_uring_wait_cqe_timeout(&uring->uring, &cqe,
+                                              &timeout) < 0) {
+                        warn("io_uring requests did not complete in time.");
+                        break;
+                }
+
+                tag = io_uring_cqe_get_data(cqe);
+                if (tag == &uring_read_tag) {
+                        uring->read_pending = FALSE;
+                } else if (tag != &uring_cancel_tag) {
+                        g_queue_remove(&uring->writes, tag);
+                        g_free(tag);
+                }
+                io_uring_cqe_seen(&uring->uring, cqe);
+        }
+
+        g_queue_clear_full(&uring->writes, g_free);
+
+        io_uring_queue_exit(&uring->uring);
+        close(uring->event_fd);
+
+        FREE(&uring);
+}
+
+gint kt_uring_get_event_fd(KtUring *uring)
+{
+        return uring->event_fd;
+}
+
+/**
+ * kt_uring_arm_read: Queue a read into the free space of the ring, unless
+ * one is already in flight or the ring is full.
+ */
+void kt_uring_arm_read(KtUring *uring)
+{
+        struct io_uring_sqe *sqe;
+        guint8 *data;
+        gsize avail;
+
+        if (uring->read_pending || uring->eof)
+                return;
+
+        data = kt_ring_write_ptr(uring->ring, &avail);
+        if (avail == 0)
+                return;
+
+        sqe = uring_get_sqe(uring);
+        if (sqe == NULL)
+                return;
+
+        io_uring_prep_read(sqe, uring->fd, data,
+                           MIN(avail, G_MAXUINT32), URING_NO_OFFSET);
+        io_uring_sqe_set_data(sqe, &uring_read_tag);
+
+        uring->read_pending = TRUE;
+        uring->queued++;
+}
+
+/**
+ * kt_uring_queue_writev: Queue a write of iov. The iovec array and the
+ * buffers must stay valid until func is called.
+ *
+ * Writes queued during the same main loop iteration are handed to the
+ * kernel together.
+ *
+ * Returns: TRUE if queued, FALSE if not.
+ */
+gboolean kt_uring_queue_writev(KtUring *uring,
+                               const struct iovec *iov,
+                               gint iovcnt,
+                               KtUringWriteFunc func,
+                               gpointer data)
+{
+        struct io_uring_sqe *sqe;
+        UringWrite *write;
+
+        sqe = uring_get_sqe(uring);
+        if (sqe == NULL)
+                return FALSE;
+
+        write = g_new(UringWrite, 1);
+        write->func = func;
+        write->data = data;
+
+        io_uring_prep_writev(sqe, uring->fd, iov, iovcnt, URING_NO_OFFSET);
+        io_uring_sqe_set_data(sqe, write);
+        g_queue_push_tail(&uring->writes, write);
+
+        uring->queued++;
+
+        if (uring->flush_source == 0)
+                uring->flush_source = g_idle_add_full(G_PRIORITY_HIGH,
+                                                      (GSourceFunc)uring_flush_cb,
+                                                      uring,
+                                                      NULL);
+
+        return TRUE;
+}
+
+/**
+ * kt_uring_submit: Hand all the queued submissions to the kernel.
+ */
+void kt_uring_submit(KtUring *uring)
+{
+        if (uring->queued == 0)
+                return;
+
+        io_uring_submit(&uring->uring);
+        uring->enter_calls++;
+        uring->queued = 0;
+}
+
+/**
+ * kt_uring_reap: Process the completions. Data that was read is committed
+ * to the ring and its length is added to bytes_read.
+ *
+ * Returns: FALSE once the pty reached eof, TRUE otherwise.
+ */
+gboolean kt_uring_reap(KtUring *uring, gsize *bytes_read, gint *err)
+{
+        struct io_uring_cqe *cqe;
+        eventfd_t value;
+
+        eventfd_read(uring->event_fd, &value);
+
+        while (io_uring_peek_cqe(&uring->uring, &cqe) == 0) {
+                gpointer tag = io_uring_cqe_get_data(cqe);
+                gint res = cqe->res;
+
+                io_uring_cqe_seen(&uring->uring, cqe);
+
+                if (tag == &uring_read_tag) {
+                        uring_complete_read(uring, res, bytes_read);
+                } else {
+                        UringWrite *write = tag;
+
+                        g_queue_remove(&uring->writes, write);
+                        write->func(res, write->data);
+                        g_free(write);
+                }
+        }
+
+        if (err)
+                *err = uring->err;
+
+        return !uring->eof;
+}
+
+/**
+ * kt_uring_poke: Make the event fd readable, so that the main loop comes
+ * back for the data it left in the ring.
+ */
+void kt_uring_poke(KtUring *uring)
+{
+        eventfd_write(uring->event_fd, 1);
+}
+
+guint64 kt_uring_get_enter_calls(KtUring *uring)
+{
+        return uring->enter_calls;
+}
+
+#else /* HAVE_LIBURING */
+
+KtUring *kt_uring_new(gint fd, KtRing *ring)
+{
+        return NULL;
+}
+
+void kt_uring_free(KtUring *uring)
+{
+}
+
+gint kt_uring_get_event_fd(KtUring *uring)
+{
+        return -1;
+}
+
+void kt_uring_arm_read(KtUring *uring)
+{
+}
+
+gboolean kt_uring_queue_writev(KtUring *uring,
+                               const struct iovec *iov,
+                               gint iovcnt,
+                               KtUringWriteFunc func,
+                               gpointer data)
+{
+        return FALSE;
+}
+
+void kt_uring_submit(KtUring *uring)
+{
+}
+
+gboolean kt_uring_reap(KtUring *uring, gsize *bytes_read, gint *err)
+{
+        return FALSE;
+}
+
+void kt_uring_poke(KtUring *uring)
+{
+}
+
+guint64 kt_uring_get_enter_calls(KtUring *uring)
+{
+        return 0;
+}
+
+#endif /* HAVE_LIBURING */
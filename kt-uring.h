@@ -0,0 +1,68 @@
+/*
+ * kt-uring.h
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KT_URING_H
+#define KT_URING_H
+
+#include <glib.h>
+
+#include <sys/uio.h>
+
+#include "kt-ring.h"
+
+G_BEGIN_DECLS
+
+/*
+  io_uring backend for the master side of the pty.
+
+  Reads are submitted straight into the free region of the terminal's
+  KtRing, writes are queued as submissions and flushed together once per
+  main loop iteration. Completions are signalled through a single eventfd
+  that is watched by the main loop.
+
+  Only available when kixterm is built against liburing (HAVE_LIBURING),
+  kt_uring_new() returns NULL otherwise or if the kernel lacks io_uring.
+ */
+typedef struct _KtUring KtUring;
+
+/* Called with the number of bytes written or a negative errno. */
+typedef void (*KtUringWriteFunc)(gssize result, gpointer data);
+
+KtUring *kt_uring_new(gint fd, KtRing *ring);
+void kt_uring_free(KtUring *uring);
+
+gint kt_uring_get_event_fd(KtUring *uring);
+
+void kt_uring_arm_read(KtUring *uring);
+gboolean kt_uring_queue_writev(KtUring *uring,
+                               const struct iovec *iov,
+                               gint iovcnt,
+                               KtUringWriteFunc func,
+                               gpointer data);
+void kt_uring_submit(KtUring *uring);
+gboolean kt_uring_reap(KtUring *uring, gsize *bytes_read, gint *err);
+void kt_uring_poke(KtUring *uring);
+
+guint64 kt_uring_get_enter_calls(KtUring *uring);
+
+G_END_DECLS
+#endif /* KT_URING_H */
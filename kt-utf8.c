@@ -0,0 +1,411 @@
+/*
+ * kt-utf8.c
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "kt-utf8.h"
+#include "kt-util.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/*
+  Blocks of non-ASCII input are validated this many bytes at a time. A
+  valid block is then decoded without any further checks, up to the last
+  character boundary in it; anything else goes through the scalar decoder.
+ */
+#define VALIDATE_BLOCK 64
+
+/* Returns the length of the valid characters the block starts with, the
+   whole block less an unfinished last one, or 0 if it has an error */
+typedef gsize (*ValidateFunc)(const guint8 *p);
+
+static ValidateFunc validate_block;
+
+/* Private methods */
+
+/**
+ * utf8_decode_scalar: Decode with all the checks, byte by byte.
+ *
+ * Returns: The number of code points stored in out.
+ */
+static gsize utf8_decode_scalar(KtUtf8 *dec,
+                                const guint8 *p,
+                                const guint8 *end,
+                                gunichar *out)
+{
+        gunichar *o = out;
+
+        while (p < end) {
+                guint8 c = *p;
+
+                if (dec->need) {
+                        if (c < dec->lower || c > dec->upper) {
+                                /* The maximal subpart ends here, c starts
+                                   over. */
+                                *o++ = KT_UTF8_REPLACEMENT;
+                                dec->need = 0;
+                                continue;
+                        }
+
+                        dec->cp = dec->cp << 6 | (c & 0x3f);
+                        dec->lower = 0x80;
+                        dec->upper = 0xbf;
+                        if (--dec->need == 0)
+                                *o++ = dec->cp;
+                        p++;
+                        continue;
+                }
+
+                p++;
+
+                if (c < 0x80) {
+                        *o++ = c;
+                        continue;
+                }
+
+                dec->lower = 0x80;
+                dec->upper = 0xbf;
+
+                if (c >= 0xc2 && c <= 0xdf) {
+                        dec->need = 1;
+                        dec->cp = c & 0x1f;
+                } else if (c >= 0xe0 && c <= 0xef) {
+                        dec->need = 2;
+                        dec->cp = c & 0x0f;
+                        if (c == 0xe0)
+                                dec->lower = 0xa0; /* Overlong */
+                        else if (c == 0xed)
+                                dec->upper = 0x9f; /* Surrogates */
+                } else if (c >= 0xf0 && c <= 0xf4) {
+                        dec->need = 3;
+                        dec->cp = c & 0x07;
+                        if (c == 0xf0)
+                                dec->lower = 0x90; /* Overlong */
+                        else if (c == 0xf4)
+                                dec->upper = 0x8f; /* Above U+10FFFF */
+                } else {
+                        /* Continuation without a lead, C0, C1, F5..FF */
+                        *o++ = KT_UTF8_REPLACEMENT;
+                }
+        }
+
+        return o - out;
+}
+
+/**
+ * utf8_decode_valid: Decode input already known to be valid and complete.
+ */
+static gsize utf8_decode_valid(const guint8 *p,
+                               const guint8 *end,
+                               gunichar *out)
+{
+        gunichar *o = out;
+
+        while (p < end) {
+                guint8 c = *p;
+
+                if (c < 0x80) {
+                        *o++ = c;
+                        p++;
+                } else if (c < 0xe0) {
+                        *o++ = (c & 0x1f) << 6 | (p[1] & 0x3f);
+                        p += 2;
+                } else if (c < 0xf0) {
+                        *o++ = (c & 0x0f) << 12 | (p[1] & 0x3f) << 6 |
+                                (p[2] & 0x3f);
+                        p += 3;
+                } else {
+                        *o++ = (c & 0x07) << 18 | (p[1] & 0x3f) << 12 |
+                                (p[2] & 0x3f) << 6 | (p[3] & 0x3f);
+                        p += 4;
+                }
+        }
+
+        return o - out;
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * ascii_widen_sse2: Store the code points of a run of ASCII, 16 bytes at a
+ * time.
+ *
+ * Returns: The number of bytes (and code points) done.
+ */
+__attribute__((target("sse2")))
+static gsize ascii_widen_sse2(const guint8 *p, gsize length, gunichar *out)
+{
+        const __m128i zero = _mm_setzero_si128();
+        gsize done = 0;
+
+        while (length - done >= 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(p + done));
+                __m128i lo, hi;
+
+                if (_mm_movemask_epi8(v))
+                        break;
+
+                lo = _mm_unpacklo_epi8(v, zero);
+                hi = _mm_unpackhi_epi8(v, zero);
+                _mm_storeu_si128((__m128i *)(out + done),
+                                 _mm_unpacklo_epi16(lo, zero));
+                _mm_storeu_si128((__m128i *)(out + done + 4),
+                                 _mm_unpackhi_epi16(lo, zero));
+                _mm_storeu_si128((__m128i *)(out + done + 8),
+                                 _mm_unpacklo_epi16(hi, zero));
+                _mm_storeu_si128((__m128i *)(out + done + 12),
+                                 _mm_unpackhi_epi16(hi, zero));
+                done += 16;
+        }
+
+        return done;
+}
+
+/*
+  The lookup algorithm of Keiser and Lemire ("Validating UTF-8 in less
+  than one instruction per byte"). Every error shows up as a bit that is
+  set in all of three table lookups, indexed by the high and low nibble of
+  the previous byte and the high nibble of the current one. Overlong 3 and
+  4 byte sequences, surrogates and too large values are caught the same
+  way; missing or extra continuations of 3 and 4 byte sequences are
+  checked separately.
+ */
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS (1 << 7)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+__attribute__((target("ssse3")))
+static __m128i utf8_check_block(__m128i input, __m128i prev_input)
+{
+        const __m128i nibble = _mm_set1_epi8(0x0f);
+        const __m128i byte_1_high_table =
+                _mm_setr_epi8(TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+                              TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+                              TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+                              TOO_SHORT | OVERLONG_2,
+                              TOO_SHORT,
+                              TOO_SHORT | OVERLONG_3 | SURROGATE,
+                              TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+        const __m128i byte_1_low_table =
+                _mm_setr_epi8(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+                              CARRY | OVERLONG_2,
+                              CARRY,
+                              CARRY,
+                              CARRY | TOO_LARGE,
+                              CARRY | TOO_LARGE | TOO_LARGE_1000,
+                              CARRY | TOO_LARGE | TOO_LARGE_1000,
+                              CARRY | TOO_LARGE | TOO_LARGE_1000,
+                              CARRY | TOO_LARGE | TOO_LARGE_1000,
+                              CARRY | TOO_LARGE | TOO_LARGE_1000,
+                              CARRY | TOO_LARGE | TOO_LARGE_1000,
+                              CARRY | TOO_LARGE | TOO_LARGE_1000,
+                              CARRY | TOO_LARGE | TOO_LARGE_1000,
+                              CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+                              CARRY | TOO_LARGE | TOO_LARGE_1000,
+                              CARRY | TOO_LARGE | TOO_LARGE_1000);
+        const __m128i byte_2_high_table =
+                _mm_setr_epi8(TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                              TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                              TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 |
+                              TOO_LARGE_1000 | OVERLONG_4,
+                              TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 |
+                              TOO_LARGE,
+                              TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE |
+                              TOO_LARGE,
+                              TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE |
+                              TOO_LARGE,
+                              TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+        __m128i prev1, prev2, prev3;
+        __m128i byte_1_high, byte_1_low, byte_2_high, special;
+        __m128i third, fourth, must_be_cont;
+
+        prev1 = _mm_alignr_epi8(input, prev_input, 15);
+        byte_1_high = _mm_shuffle_epi8(byte_1_high_table,
+                                       _mm_and_si128(_mm_srli_epi16(prev1, 4),
+                                                     nibble));
+        byte_1_low = _mm_shuffle_epi8(byte_1_low_table,
+                                      _mm_and_si128(prev1, nibble));
+        byte_2_high = _mm_shuffle_epi8(byte_2_high_table,
+                                       _mm_and_si128(_mm_srli_epi16(input, 4),
+                                                     nibble));
+        special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low),
+                                byte_2_high);
+
+        /* The second and third continuation of 3 and 4 byte sequences */
+        prev2 = _mm_alignr_epi8(input, prev_input, 14);
+        prev3 = _mm_alignr_epi8(input, prev_input, 13);
+        third = _mm_subs_epu8(prev2, _mm_set1_epi8(0xe0 - 0x80));
+        fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(0xf0 - 0x80));
+        must_be_cont = _mm_and_si128(_mm_or_si128(third, fourth),
+                                     _mm_set1_epi8(0x80));
+
+        return _mm_xor_si128(must_be_cont, special);
+}
+
+/**
+ * validate_block_ssse3: Check that VALIDATE_BLOCK bytes, starting on a
+ * character boundary, are valid UTF-8. A character cut off by the end of
+ * the block is not an error, its bytes are left out.
+ *
+ * Returns: The length of the block up to its last character boundary, or 0
+ * if it is not valid.
+ */
+__attribute__((target("ssse3")))
+static gsize validate_block_ssse3(const guint8 *p)
+{
+        __m128i prev = _mm_setzero_si128();
+        __m128i error = _mm_setzero_si128();
+        __m128i input = prev;
+        gint i;
+
+        for (i = 0; i < VALIDATE_BLOCK; i += 16) {
+                input = _mm_loadu_si128((const __m128i *)(p + i));
+                error = _mm_or_si128(error, utf8_check_block(input, prev));
+                prev = input;
+        }
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) !=
+            0xffff)
+                return 0;
+
+        /* Leave out a lead byte in the last three bytes that isn't
+           finished, and its continuations */
+        if (p[VALIDATE_BLOCK - 1] >= 0xc0)
+                return VALIDATE_BLOCK - 1;
+        if (p[VALIDATE_BLOCK - 2] >= 0xe0)
+                return VALIDATE_BLOCK - 2;
+        if (p[VALIDATE_BLOCK - 3] >= 0xf0)
+                return VALIDATE_BLOCK - 3;
+
+        return VALIDATE_BLOCK;
+}
+#endif
+
+static ValidateFunc utf8_validate_select(void)
+{
+#ifdef HAVE_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("ssse3"))
+                return validate_block_ssse3;
+#endif
+        return NULL;
+}
+
+/* Public methods */
+void kt_utf8_init(KtUtf8 *dec)
+{
+        static gsize select_done = 0;
+
+        g_return_if_fail(dec != NULL);
+
+        if (g_once_init_enter(&select_done)) {
+                validate_block = utf8_validate_select();
+                g_once_init_leave(&select_done, 1);
+        }
+
+        MEMSET(dec, 1);
+}
+
+/**
+ * kt_utf8_decode: Decode length bytes of data into out, which must have room
+ * for length + 1 code points. A sequence left incomplete at the end is kept
+ * in the decoder.
+ *
+ * Returns: The number of code points stored in out.
+ */
+gsize kt_utf8_decode(KtUtf8 *dec,
+                     const guint8 *data,
+                     gsize length,
+                     gunichar *out)
+{
+        const guint8 *p = data;
+        const guint8 *end = data + length;
+        gunichar *o = out;
+
+        g_return_val_if_fail(dec != NULL, 0);
+
+        while (p < end) {
+                const guint8 *next;
+#ifdef HAVE_X86_SIMD
+                gsize valid;
+#endif
+
+                /* Finish what the last call or block left over */
+                if (dec->need) {
+                        next = MIN(p + dec->need, end);
+                        o += utf8_decode_scalar(dec, p, next, o);
+                        p = next;
+                        continue;
+                }
+
+#ifdef HAVE_X86_SIMD
+                if (*p < 0x80) {
+                        gsize done = ascii_widen_sse2(p, end - p, o);
+
+                        p += done;
+                        o += done;
+                        if (done)
+                                continue;
+                }
+
+                if (validate_block && end - p >= VALIDATE_BLOCK &&
+                    (valid = validate_block(p)) > 0) {
+                        o += utf8_decode_valid(p, p + valid, o);
+                        p += valid;
+                        continue;
+                }
+#endif
+
+                /* Up to the next block, or the end */
+                next = MIN(p + 16, end);
+                o += utf8_decode_scalar(dec, p, next, o);
+                p = next;
+        }
+
+        return o - out;
+}
+
+/**
+ * kt_utf8_flush: End the input. An incomplete sequence is replaced with
+ * U+FFFD.
+ *
+ * Returns: The number of code points stored in out, 0 or 1.
+ */
+gsize kt_utf8_flush(KtUtf8 *dec, gunichar *out)
+{
+        g_return_val_if_fail(dec != NULL, 0);
+
+        if (dec->need == 0)
+                return 0;
+
+        dec->need = 0;
+        *out = KT_UTF8_REPLACEMENT;
+
+        return 1;
+}
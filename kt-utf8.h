@@ -0,0 +1,62 @@
+/*
+ * kt-utf8.h
+ *
+ * Part of the kixterm project.
+ *
+ * Copyright © 2014 Partha Susarla <ajaysusarla@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef KT_UTF8_H
+#define KT_UTF8_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+  Incremental UTF-8 decoder for the output of the pty.
+
+  The input can be split anywhere, a sequence left incomplete at the end of
+  one call is finished by the next one. Invalid input is replaced with
+  U+FFFD following the "maximal subpart" practice of the Unicode standard
+  (section 3.9): one replacement character for each maximal prefix of a
+  valid sequence, and one for every other invalid byte.
+
+  The decoder is small and meant to be embedded in its user.
+ */
+#define KT_UTF8_REPLACEMENT 0xfffd
+
+typedef struct {
+        /* <private> */
+        gunichar cp; /* Code point decoded so far */
+        guint8 need; /* Continuation bytes still expected */
+        guint8 lower; /* Valid range of the next continuation byte */
+        guint8 upper;
+} KtUtf8;
+
+void kt_utf8_init(KtUtf8 *dec);
+
+/* out must have room for length + 1 code points */
+gsize kt_utf8_decode(KtUtf8 *dec,
+                     const guint8 *data,
+                     gsize length,
+                     gunichar *out);
+/* Ends an incomplete sequence, out must have room for 1 code point */
+gsize kt_utf8_flush(KtUtf8 *dec, gunichar *out);
+
+G_END_DECLS
+#endif /* KT_UTF8_H */
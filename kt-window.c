@@ -24,6 +24,12 @@
 #include "kt-terminal.h"
 #include "kt-util.h"
 #include "kt-buffer.h"
+#include "kt-parser.h"
+#include "kt-utf8.h"
+#include "kt-grid.h"
+#include "kt-scrollback.h"
+#include "kt-matcher.h"
+#include "kt-search.h"
 
 #include <xcb/xcb_icccm.h>
 #include <pango/pangocairo.h>
@@ -32,14 +38,34 @@ struct _KtWindowPrivate {
         xcb_window_t window;
         xcb_gcontext_t gc;
         xcb_rectangle_t geometry;
+        xcb_rectangle_t pending_geometry; /* From the last ConfigureNotify */
+        guint resize_source;
 
         /* Rendering */
         xcb_pixmap_t pixmap;
+        guint16 pixmap_width; /* The pixmap can be larger than the window */
+        guint16 pixmap_height;
         cairo_surface_t *surface;
         cairo_t *cairo;
         gboolean mapped;
 
         KtTerminal *terminal;
+        KtParser *parser;
+        KtUtf8 utf8; /* Decoder for the printed text */
+        KtGrid *grid; /* The screen shown, one of the two below */
+        KtGrid *primary;
+        KtGrid *alternate; /* Allocated on first use */
+        guint alternate_source; /* Frees the alternate screen when unused */
+        guint redraw_source;
+        gboolean redraw_all; /* The pixmap contents are lost */
+        guint cursor_row; /* Where the cursor was drawn */
+        KtMatcher *matcher; /* URLs and such to underline, or NULL */
+        KtSearch *search; /* Created on the first search */
+        GString *query; /* Typed after Ctrl+Shift+F, until Return */
+        GArray *found; /* KtSearchMatch on the screen, in absolute lines */
+        guint found_total;
+        guint64 parsed_bytes;
+        gint64 parse_usec; /* Time spent in the parser */
 
         /* Properites */
         KtApp *app;
@@ -60,9 +86,310 @@ G_DEFINE_TYPE_WITH_CODE(KtWindow, kt_window, G_TYPE_OBJECT,
                         G_ADD_PRIVATE(KtWindow));
 
 /* Private methods */
+
+/**
+ * key_to_string: Translate a key press into the bytes sent to the child.
+ *
+ * Returns: The number of bytes stored in buf.
+ */
+static gint key_to_string(xcb_keysym_t keysym, guint16 state, gchar *buf)
+{
+        const gchar *seq = NULL;
+        gint len = 0;
+
+        switch (keysym) {
+        case 0xff08: /* BackSpace */
+                seq = "\177";
+                break;
+        case 0xff09: /* Tab */
+                seq = "\t";
+                break;
+        case 0xff0d: /* Return */
+        case 0xff8d: /* KP_Enter */
+                seq = "\r";
+                break;
+        case 0xff1b: /* Escape */
+                seq = "\033";
+                break;
+        case 0xff51: /* Left */
+                seq = "\033[D";
+                break;
+        case 0xff52: /* Up */
+                seq = "\033[A";
+                break;
+        case 0xff53: /* Right */
+                seq = "\033[C";
+                break;
+        case 0xff54: /* Down */
+                seq = "\033[B";
+                break;
+        default:
+                break;
+        }
+
+        if (state & XCB_MOD_MASK_1)
+                buf[len++] = '\033';
+
+        if (seq) {
+                strcpy(buf + len, seq);
+                return len + strlen(seq);
+        }
+
+        if (keysym >= 0x20 && keysym <= 0x7e) {
+                gchar c = keysym;
+
+                if (state & XCB_MOD_MASK_CONTROL) {
+                        if (c >= 'a' && c <= 'z')
+                                c -= 'a' - 'A';
+                        if (c >= '@' && c <= '_')
+                                c &= 0x1f;
+                        else if (c == ' ')
+                                c = 0;
+                }
+                buf[len++] = c;
+        } else if (keysym >= 0xa0 && keysym <= 0xff) {
+                /* Latin-1 keysyms match their code points */
+                len += g_unichar_to_utf8(keysym, buf + len);
+        } else if ((keysym & 0xff000000) == 0x01000000) {
+                /* Unicode keysyms */
+                len += g_unichar_to_utf8(keysym & 0x00ffffff, buf + len);
+        } else {
+                /* Modifiers and keys we don't handle yet */
+                len = 0;
+        }
+
+        return len;
+}
+
+/**
+ * window_color_rgb: Resolve a cell colour to RGB. Indexes past the 16 ANSI
+ * colours are the xterm 6x6x6 cube and grey ramp.
+ */
+static kt_color_t window_color_rgb(KtWindow *window, guint32 color,
+                                   gboolean fg)
+{
+        static const guint8 cube[] = { 0x00, 0x5f, 0x87, 0xaf, 0xd7, 0xff };
+        KtPrefs *prefs = window->priv->prefs;
+        kt_color_t rgb;
+        guint i;
+
+        switch (KT_CELL_COLOR_KIND(color)) {
+        case KT_CELL_COLOR_KIND_INDEXED:
+                i = KT_CELL_COLOR_VALUE(color);
+                if (i < 16)
+                        return prefs->palette[i];
+                if (i < 232) {
+                        i -= 16;
+                        rgb.r = cube[i / 36];
+                        rgb.g = cube[i / 6 % 6];
+                        rgb.b = cube[i % 6];
+                } else {
+                        rgb.r = rgb.g = rgb.b = 8 + (i - 232) * 10;
+                }
+                return rgb;
+        case KT_CELL_COLOR_KIND_RGB:
+                i = KT_CELL_COLOR_VALUE(color);
+                rgb.r = i >> 16;
+                rgb.g = i >> 8;
+                rgb.b = i;
+                return rgb;
+        default:
+                return fg ? prefs->fg_color : prefs->bg_color;
+        }
+}
+
+static void window_set_source(KtWindow *window, guint32 color, gboolean fg)
+{
+        kt_color_t rgb = window_color_rgb(window, color, fg);
+
+        cairo_set_source_rgb(window->priv->cairo,
+                             rgb.r / 255.0, rgb.g / 255.0, rgb.b / 255.0);
+}
+
+/* The colours a style is drawn with, after reverse video */
+static void style_colors(const KtStyle *style, guint32 *fg, guint32 *bg,
+                         gboolean *fg_is_fg)
+{
+        if (style->attrs & KT_ATTR_REVERSE) {
+                *fg = style->bg;
+                *bg = style->fg;
+                *fg_is_fg = FALSE;
+        } else {
+                *fg = style->fg;
+                *bg = style->bg;
+                *fg_is_fg = TRUE;
+        }
+}
+
+/**
+ * render_line: Draw one line of the grid, in runs of cells sharing their
+ * style.
+ */
+static void render_line(KtWindow *window, PangoLayout *layout,
+                        const KtGridLine *line, guint row)
+{
+        KtWindowPrivate *priv = window->priv;
+        guint cols = kt_grid_get_cols(priv->grid);
+        gint width, height;
+        gdouble x0, y;
+        GString *text;
+        guint start, end;
+
+        kt_font_get_size(priv->font, &width, &height);
+        x0 = priv->prefs->bd_width;
+        y = priv->prefs->bd_width + row * height;
+
+        text = g_string_sized_new(cols * 4);
+
+        for (start = 0; start < cols; start = end) {
+                guint32 id = line->cells[start].style;
+                const KtStyle *style = kt_grid_get_style(priv->grid, id);
+                guint32 fg, bg;
+                gboolean fg_is_fg;
+
+                style_colors(style, &fg, &bg, &fg_is_fg);
+
+                g_string_truncate(text, 0);
+                for (end = start; end < cols; end++) {
+                        const KtCell *cell = &line->cells[end];
+
+                        if (cell->style != id)
+                                break;
+
+                        if (cell->ch & KT_CELL_WIDE_TAIL)
+                                continue;
+
+                        if (cell->ch & KT_CELL_CLUSTER) {
+                                const gunichar *chars;
+                                guint i, len;
+
+                                chars = kt_grid_get_cluster(priv->grid, cell,
+                                                            &len);
+                                for (i = 0; i < len; i++)
+                                        g_string_append_unichar(text,
+                                                                chars[i]);
+                        } else if (KT_CELL_CHAR(cell)) {
+                                g_string_append_unichar(text,
+                                                        KT_CELL_CHAR(cell));
+                        } else {
+                                g_string_append_c(text, ' ');
+                        }
+                }
+
+                window_set_source(window, bg, !fg_is_fg);
+                cairo_rectangle(priv->cairo, x0 + start * width, y,
+                                (end - start) * width, height);
+                cairo_fill(priv->cairo);
+
+                if (style->attrs & KT_ATTR_INVISIBLE)
+                        continue;
+
+                window_set_source(window, fg, fg_is_fg);
+                pango_layout_set_font_description(layout,
+                                                  kt_font_get_desc(priv->font,
+                                                                   style->attrs & KT_ATTR_BOLD,
+                                                                   style->attrs & KT_ATTR_ITALIC));
+                pango_layout_set_text(layout, text->str, text->len);
+                cairo_move_to(priv->cairo, x0 + start * width, y);
+                pango_cairo_show_layout(priv->cairo, layout);
+
+                if (style->attrs & KT_ATTR_UNDERLINE) {
+                        if (style->ul != KT_CELL_COLOR_DEFAULT)
+                                window_set_source(window, style->ul, TRUE);
+                        cairo_rectangle(priv->cairo, x0 + start * width,
+                                        y + height - 1,
+                                        (end - start) * width, 1);
+                        cairo_fill(priv->cairo);
+                }
+        }
+
+        g_string_free(text, TRUE);
+}
+
+/* Underline what the matcher found on a row */
+static void render_matches(KtWindow *window, guint row)
+{
+        KtWindowPrivate *priv = window->priv;
+        const KtMatchSpan *spans;
+        gint width, height;
+        guint i, n;
+
+        spans = kt_matcher_get_spans(priv->matcher, row, &n);
+        if (n == 0)
+                return;
+
+        kt_font_get_size(priv->font, &width, &height);
+
+        window_set_source(window, KT_CELL_COLOR_DEFAULT, TRUE);
+        for (i = 0; i < n; i++)
+                cairo_rectangle(priv->cairo,
+                                priv->prefs->bd_width + spans[i].start * width,
+                                priv->prefs->bd_width + (row + 1) * height - 1,
+                                (spans[i].end - spans[i].start) * width, 1);
+        cairo_fill(priv->cairo);
+}
+
+/* Frame the search matches on a row */
+static void render_search(KtWindow *window, guint row)
+{
+        KtWindowPrivate *priv = window->priv;
+        guint64 line = kt_grid_get_screen_line(priv->grid) + row;
+        guint cols = kt_grid_get_cols(priv->grid);
+        gint width, height;
+        guint i;
+
+        kt_font_get_size(priv->font, &width, &height);
+
+        window_set_source(window, KT_CELL_COLOR_DEFAULT, TRUE);
+        for (i = 0; i < priv->found->len; i++) {
+                const KtSearchMatch *match =
+                        &g_array_index(priv->found, KtSearchMatch, i);
+                guint start, end;
+
+                if (line < match->line || line > match->end_line)
+                        continue;
+
+                start = line == match->line ? match->col : 0;
+                end = line == match->end_line ? match->end_col + 1 : cols;
+                cairo_rectangle(priv->cairo,
+                                priv->prefs->bd_width + start * width + 0.5,
+                                priv->prefs->bd_width + row * height + 0.5,
+                                (end - start) * width - 1, height - 1);
+        }
+        cairo_stroke(priv->cairo);
+}
+
+static void render_cursor(KtWindow *window)
+{
+        KtWindowPrivate *priv = window->priv;
+        gint width, height;
+        guint row, col;
+
+        kt_font_get_size(priv->font, &width, &height);
+        kt_grid_get_cursor(priv->grid, &row, &col);
+
+        window_set_source(window, KT_CELL_COLOR_DEFAULT, TRUE);
+        cairo_rectangle(priv->cairo,
+                        priv->prefs->bd_width + col * width + 0.5,
+                        priv->prefs->bd_width + row * height + 0.5,
+                        width - 1, height - 1);
+        cairo_stroke(priv->cairo);
+
+        priv->cursor_row = row;
+}
+
+/**
+ * render_pixmap: Bring the pixmap up to date with the grid, drawing only
+ * the lines that changed.
+ */
 static void render_pixmap(KtWindow *window)
 {
         KtWindowPrivate *priv = window->priv;
+        PangoLayout *layout;
+        guint rows, row;
+
+        if (priv->grid == NULL)
+                return;
 
         priv->cairo = cairo_create(priv->surface);
         cairo_set_line_width(priv->cairo, 1.0);
@@ -71,7 +398,44 @@ static void render_pixmap(KtWindow *window)
         {
                 g_assert(cairo_status(priv->cairo) == 0);
 
-                /* TODO: Draw the terminal buffer contents here */
+                rows = kt_grid_get_rows(priv->grid);
+
+                if (priv->redraw_all) {
+                        window_set_source(window, KT_CELL_COLOR_DEFAULT, FALSE);
+                        cairo_paint(priv->cairo);
+                        for (row = 0; row < rows; row++)
+                                kt_grid_get_line(priv->grid, row)->flags |=
+                                        KT_LINE_DIRTY;
+                        priv->redraw_all = FALSE;
+                }
+
+                /* The old cursor has to go */
+                if (priv->cursor_row < rows)
+                        kt_grid_get_line(priv->grid, priv->cursor_row)->flags |=
+                                KT_LINE_DIRTY;
+
+                /* Marks the rows whose matches changed as well */
+                if (priv->matcher)
+                        kt_matcher_update(priv->matcher, priv->grid);
+
+                layout = pango_cairo_create_layout(priv->cairo);
+                for (row = 0; row < rows; row++) {
+                        KtGridLine *line = kt_grid_get_line(priv->grid, row);
+
+                        if (!(line->flags & KT_LINE_DIRTY))
+                                continue;
+
+                        render_line(window, layout, line, row);
+                        if (priv->matcher)
+                                render_matches(window, row);
+                        if (priv->found->len > 0 &&
+                            priv->grid == priv->primary)
+                                render_search(window, row);
+                        line->flags &= ~KT_LINE_DIRTY;
+                }
+                g_object_unref(layout);
+
+                render_cursor(window);
 
                 g_assert(cairo_status(priv->cairo) == 0);
         }
@@ -84,6 +448,25 @@ static void render_pixmap(KtWindow *window)
         g_assert(cairo_surface_status(priv->surface) == CAIRO_STATUS_SUCCESS);
 }
 
+static void free_pixmap_and_cairo_surface(KtWindow *window)
+{
+        KtWindowPrivate *priv = window->priv;
+
+        if (priv->surface) {
+                cairo_surface_destroy(priv->surface);
+                priv->surface = NULL;
+        }
+
+        if (priv->pixmap) {
+                xcb_free_pixmap(kt_app_get_x_connection(priv->app),
+                                priv->pixmap);
+                priv->pixmap = 0;
+        }
+
+        priv->pixmap_width = 0;
+        priv->pixmap_height = 0;
+}
+
 static void create_pixmap_and_cairo_surface(KtWindow *window)
 {
         KtWindowPrivate *priv = window->priv;
@@ -98,13 +481,15 @@ static void create_pixmap_and_cairo_surface(KtWindow *window)
         visual = kt_app_get_visual(priv->app);
 
         priv->pixmap = xcb_generate_id(con);
+        priv->pixmap_width = MAX(priv->pixmap_width, priv->geometry.width);
+        priv->pixmap_height = MAX(priv->pixmap_height, priv->geometry.height);
 
         cookie = xcb_create_pixmap_checked(con,
                                            screen->root_depth,
                                            priv->pixmap,
                                            screen->root,
-                                           priv->geometry.width,
-                                           priv->geometry.height);
+                                           priv->pixmap_width,
+                                           priv->pixmap_height);
 
         error = xcb_request_check(con, cookie);
         if (error) {
@@ -115,8 +500,8 @@ static void create_pixmap_and_cairo_surface(KtWindow *window)
         priv->surface = cairo_xcb_surface_create(con,
                                                  priv->pixmap,
                                                  visual,
-                                                 priv->geometry.width,
-                                                 priv->geometry.height);
+                                                 priv->pixmap_width,
+                                                 priv->pixmap_height);
         if (priv->surface == NULL) {
                 error("Could not create cairo surface...Exiting!");
                 return;
@@ -124,33 +509,694 @@ static void create_pixmap_and_cairo_surface(KtWindow *window)
 
         g_assert(cairo_surface_status(priv->surface) == CAIRO_STATUS_SUCCESS);
 
+        priv->redraw_all = TRUE;
         render_pixmap(window);
 }
 
-static void
-kt_window_draw_fg(KtTerminal *term, KtBuffer *buffer, KtWindow *window)
+static void window_copy_pixmap(KtWindow *window,
+                               gint16 x, gint16 y,
+                               guint16 width, guint16 height)
 {
         KtWindowPrivate *priv = window->priv;
+        xcb_connection_t *con = kt_app_get_x_connection(priv->app);
 
-        cairo_save(priv->cairo);
-        {
-                PangoLayout *layout;
-                layout = pango_cairo_create_layout(priv->cairo);
+        if (priv->pixmap == 0)
+                return;
+
+        xcb_copy_area(con, priv->pixmap, priv->window, priv->gc,
+                      x, y, x, y, width, height);
+        xcb_flush(con);
+}
+
+static gboolean window_redraw_cb(KtWindow *window)
+{
+        KtWindowPrivate *priv = window->priv;
+
+        priv->redraw_source = 0;
+
+        if (priv->surface == NULL)
+                return G_SOURCE_REMOVE;
+
+        render_pixmap(window);
+        window_copy_pixmap(window, 0, 0,
+                           priv->geometry.width, priv->geometry.height);
+
+        return G_SOURCE_REMOVE;
+}
+
+/* Redraw once the pending output has been handled */
+static void window_schedule_redraw(KtWindow *window)
+{
+        KtWindowPrivate *priv = window->priv;
+
+        if (priv->redraw_source != 0)
+                return;
+
+        priv->redraw_source = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+                                              (GSourceFunc)window_redraw_cb,
+                                              window,
+                                              NULL);
+}
+
+static void window_search_clear(KtWindow *window);
+
+/**
+ * window_resize_cb: Apply the last configured size. ConfigureNotify events
+ * come in bursts while the window is dragged; all of the ones handled
+ * during a main loop iteration end up here once.
+ */
+static gboolean window_resize_cb(KtWindow *window)
+{
+        KtWindowPrivate *priv = window->priv;
+        gint width, height;
+        gint rows, cols;
+
+        priv->resize_source = 0;
+
+        if (priv->pending_geometry.width == priv->geometry.width &&
+            priv->pending_geometry.height == priv->geometry.height)
+                return G_SOURCE_REMOVE;
+
+        priv->geometry.width = priv->pending_geometry.width;
+        priv->geometry.height = priv->pending_geometry.height;
+
+        /* Only reallocate when growing, and then with some room to spare
+           so that dragging the window larger doesn't do it every step. */
+        if (priv->mapped &&
+            (priv->geometry.width > priv->pixmap_width ||
+             priv->geometry.height > priv->pixmap_height)) {
+                guint16 pw = priv->pixmap_width;
+                guint16 ph = priv->pixmap_height;
+
+                free_pixmap_and_cairo_surface(window);
+                priv->pixmap_width =
+                        MIN(MAX(priv->geometry.width, pw + pw / 4), G_MAXUINT16);
+                priv->pixmap_height =
+                        MIN(MAX(priv->geometry.height, ph + ph / 4), G_MAXUINT16);
+                create_pixmap_and_cairo_surface(window);
+        } else if (priv->surface) {
+                render_pixmap(window);
         }
-        cairo_restore(priv->cairo);
+
+        kt_font_get_size(priv->font, &width, &height);
+
+        cols = (priv->geometry.width - 2 * priv->prefs->bd_width -
+                priv->prefs->sb_width) / width;
+        rows = (priv->geometry.height - 2 * priv->prefs->bd_width) / height;
+
+        rows = MAX(rows, 1);
+        cols = MAX(cols, 1);
+        /* The lines are rewrapped, the matches would be out of place */
+        window_search_clear(window);
+        kt_grid_resize(priv->primary, rows, cols);
+        if (priv->alternate)
+                kt_grid_resize(priv->alternate, rows, cols);
+        kt_terminal_set_size(priv->terminal, rows, cols);
+        priv->redraw_all = TRUE;
+        window_schedule_redraw(window);
+
+        return G_SOURCE_REMOVE;
 }
 
-static void
-on_tty_data_received(KtTerminal *term, KtBuffer *buffer, KtWindow *window)
+/* Search */
+/* Forget the matches, and redraw the rows they were on */
+static void window_search_clear(KtWindow *window)
 {
-        fprintf(stdout, "on_tty_data_received: %ld.\n",  buffer->length);
-        fprintf(stdout, "<< %s >>\n", buffer->data);
+        KtWindowPrivate *priv = window->priv;
+        guint64 screen = kt_grid_get_screen_line(priv->primary);
+        guint rows = kt_grid_get_rows(priv->primary);
+        guint i;
+
+        if (priv->search)
+                kt_search_cancel(priv->search);
+
+        for (i = 0; i < priv->found->len; i++) {
+                const KtSearchMatch *match =
+                        &g_array_index(priv->found, KtSearchMatch, i);
+                guint64 line;
+
+                for (line = MAX(match->line, screen);
+                     line <= match->end_line && line < screen + rows; line++)
+                        kt_grid_get_line(priv->primary, line - screen)->flags |=
+                                KT_LINE_DIRTY;
+        }
+
+        g_array_set_size(priv->found, 0);
+        priv->found_total = 0;
+        window_schedule_redraw(window);
+}
+
+/**
+ * window_search_found_cb: Keep the matches that are on the screen. There
+ * is no view of the history yet, so the others are only counted.
+ */
+static void window_search_found_cb(const KtSearchMatch *matches, guint n,
+                                   gboolean done, gpointer user_data)
+{
+        KtWindow *window = user_data;
+        KtWindowPrivate *priv = window->priv;
+        guint64 screen = kt_grid_get_screen_line(priv->primary);
+        guint rows = kt_grid_get_rows(priv->primary);
+        guint i;
+
+        priv->found_total += n;
+
+        for (i = 0; i < n; i++) {
+                KtSearchMatch match;
+                guint64 line;
 
-        window->priv->cairo = cairo_create(window->priv->surface);
-        kt_window_draw_fg(term, buffer, window);
-        cairo_destroy(window->priv->cairo);
+                if (!kt_grid_find_position(priv->primary, matches[i].end_line,
+                                           matches[i].end_col,
+                                           &match.end_line, &match.end_col) ||
+                    match.end_line < screen)
+                        continue;
+
+                if (!kt_grid_find_position(priv->primary, matches[i].line,
+                                           matches[i].col,
+                                           &match.line, &match.col))
+                        continue;
+
+                g_array_append_val(priv->found, match);
+
+                for (line = MAX(match.line, screen);
+                     line <= match.end_line && line < screen + rows; line++)
+                        kt_grid_get_line(priv->primary, line - screen)->flags |=
+                                KT_LINE_DIRTY;
+        }
+
+        if (priv->found->len > 0)
+                window_schedule_redraw(window);
+
+        if (done)
+                debug("Search found %u matches, %u of them on the screen.",
+                      priv->found_total, priv->found->len);
 }
 
+/* Look for the query in the primary screen and its history */
+static void window_search_start(KtWindow *window)
+{
+        KtWindowPrivate *priv = window->priv;
+        GError *err = NULL;
+
+        window_search_clear(window);
+
+        if (priv->query->len == 0)
+                return;
+
+        if (priv->search == NULL)
+                priv->search = kt_search_new(window_search_found_cb, window);
+        if (priv->search == NULL)
+                return;
+
+        if (!kt_search_start(priv->search, priv->primary, priv->query->str,
+                             KT_SEARCH_CASELESS, &err)) {
+                warn("Could not search: %s", err->message);
+                g_error_free(err);
+        }
+}
+
+/* Leave the query, the matches stay */
+static void window_search_leave(KtWindow *window)
+{
+        KtWindowPrivate *priv = window->priv;
+
+        g_string_free(priv->query, TRUE);
+        priv->query = NULL;
+}
+
+/**
+ * window_search_key: Edit the query while it's being typed. Return runs
+ * the search and Escape gives up on it, clearing the matches. Any other
+ * key that isn't text, Ctrl and Alt ones included, leaves the query alone
+ * and goes to the child as usual.
+ *
+ * Returns: TRUE if the key was taken, FALSE if the child should get it.
+ */
+static gboolean window_search_key(KtWindow *window, xcb_keysym_t keysym,
+                                  guint16 state)
+{
+        KtWindowPrivate *priv = window->priv;
+        gchar buf[16];
+        gint len;
+
+        switch (keysym) {
+        case 0xff0d: /* Return */
+        case 0xff8d: /* KP_Enter */
+                window_search_start(window);
+                window_search_leave(window);
+                return TRUE;
+        case 0xff1b: /* Escape */
+                window_search_clear(window);
+                window_search_leave(window);
+                return TRUE;
+        case 0xff08: /* BackSpace */
+                if (priv->query->len > 0) {
+                        const gchar *prev;
+
+                        prev = g_utf8_find_prev_char(priv->query->str,
+                                                     priv->query->str +
+                                                     priv->query->len);
+                        g_string_truncate(priv->query,
+                                          prev ? prev - priv->query->str : 0);
+                }
+                break;
+        default:
+                len = key_to_string(keysym, state, buf);
+                /* Shift and the other modifiers on their own */
+                if (len == 0)
+                        return TRUE;
+                if ((state & (XCB_MOD_MASK_CONTROL | XCB_MOD_MASK_1)) ||
+                    (guchar)buf[0] < 0x20 || buf[0] == 0x7f) {
+                        window_search_leave(window);
+                        return FALSE;
+                }
+                g_string_append_len(priv->query, buf, len);
+                break;
+        }
+
+        debug("Search: %s", priv->query->str);
+
+        return TRUE;
+}
+
+/* Parser callbacks */
+/* Decode this much of a run at a time */
+#define PRINT_CHUNK 1024
+
+/* Anything but text ends an unfinished character */
+static void window_flush_utf8(KtWindow *window)
+{
+        gunichar replacement;
+
+        if (kt_utf8_flush(&window->priv->utf8, &replacement))
+                kt_grid_put_chars(window->priv->grid, &replacement, 1);
+}
+
+static void window_print(const guint8 *data, gsize length, gpointer user_data)
+{
+        KtWindow *window = user_data;
+        gunichar chars[PRINT_CHUNK + 1];
+        gsize n;
+
+        while (length) {
+                gsize chunk = MIN(length, PRINT_CHUNK);
+
+                n = kt_utf8_decode(&window->priv->utf8, data, chunk, chars);
+                kt_grid_put_chars(window->priv->grid, chars, n);
+
+                data += chunk;
+                length -= chunk;
+        }
+}
+
+static void window_execute(guint8 c, gpointer user_data)
+{
+        KtWindow *window = user_data;
+        KtGrid *grid = window->priv->grid;
+
+        window_flush_utf8(window);
+
+        switch (c) {
+        case '\n':
+        case '\v':
+        case '\f':
+                kt_grid_newline(grid);
+                break;
+        case '\r':
+                kt_grid_carriage_return(grid);
+                break;
+        case '\b':
+                kt_grid_backspace(grid);
+                break;
+        case '\t':
+                kt_grid_tab(grid);
+                break;
+        default:
+                break;
+        }
+}
+
+/* How long an unused alternate screen is kept */
+#define ALTERNATE_RELEASE_SECONDS 60
+
+static gboolean window_release_alternate(gpointer user_data)
+{
+        KtWindow *window = user_data;
+        KtWindowPrivate *priv = window->priv;
+
+        debug("Releasing the unused alternate screen, %zu bytes.",
+              kt_grid_get_memory(priv->alternate));
+        kt_grid_free(priv->alternate);
+        priv->alternate = NULL;
+        priv->alternate_source = 0;
+
+        return G_SOURCE_REMOVE;
+}
+
+/**
+ * window_set_alternate: Switch to or from the alternate screen for DECSET
+ * mode 47, 1047 or 1049.
+ *
+ * The alternate grid is allocated on first use, without scrollback, and
+ * freed once it has not been used for ALTERNATE_RELEASE_SECONDS. Switching
+ * only changes which grid priv->grid points to: the primary one keeps its
+ * lines, cursor and pen in place meanwhile, which is all 1049 has to save
+ * and restore. The other modes carry the cursor and pen across, as they
+ * belong to the terminal rather than to a screen there.
+ */
+static void window_set_alternate(KtWindow *window, gint mode, gboolean on)
+{
+        KtWindowPrivate *priv = window->priv;
+        KtGrid *from = priv->grid;
+        KtGrid *to;
+        KtStyle pen;
+        guint row, col;
+
+        if (on == (priv->grid == priv->alternate))
+                return;
+
+        if (on) {
+                if (priv->alternate_source != 0) {
+                        g_source_remove(priv->alternate_source);
+                        priv->alternate_source = 0;
+                }
+
+                if (priv->alternate == NULL) {
+                        priv->alternate =
+                                kt_grid_new(kt_grid_get_rows(from),
+                                            kt_grid_get_cols(from), 0);
+                        debug("Alternate screen allocated, %zu bytes.",
+                              kt_grid_get_memory(priv->alternate));
+                }
+                to = priv->alternate;
+        } else {
+                /* 1047 leaves the alternate screen clean */
+                if (mode == 1047)
+                        kt_grid_erase_display(from, 2);
+                to = priv->primary;
+
+                priv->alternate_source =
+                        g_timeout_add_seconds(ALTERNATE_RELEASE_SECONDS,
+                                              window_release_alternate,
+                                              window);
+        }
+
+        if (mode != 1049 || on) {
+                kt_grid_get_cursor(from, &row, &col);
+                kt_grid_get_pen(from, &pen);
+                kt_grid_set_cursor(to, row, col);
+                kt_grid_set_pen(to, &pen);
+        }
+
+        if (mode == 1049 && on)
+                kt_grid_erase_display(to, 2);
+
+        priv->grid = to;
+        priv->redraw_all = TRUE;
+}
+
+/* DECSET and DECRST */
+static void window_set_private_modes(KtWindow *window, const gint *params,
+                                     gsize n_params, gboolean on)
+{
+        gsize i;
+
+        for (i = 0; i < n_params; i++) {
+                switch (params[i]) {
+                case 47:
+                case 1047:
+                case 1049:
+                        window_set_alternate(window, params[i], on);
+                        break;
+                default:
+                        break;
+                }
+        }
+}
+
+static void window_esc_dispatch(const guint8 *intermediates,
+                                gsize n_intermediates,
+                                guint8 final,
+                                gpointer user_data)
+{
+        KtWindow *window = user_data;
+        KtGrid *grid = window->priv->grid;
+        KtStyle pen;
+
+        window_flush_utf8(window);
+
+        if (n_intermediates)
+                return;
+
+        switch (final) {
+        case '7': /* DECSC */
+                kt_grid_save_cursor(grid);
+                break;
+        case '8': /* DECRC */
+                kt_grid_restore_cursor(grid);
+                break;
+        case 'D': /* IND */
+                kt_grid_newline(grid);
+                break;
+        case 'E': /* NEL */
+                kt_grid_carriage_return(grid);
+                kt_grid_newline(grid);
+                break;
+        case 'M': /* RI */
+                kt_grid_reverse_index(grid);
+                break;
+        case 'c': /* RIS */
+                window_set_alternate(window, 1049, FALSE);
+                grid = window->priv->grid;
+                MEMSET(&pen, 1);
+                kt_grid_set_pen(grid, &pen);
+                kt_grid_set_margins(grid, 0, 0);
+                kt_grid_erase_display(grid, 2);
+                break;
+        default:
+                break;
+        }
+}
+
+/**
+ * window_sgr: Select Graphic Rendition. Extended colours are taken in the
+ * 38;5;n and 38;2;r;g;b forms, for the underline colour too.
+ */
+static void window_sgr(KtWindow *window, const gint *params, gsize n)
+{
+        KtGrid *grid = window->priv->grid;
+        KtStyle pen;
+        guint32 attrs;
+        gsize i;
+
+        kt_grid_get_pen(grid, &pen);
+        attrs = pen.attrs;
+
+        if (n == 0) {
+                MEMSET(&pen, 1);
+                attrs = 0;
+        }
+
+        for (i = 0; i < n; i++) {
+                gint p = params[i];
+                guint32 *color = NULL;
+
+                switch (p) {
+                case 0:
+                        MEMSET(&pen, 1);
+                        attrs = 0;
+                        break;
+                case 1: attrs |= KT_ATTR_BOLD; break;
+                case 2: attrs |= KT_ATTR_DIM; break;
+                case 3: attrs |= KT_ATTR_ITALIC; break;
+                case 4: attrs |= KT_ATTR_UNDERLINE; break;
+                case 5: attrs |= KT_ATTR_BLINK; break;
+                case 7: attrs |= KT_ATTR_REVERSE; break;
+                case 8: attrs |= KT_ATTR_INVISIBLE; break;
+                case 9: attrs |= KT_ATTR_STRIKE; break;
+                case 22: attrs &= ~(KT_ATTR_BOLD | KT_ATTR_DIM); break;
+                case 23: attrs &= ~KT_ATTR_ITALIC; break;
+                case 24: attrs &= ~KT_ATTR_UNDERLINE; break;
+                case 25: attrs &= ~KT_ATTR_BLINK; break;
+                case 27: attrs &= ~KT_ATTR_REVERSE; break;
+                case 28: attrs &= ~KT_ATTR_INVISIBLE; break;
+                case 29: attrs &= ~KT_ATTR_STRIKE; break;
+                case 39: pen.fg = KT_CELL_COLOR_DEFAULT; break;
+                case 49: pen.bg = KT_CELL_COLOR_DEFAULT; break;
+                case 59: pen.ul = KT_CELL_COLOR_DEFAULT; break;
+                case 38: color = &pen.fg; break;
+                case 48: color = &pen.bg; break;
+                case 58: color = &pen.ul; break;
+                default:
+                        if (p >= 30 && p <= 37)
+                                pen.fg = KT_CELL_COLOR_INDEXED(p - 30);
+                        else if (p >= 40 && p <= 47)
+                                pen.bg = KT_CELL_COLOR_INDEXED(p - 40);
+                        else if (p >= 90 && p <= 97)
+                                pen.fg = KT_CELL_COLOR_INDEXED(p - 90 + 8);
+                        else if (p >= 100 && p <= 107)
+                                pen.bg = KT_CELL_COLOR_INDEXED(p - 100 + 8);
+                        break;
+                }
+
+                if (color == NULL)
+                        continue;
+
+                if (i + 2 < n && params[i + 1] == 5) {
+                        *color = KT_CELL_COLOR_INDEXED(params[i + 2]);
+                        i += 2;
+                } else if (i + 4 < n && params[i + 1] == 2) {
+                        *color = KT_CELL_COLOR_RGB(params[i + 2],
+                                                   params[i + 3],
+                                                   params[i + 4]);
+                        i += 4;
+                } else {
+                        break;
+                }
+        }
+
+        pen.attrs = attrs;
+        kt_grid_set_pen(grid, &pen);
+}
+
+static void window_csi_dispatch(const gint *params,
+                                gsize n_params,
+                                const guint8 *intermediates,
+                                gsize n_intermediates,
+                                guint8 final,
+                                gpointer user_data)
+{
+        KtWindow *window = user_data;
+        KtGrid *grid = window->priv->grid;
+        /* Most sequences take a count that defaults to 1 */
+        gint n = n_params > 0 && params[0] > 0 ? params[0] : 1;
+        gint m = n_params > 1 && params[1] > 0 ? params[1] : 1;
+        guint row, col;
+
+        window_flush_utf8(window);
+
+        if (n_intermediates == 1 && intermediates[0] == '?' &&
+            (final == 'h' || final == 'l')) {
+                window_set_private_modes(window, params, n_params,
+                                         final == 'h');
+                return;
+        }
+
+        /* Other private and intermediate sequences aren't handled yet */
+        if (n_intermediates)
+                return;
+
+        kt_grid_get_cursor(grid, &row, &col);
+
+        switch (final) {
+        case 'A': /* CUU */
+                kt_grid_move_cursor(grid, -n, 0);
+                break;
+        case 'B': /* CUD */
+        case 'e': /* VPR */
+                kt_grid_move_cursor(grid, n, 0);
+                break;
+        case 'C': /* CUF */
+        case 'a': /* HPR */
+                kt_grid_move_cursor(grid, 0, n);
+                break;
+        case 'D': /* CUB */
+                kt_grid_move_cursor(grid, 0, -n);
+                break;
+        case 'E': /* CNL */
+                kt_grid_set_cursor(grid, row + n, 0);
+                break;
+        case 'F': /* CPL */
+                kt_grid_set_cursor(grid, MAX((gint)row - n, 0), 0);
+                break;
+        case 'G': /* CHA */
+        case '`': /* HPA */
+                kt_grid_set_cursor(grid, row, n - 1);
+                break;
+        case 'H': /* CUP */
+        case 'f': /* HVP */
+                kt_grid_set_cursor(grid, n - 1, m - 1);
+                break;
+        case 'd': /* VPA */
+                kt_grid_set_cursor(grid, n - 1, col);
+                break;
+        case 'J': /* ED */
+                kt_grid_erase_display(grid, n_params ? params[0] : 0);
+                break;
+        case 'K': /* EL */
+                kt_grid_erase_line(grid, n_params ? params[0] : 0);
+                break;
+        case 'L': /* IL */
+                kt_grid_insert_lines(grid, n);
+                break;
+        case 'M': /* DL */
+                kt_grid_delete_lines(grid, n);
+                break;
+        case '@': /* ICH */
+                kt_grid_insert_chars(grid, n);
+                break;
+        case 'P': /* DCH */
+                kt_grid_delete_chars(grid, n);
+                break;
+        case 'X': /* ECH */
+                kt_grid_erase_chars(grid, n);
+                break;
+        case 'S': /* SU */
+                kt_grid_scroll_up(grid, n);
+                break;
+        case 'T': /* SD */
+                kt_grid_scroll_down(grid, n);
+                break;
+        case 'm': /* SGR */
+                window_sgr(window, params, n_params);
+                break;
+        case 'r': /* DECSTBM */
+                kt_grid_set_margins(grid, n - 1,
+                                    n_params > 1 && params[1] > 0 ?
+                                    params[1] - 1 :
+                                    kt_grid_get_rows(grid) - 1);
+                break;
+        case 's': /* SCOSC */
+                kt_grid_save_cursor(grid);
+                break;
+        case 'u': /* SCORC */
+                kt_grid_restore_cursor(grid);
+                break;
+        default:
+                break;
+        }
+}
+
+static const KtParserCallbacks parser_callbacks = {
+        .print = window_print,
+        .execute = window_execute,
+        .esc_dispatch = window_esc_dispatch,
+        .csi_dispatch = window_csi_dispatch,
+};
+
+static gsize on_tty_data_received(KtTerminal *term,
+                                  const guint8 *data,
+                                  gsize length,
+                                  gpointer user_data)
+{
+        KtWindow *window = user_data;
+        KtWindowPrivate *priv = window->priv;
+        gint64 start;
+
+        start = g_get_monotonic_time();
+        kt_parser_feed(priv->parser, data, length);
+        priv->parse_usec += g_get_monotonic_time() - start;
+        priv->parsed_bytes += length;
+
+        window_schedule_redraw(window);
+
+        return length;
+}
+
+static const KtTerminalSink tty_sink = {
+        on_tty_data_received,
+};
+
 /* Class methods */
 static void kt_window_get_property(GObject *obj,
                                    guint param_id,
@@ -226,6 +1272,17 @@ static void kt_window_finalize(GObject *object)
 
         con = kt_app_get_x_connection(priv->app);
 
+        if (priv->resize_source != 0)
+                g_source_remove(priv->resize_source);
+
+        if (priv->redraw_source != 0)
+                g_source_remove(priv->redraw_source);
+
+        if (priv->alternate_source != 0)
+                g_source_remove(priv->alternate_source);
+
+        free_pixmap_and_cairo_surface(window);
+
         xcb_destroy_window(con, priv->window);
         xcb_free_gc(con, priv->gc);
 
@@ -234,6 +1291,46 @@ static void kt_window_finalize(GObject *object)
         if (priv->terminal)
                 g_object_unref(priv->terminal);
 
+        if (priv->parse_usec > 0)
+                debug("Parsed %" G_GUINT64_FORMAT " bytes at %.1f MB/s.",
+                      priv->parsed_bytes,
+                      (gdouble)priv->parsed_bytes / priv->parse_usec);
+        kt_parser_free(priv->parser);
+        if (priv->primary) {
+                gsize alternate = 0, budget, used;
+                guint64 dropped;
+                guint stores;
+
+                if (priv->alternate)
+                        alternate = kt_grid_get_memory(priv->alternate);
+                debug("Screens held %zu bytes, %zu of them the alternate"
+                      " one.", kt_grid_get_memory(priv->primary) + alternate,
+                      alternate);
+
+                kt_scrollback_get_budget(&budget, &used, &stores, &dropped);
+                if (budget > 0)
+                        debug("Scrollback of %u terminals held %zu of %zu "
+                              "bytes, %" G_GUINT64_FORMAT " lines dropped "
+                              "to fit.", stores, used, budget, dropped);
+        }
+        /* Before the grid its matches are found in */
+        kt_search_free(priv->search);
+        if (priv->query)
+                g_string_free(priv->query, TRUE);
+        g_array_unref(priv->found);
+        kt_grid_free(priv->primary);
+        kt_grid_free(priv->alternate);
+
+        if (priv->matcher) {
+                guint64 scanned, kept;
+
+                kt_matcher_get_stats(priv->matcher, &scanned, &kept);
+                debug("Matched %" G_GUINT64_FORMAT " rows, %" G_GUINT64_FORMAT
+                      " more changed rows were found as they were.",
+                      scanned, kept);
+                kt_matcher_free(priv->matcher);
+        }
+
         if (priv->app)
                 g_object_unref(priv->app);
         if (priv->prefs)
@@ -301,11 +1398,30 @@ static void kt_window_init(KtWindow *window)
         priv->window = 0;
         priv->gc = 0;
         priv->pixmap = 0;
+        priv->pixmap_width = 0;
+        priv->pixmap_height = 0;
+        priv->resize_source = 0;
         priv->surface = NULL;
         priv->cairo = NULL;
         priv->mapped = FALSE;
 
         priv->terminal = NULL;
+        priv->parser = NULL;
+        kt_utf8_init(&priv->utf8);
+        priv->grid = NULL;
+        priv->primary = NULL;
+        priv->alternate = NULL;
+        priv->alternate_source = 0;
+        priv->redraw_source = 0;
+        priv->redraw_all = TRUE;
+        priv->cursor_row = 0;
+        priv->matcher = NULL;
+        priv->search = NULL;
+        priv->query = NULL;
+        priv->found = g_array_new(FALSE, FALSE, sizeof(KtSearchMatch));
+        priv->found_total = 0;
+        priv->parsed_bytes = 0;
+        priv->parse_usec = 0;
 }
 
 /* Public methods */
@@ -368,6 +1484,7 @@ KtWindow *kt_window_new(KtApp *app,
                 priv->prefs->sb_width;
         priv->geometry.height = 2 * priv->prefs->bd_width +
                 priv->prefs->rows * height;
+        priv->pending_geometry = priv->geometry;
 
         win_vals[0] = kt_color_get_bg_pixel(color);
         win_vals[6] = kt_app_get_normal_cursor(app);
@@ -415,14 +1532,39 @@ KtWindow *kt_window_new(KtApp *app,
                 goto failed;
         }
 
+        priv->parser = kt_parser_new(&parser_callbacks, win);
+        priv->primary = kt_grid_new(priv->prefs->rows, priv->prefs->cols,
+                                    priv->prefs->scrollback_lines);
+        priv->grid = priv->primary;
+        if (priv->prefs->scrollback_spill_mb > 0) {
+                KtSpill *spill;
+
+                spill = kt_spill_new((gsize)priv->prefs->scrollback_spill_mb
+                                     << 20);
+                if (spill)
+                        kt_grid_set_spill(priv->primary, spill);
+        }
+        kt_grid_set_history_bytes(priv->primary,
+                                  (gsize)priv->prefs->scrollback_mb << 20);
+
+        if (priv->prefs->highlight_matches) {
+                GError *err = NULL;
+
+                priv->matcher = kt_matcher_new(priv->prefs->match_pattern,
+                                               &err);
+                if (priv->matcher == NULL) {
+                        warn("Not highlighting matches: %s", err->message);
+                        g_error_free(err);
+                }
+        }
+
         /* Create terminal */
         priv->terminal = kt_terminal_new(priv->prefs, priv->window);
         if (priv->terminal == NULL) {
                 error("Could not create terminal.");
                 goto failed;
         }
-        g_signal_connect(priv->terminal, "got-tty-data",
-                         G_CALLBACK(on_tty_data_received), win);
+        kt_terminal_set_sink(priv->terminal, &tty_sink, win);
 
         /* Map the window */
         cookie = xcb_map_window(con, priv->window);
@@ -444,6 +1586,37 @@ failed:
 
 void kt_window_key_press(KtWindow *window, xcb_key_press_event_t *event)
 {
+        KtWindowPrivate *priv;
+        xcb_keysym_t keysym;
+        gchar buf[16];
+        gint len;
+
+        g_return_if_fail(KT_IS_WINDOW(window));
+
+        priv = window->priv;
+
+        keysym = xcb_key_symbols_get_keysym(kt_app_get_key_symbols(priv->app),
+                                            event->detail,
+                                            (event->state & XCB_MOD_MASK_SHIFT) ?
+                                            1 : 0);
+
+        /* Ctrl+Shift+F starts typing a search, the text keys go to it
+           then */
+        if ((event->state & XCB_MOD_MASK_CONTROL) &&
+            (event->state & XCB_MOD_MASK_SHIFT) &&
+            (keysym == 'F' || keysym == 'f')) {
+                if (priv->query == NULL)
+                        priv->query = g_string_new(NULL);
+                g_string_truncate(priv->query, 0);
+                return;
+        }
+
+        if (priv->query && window_search_key(window, keysym, event->state))
+                return;
+
+        len = key_to_string(keysym, event->state, buf);
+        if (len > 0)
+                kt_terminal_write(priv->terminal, buf, len);
 }
 
 void kt_window_key_release(KtWindow *window, xcb_key_release_event_t *event)
@@ -464,6 +1637,10 @@ void kt_window_motion_notify(KtWindow *window, xcb_motion_notify_event_t *event)
 
 void kt_window_expose(KtWindow *window, xcb_expose_event_t *event)
 {
+        g_return_if_fail(KT_IS_WINDOW(window));
+
+        window_copy_pixmap(window, event->x, event->y,
+                           event->width, event->height);
 }
 
 void kt_window_enter_notify(KtWindow *window, xcb_enter_notify_event_t *event)
@@ -507,6 +1684,26 @@ void kt_window_unmap_notify(KtWindow *window, xcb_unmap_notify_event_t *event)
 
 void kt_window_configure_notify(KtWindow *window, xcb_configure_notify_event_t *event)
 {
+        KtWindowPrivate *priv;
+
+        g_return_if_fail(KT_IS_WINDOW(window));
+
+        priv = window->priv;
+
+        priv->pending_geometry.width = event->width;
+        priv->pending_geometry.height = event->height;
+
+        if (priv->resize_source != 0 ||
+            (event->width == priv->geometry.width &&
+             event->height == priv->geometry.height))
+                return;
+
+        /* kt_poll() drains the X queue before anything else is dispatched,
+           so this runs once after the whole batch of events. */
+        priv->resize_source = g_idle_add_full(G_PRIORITY_HIGH_IDLE,
+                                              (GSourceFunc)window_resize_cb,
+                                              window,
+                                              NULL);
 }
 
 void kt_window_destroy_notify(KtWindow *window, xcb_destroy_notify_event_t *event)
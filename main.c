@@ -33,6 +33,8 @@
 #include "kt-font.h"
 #include "kt-color.h"
 #include "kt-window.h"
+#include "kt-pty-pool.h"
+#include "kt-scrollback.h"
 
 #include <xcb/xcb_event.h>
 
@@ -47,6 +49,7 @@ struct kixterm_t {
         KtWindow *win;
         KtFont *font;
         KtColor *color;
+        KtPtyPool *pool; /* Prespawned shells, may be NULL */
 };
 
 struct kixterm_t kixterm;
@@ -59,6 +62,8 @@ static void cleanup(void)
         g_object_unref(kixterm.prefs);
         g_object_unref(kixterm.win);
         g_object_unref(kixterm.color);
+        if (kixterm.pool)
+                g_object_unref(kixterm.pool);
         debug("...Done!!");
 }
 
@@ -254,6 +259,13 @@ int main(int argc, char **argv)
         kixterm.app = kt_app_new();
         /* Preferences */
         kixterm.prefs = kt_prefs_new();
+        /* Prespawned shells. The first one starts up while we load the
+           fonts and create the window, whose terminal then takes it. */
+        if (kixterm.prefs->pty_pool_size > 0)
+                kixterm.pool = kt_pty_pool_new(kixterm.prefs);
+        /* History in memory, shared by all the terminals */
+        kt_scrollback_set_budget((gsize)kixterm.prefs->scrollback_total_mb
+                                 << 20);
         /* Font */
         kixterm.font = kt_font_new(kixterm.app, kixterm.prefs);
         /* Color */